@@ -29,6 +29,11 @@
 #include "pango-impl-utils.h"
 #include <string.h>
 
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2_INTRINSICS 1
+#include <emmintrin.h>
+#endif
+
 /* {{{ Unicode line breaking and segmentation */
 
 #define PARAGRAPH_SEPARATOR 0x2029
@@ -129,6 +134,60 @@ static const CharJamoProps HangulJamoProps[] = {
 #define EMOJI(wc) (_pango_Is_Emoji_Base_Character (wc))
 #define BACKSPACE_DELETES_CHARACTER(wc) (!LATIN (wc) && !CYRILLIC (wc) && !GREEK (wc) && !KANA (wc) && !HANGUL (wc) && !EMOJI (wc))
 
+/* ASCII letters make up most of the text we see, and an ASCII letter
+ * that follows another ASCII letter always gets the same log attrs: a
+ * cursor position and char break, but no word, sentence or line boundary,
+ * and a hyphen is inserted if we break there. default_break() fills such
+ * runs in bulk instead of going through the full state machine.
+ */
+#define ASCII_ALPHA(wc) ((wc) < 0x80 && (guint) (((wc) | 0x20) - 'a') < 26)
+
+static const PangoLogAttr ascii_letter_attr = {
+  .is_char_break = TRUE,
+  .is_cursor_position = TRUE,
+  .break_inserts_hyphen = TRUE,
+};
+
+/* Returns the number of ASCII letters at the start of @p.
+ * @end may be %NULL if the text is nul-terminated.
+ */
+static inline int
+scan_ascii_letters (const char *p,
+                    const char *end)
+{
+  const char *start = p;
+
+#ifdef HAVE_SSE2_INTRINSICS
+  if (end)
+    {
+      const __m128i before_a = _mm_set1_epi8 ('a' - 1);
+      const __m128i after_z = _mm_set1_epi8 ('z' + 1);
+      const __m128i case_bit = _mm_set1_epi8 (0x20);
+
+      /* Bytes >= 0x80 are negative as signed chars, so they
+       * never compare as letters.
+       */
+      while (end - p >= 16)
+        {
+          __m128i chunk = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) p), case_bit);
+          __m128i alpha = _mm_and_si128 (_mm_cmpgt_epi8 (chunk, before_a),
+                                         _mm_cmplt_epi8 (chunk, after_z));
+          guint mask = (guint) _mm_movemask_epi8 (alpha);
+
+          if (mask != 0xffff)
+            return (p - start) + g_bit_nth_lsf (~mask, -1);
+
+          p += 16;
+        }
+    }
+#endif
+
+  while ((!end || p < end) && ASCII_ALPHA ((guchar) *p))
+    p++;
+
+  return p - start;
+}
+
 /* Previously "123foo" was two words. But in UAX 29 of Unicode, 
  * we know don't break words between consecutive letters and numbers
  */
@@ -299,6 +358,57 @@ default_break (const char    *text,
 
       PangoScript script;
 
+      /* Bulk-process ASCII letters following an ASCII letter, see
+       * ascii_letter_attr. All the state checked here is what a
+       * preceding ASCII letter leaves behind, unless it was itself
+       * glued to something before it.
+       */
+      if (!almost_done &&
+          ASCII_ALPHA (next_wc) &&
+          ASCII_ALPHA (prev_wc) &&
+          prev_GB_type == GB_Other &&
+          !met_Extended_Pictographic &&
+          prev_WB_type == WB_ALetter && prev_WB_i == i - 1 &&
+          prev_break_type == G_UNICODE_BREAK_ALPHABETIC &&
+          prev_LB_type == LB_Other &&
+          current_word_type == WordLetters &&
+          !prev_space_or_hyphen)
+        {
+          int n, j;
+
+          n = scan_ascii_letters (next, length >= 0 ? text + length : NULL);
+
+          for (j = i; j < i + n; j++)
+            attrs[j] = ascii_letter_attr;
+
+          if (last_sentence_start == -1)
+            last_sentence_start = i - 1;
+
+          i += n - 1;
+          next += n;
+
+          prev_wc = (guchar) next[-1];
+          base_character = prev_wc;
+          last_word_letter = prev_wc;
+          prev_prev_break_type = G_UNICODE_BREAK_ALPHABETIC;
+          prev_prev_WB_type = WB_ALetter;
+          prev_WB_i = i;
+          last_non_space = i;
+
+          if ((length >= 0 && next >= text + length) || *next == '\0')
+            {
+              next_wc = PARAGRAPH_SEPARATOR;
+              almost_done = TRUE;
+            }
+          else
+            next_wc = g_utf8_get_char (next);
+
+          next_break_type = g_unichar_break_type (next_wc);
+          next_break_type = BREAK_TYPE_SAFE (next_break_type);
+
+          continue;
+        }
+
       wc = next_wc;
       break_type = next_break_type;
 
@@ -1781,351 +1891,408 @@ remove_breaks_from_range (const char   *text,
     }
 }
 
-static gboolean
-handle_allow_breaks (const char    *text,
-                     int            length,
-                     PangoAttrList *attrs,
-                     int            offset,
-                     PangoLogAttr  *log_attrs,
-                     int            log_attrs_len)
+/* The attribute handlers below take character positions, which
+ * we compute with a cursor that moves back and forth from the last
+ * position we looked at. Attributes are visited in order of their
+ * start index, so this avoids walking the text from its beginning
+ * for every attribute.
+ */
+typedef struct
 {
-  PangoAttrIterator iter;
-  gboolean tailored = FALSE;
-
-  _pango_attr_list_get_iterator (attrs, &iter);
+  const char *text;
+  guint length;
+  guint offset;
+  int log_attrs_len;
+
+  const char *cursor;
+  int cursor_pos;
+} BreakAttrsState;
+
+static int
+break_attrs_state_get_pos (BreakAttrsState *state,
+                           const char      *p)
+{
+  state->cursor_pos += g_utf8_pointer_to_offset (state->cursor, p);
+  state->cursor = p;
 
-  do
-    {
-      const PangoAttribute *attr = pango_attr_iterator_get (&iter, PANGO_ATTR_ALLOW_BREAKS);
+  return state->cursor_pos;
+}
 
-      if (!attr)
-        continue;
+static void
+break_attrs_state_get_positions (BreakAttrsState *state,
+                                 guint            start,
+                                 guint            end,
+                                 int             *start_pos,
+                                 int             *end_pos)
+{
+  if (start < state->offset)
+    *start_pos = 0;
+  else
+    *start_pos = break_attrs_state_get_pos (state, state->text + start - state->offset);
 
-      if (!((PangoAttrInt*)attr)->value)
-        {
-          int start, end;
-          int start_pos, end_pos;
-          int pos;
-
-          start = attr->start_index;
-          end = attr->end_index;
-          if (start < offset)
-            start_pos = 0;
-          else
-            start_pos = g_utf8_pointer_to_offset (text, text + start - offset);
-          if (end >= offset + length)
-            end_pos = log_attrs_len;
-          else
-            end_pos = g_utf8_pointer_to_offset (text, text + end - offset);
+  if (end >= state->offset + state->length)
+    *end_pos = state->log_attrs_len;
+  else
+    *end_pos = break_attrs_state_get_pos (state, state->text + end - state->offset);
+}
 
-          for (pos = start_pos + 1; pos < end_pos; pos++)
-            log_attrs[pos].is_char_break = FALSE;
+static void
+break_attrs_state_get_range (BreakAttrsState      *state,
+                             const PangoAttribute *attr,
+                             int                  *start_pos,
+                             int                  *end_pos)
+{
+  break_attrs_state_get_positions (state, attr->start_index, attr->end_index,
+                                   start_pos, end_pos);
+}
 
-          remove_breaks_from_range (text, MAX (start - offset, 0), log_attrs, start_pos, end_pos);
+static gboolean
+handle_allow_breaks (BreakAttrsState *state,
+                     int              start_pos,
+                     int              end_pos,
+                     guint            start,
+                     PangoLogAttr    *log_attrs)
+{
+  int pos;
 
-          tailored = TRUE;
-        }
-    }
-  while (pango_attr_iterator_next (&iter));
+  for (pos = start_pos + 1; pos < end_pos; pos++)
+    log_attrs[pos].is_char_break = FALSE;
 
-  _pango_attr_iterator_destroy (&iter);
+  remove_breaks_from_range (state->text, start >= state->offset ? start - state->offset : 0, log_attrs,
+                            start_pos, end_pos);
 
-  return tailored;
+  return TRUE;
 }
 
-
 static gboolean
-handle_words (const char    *text,
-              int            length,
-              PangoAttrList *attrs,
-              int            offset,
-              PangoLogAttr  *log_attrs,
-              int            log_attrs_len)
+handle_word (BreakAttrsState      *state,
+             const PangoAttribute *attr,
+             PangoLogAttr         *log_attrs)
 {
-  PangoAttrIterator iter;
+  guint start, end;
+  int start_pos, end_pos;
+  int pos;
   gboolean tailored = FALSE;
 
-  _pango_attr_list_get_iterator (attrs, &iter);
+  start = attr->start_index;
+  end = attr->end_index;
+  break_attrs_state_get_range (state, attr, &start_pos, &end_pos);
 
-  do
+  for (pos = start_pos + 1; pos < end_pos; pos++)
     {
-      const PangoAttribute *attr = pango_attr_iterator_get (&iter, PANGO_ATTR_WORD);
-      int start, end;
-      int start_pos, end_pos;
-      int pos;
-
-      if (!attr)
-        continue;
-
-      start = attr->start_index;
-      end = attr->end_index;
-      if (start < offset)
-        start_pos = 0;
-      else
-        start_pos = g_utf8_pointer_to_offset (text, text + start - offset);
-      if (end >= offset + length)
-        end_pos = log_attrs_len;
-      else
-        end_pos = g_utf8_pointer_to_offset (text, text + end - offset);
-
-      for (pos = start_pos + 1; pos < end_pos; pos++)
-        {
-          log_attrs[pos].is_word_start = FALSE;
-          log_attrs[pos].is_word_end = FALSE;
-          log_attrs[pos].is_word_boundary = FALSE;
-        }
+      log_attrs[pos].is_word_start = FALSE;
+      log_attrs[pos].is_word_end = FALSE;
+      log_attrs[pos].is_word_boundary = FALSE;
+    }
 
-      remove_breaks_from_range (text, MAX (start - offset, 0), log_attrs,
-                                start_pos, end_pos);
+  remove_breaks_from_range (state->text, start >= state->offset ? start - state->offset : 0, log_attrs,
+                            start_pos, end_pos);
 
-      if (start >= offset)
+  if (start >= state->offset)
+    {
+      gboolean in_word = FALSE;
+      for (pos = start_pos; pos >= 0; pos--)
         {
-          gboolean in_word = FALSE;
-          for (pos = start_pos; pos >= 0; pos--)
+          if (log_attrs[pos].is_word_end)
             {
-              if (log_attrs[pos].is_word_end)
-                {
-                  in_word = pos == start_pos;
-                  break;
-                }
-              if (pos < start_pos && log_attrs[pos].is_word_start)
-                {
-                  in_word = TRUE;
-                  break;
-                }
+              in_word = pos == start_pos;
+              break;
             }
-          log_attrs[start_pos].is_word_start = TRUE;
-          log_attrs[start_pos].is_word_end = in_word;
-          log_attrs[start_pos].is_word_boundary = TRUE;
+          if (pos < start_pos && log_attrs[pos].is_word_start)
+            {
+              in_word = TRUE;
+              break;
+            }
+        }
+      log_attrs[start_pos].is_word_start = TRUE;
+      log_attrs[start_pos].is_word_end = in_word;
+      log_attrs[start_pos].is_word_boundary = TRUE;
 
-          /* Allow line breaks before words */
-          if (start_pos > 0)
-            log_attrs[start_pos].is_line_break = TRUE;
+      /* Allow line breaks before words */
+      if (start_pos > 0)
+        log_attrs[start_pos].is_line_break = TRUE;
 
-          tailored = TRUE;
-        }
+      tailored = TRUE;
+    }
 
-      if (end < offset + length)
+  if (end < state->offset + state->length)
+    {
+      gboolean in_word = FALSE;
+      for (pos = end_pos; pos < state->log_attrs_len; pos++)
         {
-          gboolean in_word = FALSE;
-          for (pos = end_pos; pos < log_attrs_len; pos++)
+          if (log_attrs[pos].is_word_start)
             {
-              if (log_attrs[pos].is_word_start)
-                {
-                  in_word = pos == end_pos;
-                  break;
-                }
-              if (pos > end_pos && log_attrs[pos].is_word_end)
-                {
-                  in_word = TRUE;
-                  break;
-                }
+              in_word = pos == end_pos;
+              break;
+            }
+          if (pos > end_pos && log_attrs[pos].is_word_end)
+            {
+              in_word = TRUE;
+              break;
             }
-          log_attrs[end_pos].is_word_start = in_word;
-          log_attrs[end_pos].is_word_end = TRUE;
-          log_attrs[end_pos].is_word_boundary = TRUE;
+        }
+      log_attrs[end_pos].is_word_start = in_word;
+      log_attrs[end_pos].is_word_end = TRUE;
+      log_attrs[end_pos].is_word_boundary = TRUE;
 
-          /* Allow line breaks before words */
-          if (in_word)
-            log_attrs[end_pos].is_line_break = TRUE;
+      /* Allow line breaks before words */
+      if (in_word)
+        log_attrs[end_pos].is_line_break = TRUE;
 
-          tailored = TRUE;
-        }
+      tailored = TRUE;
     }
-  while (pango_attr_iterator_next (&iter));
-
-  _pango_attr_iterator_destroy (&iter);
 
   return tailored;
 }
 
 static gboolean
-handle_sentences (const char    *text,
-                  int            length,
-                  PangoAttrList *attrs,
-                  int            offset,
-                  PangoLogAttr  *log_attrs,
-                  int            log_attrs_len)
+handle_sentence (BreakAttrsState      *state,
+                 const PangoAttribute *attr,
+                 PangoLogAttr         *log_attrs)
 {
-  PangoAttrIterator iter;
+  guint start, end;
+  int start_pos, end_pos;
+  int pos;
   gboolean tailored = FALSE;
 
-  _pango_attr_list_get_iterator (attrs, &iter);
+  start = attr->start_index;
+  end = attr->end_index;
+  break_attrs_state_get_range (state, attr, &start_pos, &end_pos);
 
-  do
+  for (pos = start_pos + 1; pos < end_pos; pos++)
     {
-      const PangoAttribute *attr = pango_attr_iterator_get (&iter, PANGO_ATTR_SENTENCE);
-      int start, end;
-      int start_pos, end_pos;
-      int pos;
-
-      if (!attr)
-        continue;
-
-      start = attr->start_index;
-      end = attr->end_index;
-      if (start < offset)
-        start_pos = 0;
-      else
-        start_pos = g_utf8_pointer_to_offset (text, text + start - offset);
-      if (end >= offset + length)
-        end_pos = log_attrs_len;
-      else
-        end_pos = g_utf8_pointer_to_offset (text, text + end - offset);
-
-      for (pos = start_pos + 1; pos < end_pos; pos++)
-        {
-          log_attrs[pos].is_sentence_start = FALSE;
-          log_attrs[pos].is_sentence_end = FALSE;
-          log_attrs[pos].is_sentence_boundary = FALSE;
+      log_attrs[pos].is_sentence_start = FALSE;
+      log_attrs[pos].is_sentence_end = FALSE;
+      log_attrs[pos].is_sentence_boundary = FALSE;
 
-          tailored = TRUE;
-        }
-      if (start >= offset)
+      tailored = TRUE;
+    }
+  if (start >= state->offset)
+    {
+      gboolean in_sentence = FALSE;
+      for (pos = start_pos - 1; pos >= 0; pos--)
         {
-          gboolean in_sentence = FALSE;
-          for (pos = start_pos - 1; pos >= 0; pos--)
+          if (log_attrs[pos].is_sentence_end)
+            break;
+          if (log_attrs[pos].is_sentence_start)
             {
-              if (log_attrs[pos].is_sentence_end)
-                break;
-              if (log_attrs[pos].is_sentence_start)
-                {
-                  in_sentence = TRUE;
-                  break;
-                }
+              in_sentence = TRUE;
+              break;
             }
-          log_attrs[start_pos].is_sentence_start = TRUE;
-          log_attrs[start_pos].is_sentence_end = in_sentence;
-          log_attrs[start_pos].is_sentence_boundary = TRUE;
-
-          tailored = TRUE;
         }
-      if (end < offset + length)
+      log_attrs[start_pos].is_sentence_start = TRUE;
+      log_attrs[start_pos].is_sentence_end = in_sentence;
+      log_attrs[start_pos].is_sentence_boundary = TRUE;
+
+      tailored = TRUE;
+    }
+  if (end < state->offset + state->length)
+    {
+      gboolean in_sentence = FALSE;
+      for (pos = end_pos + 1; pos < state->log_attrs_len; pos++)
         {
-          gboolean in_sentence = FALSE;
-          for (pos = end_pos + 1; end_pos < log_attrs_len; pos++)
+          if (log_attrs[pos].is_sentence_start)
+            break;
+          if (log_attrs[pos].is_sentence_end)
             {
-              if (log_attrs[pos].is_sentence_start)
-                break;
-              if (log_attrs[pos].is_sentence_end)
-                {
-                  in_sentence = TRUE;
-                  break;
-                }
+              in_sentence = TRUE;
+              break;
             }
-          log_attrs[end_pos].is_sentence_start = in_sentence;
-          log_attrs[end_pos].is_sentence_end = TRUE;
-          log_attrs[end_pos].is_sentence_boundary = TRUE;
+        }
+      log_attrs[end_pos].is_sentence_start = in_sentence;
+      log_attrs[end_pos].is_sentence_end = TRUE;
+      log_attrs[end_pos].is_sentence_boundary = TRUE;
+
+      tailored = TRUE;
+    }
+
+  return tailored;
+}
+
+/* Unlike the other handlers, this takes the range of an iterator
+ * segment rather than an attribute, since insert_hyphens=false
+ * only applies where it isn't covered by insert_hyphens=true.
+ */
+static gboolean
+handle_hyphens (BreakAttrsState *state,
+                guint            start,
+                guint            end,
+                PangoLogAttr    *log_attrs)
+{
+  int start_pos, end_pos;
+  int pos;
+  gboolean tailored = FALSE;
+
+  break_attrs_state_get_positions (state, start, end, &start_pos, &end_pos);
+
+  for (pos = start_pos + 1; pos < end_pos; pos++)
+    {
+      if (!log_attrs[pos].break_removes_preceding)
+        {
+          log_attrs[pos].break_inserts_hyphen = FALSE;
 
           tailored = TRUE;
         }
     }
-  while (pango_attr_iterator_next (&iter));
-
-  _pango_attr_iterator_destroy (&iter);
 
   return tailored;
 }
 
+typedef struct
+{
+  guint start;
+  int start_pos;
+  int end_pos;
+} AllowBreaksRange;
+
+/* Applies all break-related attributes from @attrs in a single
+ * walk over the list.
+ *
+ * Words, sentences and hyphens touch disjoint fields of the log
+ * attrs, so they can be applied as we go. Ranges that disallow
+ * breaks must override line breaks that words add, so they are
+ * collected and applied after the walk.
+ *
+ * Like pango_attr_iterator_get(), we use the topmost attribute
+ * of each type; an attribute is applied again when it becomes the
+ * topmost one again after being covered by another one. Hyphens
+ * are cleared per segment, so that nested ranges which insert
+ * hyphens keep them.
+ */
 static gboolean
-handle_hyphens (const char    *text,
-                int            length,
-                PangoAttrList *attrs,
-                int            offset,
-                PangoLogAttr  *log_attrs,
-                int            log_attrs_len)
+break_attrs (const char    *text,
+             int            length,
+             PangoAttrList *attrs,
+             int            offset,
+             PangoLogAttr  *log_attrs,
+             int            log_attrs_len)
 {
+  BreakAttrsState state;
   PangoAttrIterator iter;
+  const PangoAttribute *last_word = NULL;
+  const PangoAttribute *last_sentence = NULL;
+  const PangoAttribute *last_allow_breaks = NULL;
+  GArray *allow_breaks = NULL;
   gboolean tailored = FALSE;
 
+  if (!_pango_attr_list_has_attributes (attrs))
+    return FALSE;
+
+  state.text = text;
+  state.length = length;
+  state.offset = offset;
+  state.log_attrs_len = log_attrs_len;
+  state.cursor = text;
+  state.cursor_pos = 0;
+
   _pango_attr_list_get_iterator (attrs, &iter);
 
-  do {
-    const PangoAttribute *attr = pango_attr_iterator_get (&iter, PANGO_ATTR_INSERT_HYPHENS);
+  do
+    {
+      const PangoAttribute *attr;
+      int start, end;
 
-    if (attr && ((PangoAttrInt*)attr)->value == 0)
-      {
-        int start, end;
-        int start_pos, end_pos;
-        int pos;
+      pango_attr_iterator_range (&iter, &start, &end);
 
-        pango_attr_iterator_range (&iter, &start, &end);
-        if (start < offset)
-          start_pos = 0;
-        else
-          start_pos = g_utf8_pointer_to_offset (text, text + start - offset);
-        if (end >= offset + length)
-          end_pos = log_attrs_len;
-        else
-          end_pos = g_utf8_pointer_to_offset (text, text + end - offset);
+      if (start > offset + length)
+        break;
 
-        for (pos = start_pos + 1; pos < end_pos; pos++)
-          {
-            if (!log_attrs[pos].break_removes_preceding)
-              {
-                log_attrs[pos].break_inserts_hyphen = FALSE;
+      if (end < offset)
+        continue;
 
-                tailored = TRUE;
-              }
-          }
-      }
-  } while (pango_attr_iterator_next (&iter));
+      attr = pango_attr_iterator_get (&iter, PANGO_ATTR_WORD);
+      if (attr && attr != last_word)
+        tailored |= handle_word (&state, attr, log_attrs);
+      last_word = attr;
+
+      attr = pango_attr_iterator_get (&iter, PANGO_ATTR_SENTENCE);
+      if (attr && attr != last_sentence)
+        tailored |= handle_sentence (&state, attr, log_attrs);
+      last_sentence = attr;
+
+      attr = pango_attr_iterator_get (&iter, PANGO_ATTR_INSERT_HYPHENS);
+      if (attr && ((PangoAttrInt*)attr)->value == 0)
+        tailored |= handle_hyphens (&state, start, end, log_attrs);
+
+      attr = pango_attr_iterator_get (&iter, PANGO_ATTR_ALLOW_BREAKS);
+      if (attr && attr != last_allow_breaks && ((PangoAttrInt*)attr)->value == 0)
+        {
+          AllowBreaksRange range;
+
+          range.start = attr->start_index;
+          break_attrs_state_get_range (&state, attr, &range.start_pos, &range.end_pos);
+
+          if (G_UNLIKELY (!allow_breaks))
+            allow_breaks = g_array_new (FALSE, FALSE, sizeof (AllowBreaksRange));
+
+          g_array_append_val (allow_breaks, range);
+        }
+      last_allow_breaks = attr;
+    }
+  while (pango_attr_iterator_next (&iter));
 
   _pango_attr_iterator_destroy (&iter);
 
+  if (allow_breaks)
+    {
+      guint i;
+
+      for (i = 0; i < allow_breaks->len; i++)
+        {
+          AllowBreaksRange *range = &g_array_index (allow_breaks, AllowBreaksRange, i);
+
+          tailored |= handle_allow_breaks (&state, range->start_pos, range->end_pos,
+                                           range->start, log_attrs);
+        }
+
+      g_array_free (allow_breaks, TRUE);
+    }
+
   return tailored;
 }
 
 static gboolean
-break_attrs (const char   *text,
-             int           length,
-             GSList       *attributes,
-             int           offset,
-             PangoLogAttr *log_attrs,
-             int           log_attrs_len)
+affects_break (PangoAttribute *attr)
 {
-  PangoAttrList allow_breaks;
-  PangoAttrList words;
-  PangoAttrList sentences;
-  PangoAttrList hyphens;
+  switch ((int) attr->klass->type)
+    {
+    case PANGO_ATTR_ALLOW_BREAKS:
+    case PANGO_ATTR_WORD:
+    case PANGO_ATTR_SENTENCE:
+    case PANGO_ATTR_INSERT_HYPHENS:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* Like break_attrs(), for the attributes of an item */
+static gboolean
+break_attr_slist (const char   *text,
+                  int           length,
+                  GSList       *attributes,
+                  int           offset,
+                  PangoLogAttr *log_attrs,
+                  int           log_attrs_len)
+{
+  PangoAttrList list;
   GSList *l;
-  gboolean tailored = FALSE;
+  gboolean tailored;
 
-  _pango_attr_list_init (&allow_breaks);
-  _pango_attr_list_init (&words);
-  _pango_attr_list_init (&sentences);
-  _pango_attr_list_init (&hyphens);
+  _pango_attr_list_init (&list);
 
+  /* The list only borrows the attributes */
   for (l = attributes; l; l = l->next)
     {
       PangoAttribute *attr = l->data;
 
-      if (attr->klass->type == PANGO_ATTR_ALLOW_BREAKS)
-        pango_attr_list_insert (&allow_breaks, pango_attribute_copy (attr));
-      else if (attr->klass->type == PANGO_ATTR_WORD)
-        pango_attr_list_insert (&words, pango_attribute_copy (attr));
-      else if (attr->klass->type == PANGO_ATTR_SENTENCE)
-        pango_attr_list_insert (&sentences, pango_attribute_copy (attr));
-      else if (attr->klass->type == PANGO_ATTR_INSERT_HYPHENS)
-        pango_attr_list_insert (&hyphens, pango_attribute_copy (attr));
+      if (affects_break (attr))
+        pango_attr_list_insert (&list, attr);
     }
 
-  tailored |= handle_words (text, length, &words, offset,
-                            log_attrs, log_attrs_len);
-
-  tailored |= handle_sentences (text, length, &words, offset,
-                                log_attrs, log_attrs_len);
+  tailored = break_attrs (text, length, &list, offset, log_attrs, log_attrs_len);
 
-  tailored |= handle_hyphens (text, length, &hyphens, offset,
-                              log_attrs, log_attrs_len);
-
-  tailored |= handle_allow_breaks (text, length, &allow_breaks, offset,
-                                   log_attrs, log_attrs_len);
-
-  _pango_attr_list_destroy (&allow_breaks);
-  _pango_attr_list_destroy (&words);
-  _pango_attr_list_destroy (&sentences);
-  _pango_attr_list_destroy (&hyphens);
+  _pango_attr_list_release (&list);
 
   return tailored;
 }
@@ -2150,7 +2317,7 @@ tailor_break (const char    *text,
   res = break_script (text, length, analysis, attrs, attrs_len);
 
   if (item_offset >= 0 && analysis->extra_attrs)
-    res |= break_attrs (text, length, analysis->extra_attrs, item_offset, attrs, attrs_len);
+    res |= break_attr_slist (text, length, analysis->extra_attrs, item_offset, attrs, attrs_len);
 
   return res;
 }
@@ -2297,10 +2464,11 @@ pango_attr_break (const char    *text,
 {
   PangoLogAttr *start = attrs;
   PangoLogAttr attr_before = *start;
-  GSList *attributes;
 
-  attributes = pango_attr_list_get_attributes (attr_list);
-  if (break_attrs (text, length, attributes, offset, attrs, attrs_len))
+  if (length < 0)
+    length = strlen (text);
+
+  if (break_attrs (text, length, attr_list, offset, attrs, attrs_len))
     {
       /* if tailored, we enforce some of the attrs from before
        * tailoring at the boundary
@@ -2312,8 +2480,6 @@ pango_attr_break (const char    *text,
       start->is_mandatory_break |= attr_before.is_mandatory_break;
       start->is_cursor_position |= attr_before.is_cursor_position;
     }
-
-  g_slist_free_full (attributes, (GDestroyNotify)pango_attribute_destroy);
 }
 
 /**
@@ -2388,6 +2554,316 @@ pango_get_log_attrs (const char    *text,
                attrs_len);
 }
 
+/* Characters after which all segmentation state is reset:
+ * they end a grapheme, word, sentence and line.
+ */
+#define IS_PARAGRAPH_SEPARATOR(wc) \
+  ((wc) == '\n' || (wc) == '\r' || (wc) == 0x0085 || (wc) == 0x2028 || (wc) == PARAGRAPH_SEPARATOR)
+
+/**
+ * pango_update_log_attrs:
+ * @text: text to process, after the edit. Must be valid UTF-8
+ * @length: length in bytes of @text
+ * @level: embedding level, or -1 if unknown
+ * @language: language tag
+ * @offset: character offset at which the text was changed
+ * @n_removed: number of characters removed at @offset
+ * @n_added: number of characters inserted at @offset
+ * @attrs: (array length=attrs_len) (transfer full): the log attrs
+ *   for the text before the change, as computed by [func@Pango.get_log_attrs]
+ * @attrs_len: length of @attrs
+ * @new_attrs_len: (out): return location for the length of the result
+ *
+ * Updates the `PangoLogAttr` array for a change in the text
+ * it was computed for.
+ *
+ * The change that this function applies is removing @n_removed
+ * characters at @offset and inserting @n_added characters instead.
+ *
+ * Only the lines around the change are segmented again: this
+ * function starts at the closest hard line break (such as a newline
+ * or a paragraph separator) before @offset, and stops at the first
+ * hard line break after the change, since segmentation does not
+ * carry any state across those. The remaining log attrs are reused.
+ *
+ * The result is the same as computing the log attrs for each line
+ * separately, which is what `PangoLayout` does.
+ *
+ * Return value: (array length=new_attrs_len) (transfer full): the log attrs
+ *   for @text. This may be the same memory as @attrs, which must not be
+ *   used after this call
+ *
+ * Since: 1.52
+ */
+PangoLogAttr *
+pango_update_log_attrs (const char    *text,
+                        int            length,
+                        int            level,
+                        PangoLanguage *language,
+                        int            offset,
+                        int            n_removed,
+                        int            n_added,
+                        PangoLogAttr  *attrs,
+                        int            attrs_len,
+                        int           *new_attrs_len)
+{
+  int old_n_chars, n_chars;
+  int start, end, old_end;
+  const char *start_p, *end_p;
+  PangoLogAttr *tmp;
+
+  g_return_val_if_fail (length == 0 || text != NULL, attrs);
+  g_return_val_if_fail (attrs != NULL, NULL);
+  g_return_val_if_fail (new_attrs_len != NULL, attrs);
+  g_return_val_if_fail (offset >= 0 && n_removed >= 0 && n_added >= 0, attrs);
+  g_return_val_if_fail (offset + n_removed < attrs_len, attrs);
+
+  if (length < 0)
+    length = strlen (text);
+
+  old_n_chars = attrs_len - 1;
+  n_chars = old_n_chars - n_removed + n_added;
+
+  /* Find the start of the line containing the change. The character
+   * before @offset is included, since it may join with the new text
+   * (as in \r\n).
+   */
+  start = MAX (offset - 1, 0);
+  start_p = g_utf8_offset_to_pointer (text, start);
+  while (start > 0)
+    {
+      const char *prev = g_utf8_prev_char (start_p);
+
+      if (attrs[start].is_mandatory_break &&
+          IS_PARAGRAPH_SEPARATOR (g_utf8_get_char (prev)))
+        break;
+
+      start--;
+      start_p = prev;
+    }
+
+  /* Find the end of the line containing the change. Here, only
+   * characters after the inserted text count.
+   */
+  end = offset + n_added;
+  end_p = g_utf8_offset_to_pointer (start_p, end - start);
+  while (end < n_chars)
+    {
+      gunichar wc = g_utf8_get_char (end_p);
+
+      end_p = g_utf8_next_char (end_p);
+      end++;
+
+      if (IS_PARAGRAPH_SEPARATOR (wc) &&
+          end < n_chars &&
+          attrs[end - n_added + n_removed].is_mandatory_break)
+        break;
+    }
+
+  old_end = end - n_added + n_removed;
+
+  /* Keep the hard break at @start, like PangoLayout does for paragraphs */
+  tmp = g_new0 (PangoLogAttr, end - start + 1);
+  if (start > 0)
+    tmp[0] = attrs[start];
+  pango_get_log_attrs (start_p, end_p - start_p, level, language, tmp, end - start + 1);
+
+  /* Splice the new log attrs in. The log attrs at @end stay
+   * valid, unless we are at the end of the text.
+   */
+  if (n_chars > old_n_chars)
+    attrs = g_renew (PangoLogAttr, attrs, n_chars + 1);
+
+  memmove (attrs + end, attrs + old_end, sizeof (PangoLogAttr) * (old_n_chars + 1 - old_end));
+
+  if (n_chars < old_n_chars)
+    attrs = g_renew (PangoLogAttr, attrs, n_chars + 1);
+
+  if (end == n_chars)
+    memcpy (attrs + start, tmp, sizeof (PangoLogAttr) * (end - start + 1));
+  else
+    memcpy (attrs + start, tmp, sizeof (PangoLogAttr) * (end - start));
+
+  g_free (tmp);
+
+  *new_attrs_len = n_chars + 1;
+
+  return attrs;
+}
+
+typedef struct {
+  const char *text;
+  int length;
+  int level;
+  PangoLanguage *language;
+  PangoLogAttr *attrs;
+  int n_chars;
+  gboolean keep_end;
+} LogAttrsChunk;
+
+static void
+log_attrs_chunk_func (gpointer data,
+                      gpointer user_data G_GNUC_UNUSED)
+{
+  LogAttrsChunk *chunk = data;
+  PangoLogAttr end = { 0, };
+
+  if (chunk->keep_end)
+    end = chunk->attrs[chunk->n_chars];
+
+  pango_get_log_attrs (chunk->text, chunk->length,
+                       chunk->level, chunk->language,
+                       chunk->attrs, chunk->n_chars + 1);
+
+  if (chunk->keep_end)
+    {
+      /* The position after the chunk is the start of the
+       * next one, which has been computed already.
+       */
+      PangoLogAttr *attr = &chunk->attrs[chunk->n_chars];
+
+      end.is_line_break      |= attr->is_line_break;
+      end.is_mandatory_break |= attr->is_mandatory_break;
+      end.is_cursor_position |= attr->is_cursor_position;
+      *attr = end;
+    }
+}
+
+/* Don't bother splitting text into smaller pieces than this */
+#define MIN_CHUNK_LENGTH (16 * 1024)
+
+/**
+ * pango_get_log_attrs_parallel:
+ * @text: text to process. Must be valid UTF-8
+ * @length: length in bytes of @text
+ * @level: embedding level, or -1 if unknown
+ * @language: language tag
+ * @attrs: (array length=attrs_len): array with one `PangoLogAttr`
+ *   per character in @text, plus one extra, to be filled in
+ * @attrs_len: length of @attrs array
+ * @n_threads: the number of threads to use, or 0 to use
+ *   one per processor
+ *
+ * Computes a `PangoLogAttr` for each character in @text,
+ * using multiple threads.
+ *
+ * The text is split into chunks at paragraph boundaries,
+ * as found by [func@Pango.find_paragraph_boundary], and the
+ * chunks are processed concurrently. Since segmentation does
+ * not carry any state across paragraph boundaries, the result
+ * is the same as that of [func@Pango.get_log_attrs] on each
+ * paragraph.
+ *
+ * This is only worth it for large amounts of text.
+ *
+ * Since: 1.52
+ */
+void
+pango_get_log_attrs_parallel (const char    *text,
+                              int            length,
+                              int            level,
+                              PangoLanguage *language,
+                              PangoLogAttr  *attrs,
+                              int            attrs_len,
+                              int            n_threads)
+{
+  GArray *chunks;
+  const char *p, *end;
+  int chunk_length;
+  int offset;
+  guint i;
+
+  g_return_if_fail (length == 0 || text != NULL);
+  g_return_if_fail (attrs != NULL);
+
+  if (length < 0)
+    length = strlen (text);
+
+  if (n_threads <= 0)
+    n_threads = g_get_num_processors ();
+
+  /* Use a few chunks per thread, to balance the load */
+  chunk_length = MAX (length / (4 * n_threads), MIN_CHUNK_LENGTH);
+
+  if (n_threads == 1 || length <= chunk_length)
+    {
+      pango_get_log_attrs (text, length, level, language, attrs, attrs_len);
+      return;
+    }
+
+  chunks = g_array_new (FALSE, FALSE, sizeof (LogAttrsChunk));
+
+  offset = 0;
+  p = text;
+  end = text + length;
+  while (p < end)
+    {
+      LogAttrsChunk chunk;
+      const char *q;
+
+      q = p + MIN (chunk_length, end - p);
+      if (q < end)
+        {
+          int delimiter_index, next_paragraph_start;
+
+          while (q < end && (*q & 0xc0) == 0x80)
+            q++;
+
+          pango_find_paragraph_boundary (q, end - q, &delimiter_index, &next_paragraph_start);
+          q += next_paragraph_start;
+        }
+
+      chunk.text = p;
+      chunk.length = q - p;
+      chunk.level = level;
+      chunk.language = language;
+      chunk.attrs = attrs + offset;
+      chunk.n_chars = pango_utf8_strlen (p, q - p);
+      chunk.keep_end = FALSE;
+
+      g_array_append_val (chunks, chunk);
+
+      offset += chunk.n_chars;
+      p = q;
+    }
+
+  if (offset + 1 > attrs_len)
+    {
+      g_warning ("pango_get_log_attrs_parallel: attrs_len should have been at least %d, but was %d.",
+                 offset + 1, attrs_len);
+      g_array_unref (chunks);
+      return;
+    }
+
+  /* Neighboring chunks share a position, so we do even and odd chunks
+   * separately. The odd chunks run last and merge their end position
+   * into the start of the next chunk.
+   */
+  for (i = 0; i < 2; i++)
+    {
+      GThreadPool *pool;
+      guint j;
+
+      pool = g_thread_pool_new (log_attrs_chunk_func, NULL, n_threads, FALSE, NULL);
+
+      for (j = i; j < chunks->len; j += 2)
+        {
+          LogAttrsChunk *chunk = &g_array_index (chunks, LogAttrsChunk, j);
+
+          if (i == 0 && j > 0)
+            memset (chunk->attrs, 0, sizeof (PangoLogAttr));
+          else if (i == 1)
+            chunk->keep_end = j + 1 < chunks->len;
+
+          g_thread_pool_push (pool, chunk, NULL);
+        }
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+
+  g_array_unref (chunks);
+}
+
 /* }}} */
 
 /* vim:set foldmethod=marker expandtab: */
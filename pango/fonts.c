@@ -47,8 +47,13 @@ struct _PangoFontDescription
   guint static_family : 1;
   guint static_variations : 1;
   guint size_is_absolute : 1;
+  guint interned : 1;
 
   int size;
+
+  /* Only used for interned descriptions */
+  guint hash;
+  int ref_count;
 };
 
 G_DEFINE_BOXED_TYPE (PangoFontDescription, pango_font_description,
@@ -69,8 +74,12 @@ static const PangoFontDescription pfd_defaults = {
   0,                    /* static_family */
   0,                    /* static_variations*/
   0,                    /* size_is_absolute */
+  0,                    /* interned */
 
   0,                    /* size */
+
+  0,                    /* hash */
+  0,                    /* ref_count */
 };
 
 /**
@@ -827,6 +836,7 @@ pango_font_description_copy (const PangoFontDescription *desc)
   result = g_slice_new (PangoFontDescription);
 
   *result = *desc;
+  result->interned = FALSE;
 
   if (result->family_name)
     {
@@ -867,6 +877,7 @@ pango_font_description_copy_static (const PangoFontDescription *desc)
   result = g_slice_new (PangoFontDescription);
 
   *result = *desc;
+  result->interned = FALSE;
   if (result->family_name)
     result->static_family = TRUE;
 
@@ -899,6 +910,16 @@ pango_font_description_equal (const PangoFontDescription *desc1,
   g_return_val_if_fail (desc1 != NULL, FALSE);
   g_return_val_if_fail (desc2 != NULL, FALSE);
 
+  if (desc1 == desc2)
+    return TRUE;
+
+  /* There is only one interned description for each set of values,
+   * but families that only differ in case are interned separately
+   */
+  if (desc1->interned && desc2->interned && desc1->mask == desc2->mask &&
+      g_strcmp0 (desc1->family_name, desc2->family_name) == 0)
+    return FALSE;
+
   return desc1->style == desc2->style &&
          desc1->variant == desc2->variant &&
          desc1->weight == desc2->weight &&
@@ -947,6 +968,9 @@ pango_font_description_hash (const PangoFontDescription *desc)
 
   g_return_val_if_fail (desc != NULL, 0);
 
+  if (desc->interned)
+    return desc->hash;
+
   if (desc->family_name)
     hash = case_insensitive_hash (desc->family_name);
   if (desc->variations)
@@ -962,6 +986,114 @@ pango_font_description_hash (const PangoFontDescription *desc)
   return hash;
 }
 
+/* Interned descriptions are kept in a table, keyed by their
+ * values and mask, so that descriptions that are used as keys
+ * in font and fontset caches can be compared by pointer, and
+ * don't need to be hashed again.
+ *
+ * The table compares families case-sensitively, so interning
+ * never changes the family name that callers see.
+ */
+
+G_LOCK_DEFINE_STATIC (intern_table);
+static GHashTable *intern_table;
+
+static gboolean
+intern_equal (gconstpointer a,
+              gconstpointer b)
+{
+  const PangoFontDescription *desc1 = a;
+  const PangoFontDescription *desc2 = b;
+
+  return desc1->mask == desc2->mask &&
+         g_strcmp0 (desc1->family_name, desc2->family_name) == 0 &&
+         pango_font_description_equal (desc1, desc2);
+}
+
+/*
+ * _pango_font_description_intern:
+ * @desc: (nullable): a `PangoFontDescription`
+ * @to_unset: bitmask of fields to unset in the result
+ *
+ * Gets the interned copy of @desc, with the fields
+ * in @to_unset unset.
+ *
+ * Interned descriptions are shared, and must not be
+ * modified. Two interned descriptions with the same mask
+ * and the same family (compared case-sensitively) are equal
+ * if and only if they are the same pointer, and their hash
+ * is only computed once.
+ *
+ * Return value: (nullable): the interned description,
+ *   which should be freed with [method@Pango.FontDescription.free]
+ */
+PangoFontDescription *
+_pango_font_description_intern (const PangoFontDescription *desc,
+                                PangoFontMask               to_unset)
+{
+  PangoFontDescription tmp;
+  PangoFontDescription *result;
+
+  if (desc == NULL)
+    return NULL;
+
+  if (desc->interned && (desc->mask & to_unset) == 0)
+    {
+      result = (PangoFontDescription *) desc;
+      g_atomic_int_inc (&result->ref_count);
+      return result;
+    }
+
+  tmp = *desc;
+  tmp.interned = FALSE;
+  tmp.static_family = TRUE;
+  tmp.static_variations = TRUE;
+  if (to_unset)
+    pango_font_description_unset_fields (&tmp, to_unset);
+
+  G_LOCK (intern_table);
+
+  if (G_UNLIKELY (intern_table == NULL))
+    intern_table = g_hash_table_new ((GHashFunc) pango_font_description_hash,
+                                     intern_equal);
+
+  result = g_hash_table_lookup (intern_table, &tmp);
+  if (result)
+    g_atomic_int_inc (&result->ref_count);
+  else
+    {
+      result = pango_font_description_copy (&tmp);
+      result->hash = pango_font_description_hash (result);
+      result->ref_count = 1;
+      result->interned = TRUE;
+      g_hash_table_add (intern_table, result);
+    }
+
+  G_UNLOCK (intern_table);
+
+  return result;
+}
+
+static void
+release_interned (PangoFontDescription *desc)
+{
+  gboolean last_ref;
+
+  G_LOCK (intern_table);
+
+  last_ref = g_atomic_int_dec_and_test (&desc->ref_count);
+  if (last_ref)
+    g_hash_table_remove (intern_table, desc);
+
+  G_UNLOCK (intern_table);
+
+  if (last_ref)
+    {
+      desc->interned = FALSE;
+      pango_font_description_free (desc);
+    }
+}
+
 /**
  * pango_font_description_free:
  * @desc: (nullable): a `PangoFontDescription`, may be %NULL
@@ -974,6 +1106,12 @@ pango_font_description_free (PangoFontDescription *desc)
   if (desc == NULL)
     return;
 
+  if (desc->interned)
+    {
+      release_interned (desc);
+      return;
+    }
+
   if (desc->family_name && !desc->static_family)
     g_free (desc->family_name);
 
@@ -2043,17 +2181,28 @@ hb_font_t *
 pango_font_get_hb_font (PangoFont *font)
 {
   PangoFontPrivate *priv = pango_font_get_instance_private (font);
+  hb_font_t *hb_font;
 
   g_return_val_if_fail (PANGO_IS_FONT (font), NULL);
 
-  if (priv->hb_font)
-    return priv->hb_font;
+  hb_font = g_atomic_pointer_get (&priv->hb_font);
+  if (hb_font)
+    return hb_font;
+
+  hb_font = PANGO_FONT_GET_CLASS (font)->create_hb_font (font);
 
-  priv->hb_font = PANGO_FONT_GET_CLASS (font)->create_hb_font (font);
+  hb_font_make_immutable (hb_font);
 
-  hb_font_make_immutable (priv->hb_font);
+  /* Fonts from a thread-safe fontmap can be shared between threads;
+   * if another thread got here first, use its hb_font.
+   */
+  if (!g_atomic_pointer_compare_and_exchange (&priv->hb_font, NULL, hb_font))
+    {
+      hb_font_destroy (hb_font);
+      hb_font = g_atomic_pointer_get (&priv->hb_font);
+    }
 
-  return priv->hb_font;
+  return hb_font;
 }
 
 G_DEFINE_BOXED_TYPE (PangoFontMetrics, pango_font_metrics,
@@ -70,19 +70,27 @@ static FontCache *
 get_font_cache (PangoFontset *fontset)
 {
   FontCache *cache;
+  GObject *owner;
 
   static GQuark cache_quark = 0; /* MT-safe */
+  static GQuark owner_quark = 0; /* MT-safe */
   if (G_UNLIKELY (!cache_quark))
     cache_quark = g_quark_from_static_string ("pango-font-cache");
+  if (G_UNLIKELY (!owner_quark))
+    owner_quark = g_quark_from_static_string (PANGO_FONT_CACHE_OWNER);
+
+  owner = g_object_get_qdata (G_OBJECT (fontset), owner_quark);
+  if (!owner)
+    owner = G_OBJECT (fontset);
 
 retry:
-  cache = g_object_get_qdata (G_OBJECT (fontset), cache_quark);
+  cache = g_object_get_qdata (owner, cache_quark);
   if (G_UNLIKELY (!cache))
     {
       cache = g_slice_new (FontCache);
       cache->hash = g_hash_table_new_full (g_direct_hash, NULL,
                                            NULL, (GDestroyNotify)font_element_destroy);
-      if (!g_object_replace_qdata (G_OBJECT (fontset), cache_quark, NULL,
+      if (!g_object_replace_qdata (owner, cache_quark, NULL,
                                    cache, (GDestroyNotify)font_cache_destroy,
                                    NULL))
         {
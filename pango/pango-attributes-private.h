@@ -20,26 +20,36 @@
 #ifndef __PANGO_ATTRIBUTES_PRIVATE_H__
 #define __PANGO_ATTRIBUTES_PRIVATE_H__
 
+typedef struct _PangoAttrNode PangoAttrNode;
+typedef struct _PangoAttrFontMemo PangoAttrFontMemo;
+
 struct _PangoAttrIterator
 {
-  GPtrArray *attrs; /* From the list */
-  guint n_attrs; /* Copied from the list */
+  PangoAttrNode *next_node; /* From the list */
 
-  GPtrArray *attribute_stack;
+  GPtrArray *attribute_stack; /* NULL for attributes that ended */
+  GArray *end_heap; /* Positions in attribute_stack, by end index */
 
-  guint attr_index;
   guint start_index;
   guint end_index;
+
+  guint font_serial; /* Changes when font attributes enter or leave the stack */
+  PangoAttrFontMemo *font_memo;
 };
 
 struct _PangoAttrList
 {
   guint ref_count;
-  GPtrArray *attributes;
+  guint n_attrs;
+  guint serial; /* Changes with the list, seeds the node priorities */
+  PangoAttrNode *root;
 };
 
 void     _pango_attr_list_init         (PangoAttrList     *list);
 void     _pango_attr_list_destroy      (PangoAttrList     *list);
+void     _pango_attr_list_release      (PangoAttrList     *list);
+void     _pango_attr_list_append       (PangoAttrList     *list,
+                                        PangoAttribute    *attr);
 gboolean _pango_attr_list_has_attributes (const PangoAttrList *list);
 
 void     _pango_attr_list_get_iterator (PangoAttrList     *list,
@@ -1824,6 +1824,435 @@ pango_attribute_as_shape (PangoAttribute *attr)
 /* }}} */
 /* {{{ Attribute List */
 
+/* The attributes of a list are kept in a treap, a binary tree
+ * that is balanced by giving each node a random priority. The
+ * order of the list is the in-order of the tree. This is not
+ * a search tree: lists are normally sorted by start index, but
+ * pango_attr_list_from_string() keeps the order it is given.
+ *
+ * Each node also stores the largest start and end index in its
+ * subtree. That lets us find the place for a new attribute, or
+ * the attributes that overlap an index, in logarithmic time.
+ */
+struct _PangoAttrNode
+{
+  PangoAttribute *attr;
+  PangoAttrNode *parent;
+  PangoAttrNode *left;
+  PangoAttrNode *right;
+  guint priority;
+  guint max_start;
+  guint max_end;
+};
+
+static inline void
+node_update (PangoAttrNode *node)
+{
+  node->max_start = node->attr->start_index;
+  node->max_end = node->attr->end_index;
+
+  if (node->left)
+    {
+      node->max_start = MAX (node->max_start, node->left->max_start);
+      node->max_end = MAX (node->max_end, node->left->max_end);
+    }
+
+  if (node->right)
+    {
+      node->max_start = MAX (node->max_start, node->right->max_start);
+      node->max_end = MAX (node->max_end, node->right->max_end);
+    }
+}
+
+static void
+node_update_path (PangoAttrNode *node)
+{
+  for (; node; node = node->parent)
+    node_update (node);
+}
+
+static void
+node_update_all (PangoAttrNode *node)
+{
+  if (!node)
+    return;
+
+  node_update_all (node->left);
+  node_update_all (node->right);
+  node_update (node);
+}
+
+static PangoAttrNode *
+node_first (PangoAttrNode *node)
+{
+  if (!node)
+    return NULL;
+
+  while (node->left)
+    node = node->left;
+
+  return node;
+}
+
+static PangoAttrNode *
+node_last (PangoAttrNode *node)
+{
+  if (!node)
+    return NULL;
+
+  while (node->right)
+    node = node->right;
+
+  return node;
+}
+
+static PangoAttrNode *
+node_next (PangoAttrNode *node)
+{
+  if (node->right)
+    return node_first (node->right);
+
+  while (node->parent && node == node->parent->right)
+    node = node->parent;
+
+  return node->parent;
+}
+
+static PangoAttrNode *
+node_prev (PangoAttrNode *node)
+{
+  if (node->left)
+    return node_last (node->left);
+
+  while (node->parent && node == node->parent->left)
+    node = node->parent;
+
+  return node->parent;
+}
+
+static void
+node_free (PangoAttrNode *node,
+           gboolean       destroy_attrs)
+{
+  if (!node)
+    return;
+
+  node_free (node->left, destroy_attrs);
+  node_free (node->right, destroy_attrs);
+
+  if (destroy_attrs)
+    node->attr->klass->destroy (node->attr);
+
+  g_slice_free (PangoAttrNode, node);
+}
+
+static PangoAttrNode *
+node_copy (PangoAttrNode *node,
+           PangoAttrNode *parent)
+{
+  PangoAttrNode *copy;
+
+  if (!node)
+    return NULL;
+
+  copy = g_slice_new (PangoAttrNode);
+  copy->attr = pango_attribute_copy (node->attr);
+  copy->parent = parent;
+  copy->left = node_copy (node->left, copy);
+  copy->right = node_copy (node->right, copy);
+  copy->priority = node->priority;
+  copy->max_start = node->max_start;
+  copy->max_end = node->max_end;
+
+  return copy;
+}
+
+/* Moves @node above its parent, keeping the order */
+static void
+node_rotate_up (PangoAttrList *list,
+                PangoAttrNode *node)
+{
+  PangoAttrNode *parent = node->parent;
+  PangoAttrNode *grandparent = parent->parent;
+
+  if (parent->left == node)
+    {
+      parent->left = node->right;
+      if (node->right)
+        node->right->parent = parent;
+      node->right = parent;
+    }
+  else
+    {
+      parent->right = node->left;
+      if (node->left)
+        node->left->parent = parent;
+      node->left = parent;
+    }
+
+  parent->parent = node;
+  node->parent = grandparent;
+
+  if (!grandparent)
+    list->root = node;
+  else if (grandparent->left == parent)
+    grandparent->left = node;
+  else
+    grandparent->right = node;
+
+  node_update (parent);
+  node_update (node);
+}
+
+static guint
+next_priority (PangoAttrList *list)
+{
+  guint h = ++list->serial;
+
+  /* The finalizer of MurmurHash3 */
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* Adds @node to @list, before @next, or at the end if @next is %NULL */
+static void
+node_link (PangoAttrList *list,
+           PangoAttrNode *node,
+           PangoAttrNode *next)
+{
+  PangoAttrNode *parent;
+
+  node->left = NULL;
+  node->right = NULL;
+  node->priority = next_priority (list);
+
+  if (!next)
+    {
+      parent = node_last (list->root);
+      if (parent)
+        parent->right = node;
+      else
+        list->root = node;
+    }
+  else if (!next->left)
+    {
+      parent = next;
+      parent->left = node;
+    }
+  else
+    {
+      parent = node_last (next->left);
+      parent->right = node;
+    }
+
+  node->parent = parent;
+  node_update (node);
+  node_update_path (parent);
+
+  while (node->parent && node->parent->priority < node->priority)
+    node_rotate_up (list, node);
+
+  list->n_attrs++;
+}
+
+/* Removes @node from @list, without freeing it */
+static void
+node_unlink (PangoAttrList *list,
+             PangoAttrNode *node)
+{
+  PangoAttrNode *parent;
+
+  while (node->left || node->right)
+    {
+      if (!node->right ||
+          (node->left && node->left->priority > node->right->priority))
+        node_rotate_up (list, node->left);
+      else
+        node_rotate_up (list, node->right);
+    }
+
+  parent = node->parent;
+  if (!parent)
+    list->root = NULL;
+  else if (parent->left == node)
+    parent->left = NULL;
+  else
+    parent->right = NULL;
+
+  node_update_path (parent);
+
+  list->n_attrs--;
+  list->serial++;
+}
+
+/* Builds a tree out of @n_nodes nodes, in the given order,
+ * in linear time. The nodes must have their priority set.
+ */
+static PangoAttrNode *
+node_build (PangoAttrNode **nodes,
+            guint           n_nodes)
+{
+  PangoAttrNode *root = NULL;
+  PangoAttrNode *top = NULL; /* End of the right spine */
+  guint i;
+
+  for (i = 0; i < n_nodes; i++)
+    {
+      PangoAttrNode *node = nodes[i];
+      PangoAttrNode *last = NULL;
+
+      while (top && top->priority < node->priority)
+        {
+          last = top;
+          top = top->parent;
+        }
+
+      node->left = last;
+      node->right = NULL;
+      node->parent = top;
+
+      if (last)
+        last->parent = node;
+
+      if (top)
+        top->right = node;
+      else
+        root = node;
+
+      top = node;
+    }
+
+  node_update_all (root);
+
+  return root;
+}
+
+/* Joins two trees, all of whose nodes in @a come before those in @b */
+static PangoAttrNode *
+node_merge (PangoAttrNode *a,
+            PangoAttrNode *b)
+{
+  if (!a)
+    return b;
+
+  if (!b)
+    return a;
+
+  if (a->priority > b->priority)
+    {
+      a->right = node_merge (a->right, b);
+      a->right->parent = a;
+      node_update (a);
+
+      return a;
+    }
+  else
+    {
+      b->left = node_merge (a, b->left);
+      b->left->parent = b;
+      node_update (b);
+
+      return b;
+    }
+}
+
+#define NODE_MAX(node, by_start) ((by_start) ? (node)->max_start : (node)->max_end)
+#define NODE_INDEX(node, by_start) ((by_start) ? (node)->attr->start_index : (node)->attr->end_index)
+
+/* Returns the first node in the subtree of @node whose
+ * start index (or end index) is at least @index
+ */
+static PangoAttrNode *
+subtree_find (PangoAttrNode *node,
+              gboolean       by_start,
+              guint          index)
+{
+  if (!node || NODE_MAX (node, by_start) < index)
+    return NULL;
+
+  while (TRUE)
+    {
+      if (node->left && NODE_MAX (node->left, by_start) >= index)
+        node = node->left;
+      else if (NODE_INDEX (node, by_start) >= index)
+        return node;
+      else
+        node = node->right;
+    }
+}
+
+/* Returns the first node after @node (or from the start of the
+ * list, if @node is %NULL) whose start index (or end index) is
+ * at least @index
+ */
+static PangoAttrNode *
+node_find_next (PangoAttrList *list,
+                PangoAttrNode *node,
+                gboolean       by_start,
+                guint          index)
+{
+  PangoAttrNode *found;
+
+  if (!node)
+    return subtree_find (list->root, by_start, index);
+
+  found = subtree_find (node->right, by_start, index);
+  if (found)
+    return found;
+
+  for (; node->parent; node = node->parent)
+    {
+      if (node == node->parent->left)
+        {
+          if (NODE_INDEX (node->parent, by_start) >= index)
+            return node->parent;
+
+          found = subtree_find (node->parent->right, by_start, index);
+          if (found)
+            return found;
+        }
+    }
+
+  return NULL;
+}
+
+/* Returns the first node whose start index is bigger than @index */
+static inline PangoAttrNode *
+node_find_start_after (PangoAttrList *list,
+                       guint          index)
+{
+  if (index == G_MAXUINT)
+    return NULL;
+
+  return node_find_next (list, NULL, TRUE, index + 1);
+}
+
+#undef NODE_MAX
+#undef NODE_INDEX
+
+static PangoAttrNode *
+node_new (PangoAttribute *attr)
+{
+  PangoAttrNode *node = g_slice_new (PangoAttrNode);
+
+  node->attr = attr;
+
+  return node;
+}
+
+/* Adds @attr at the end of @list, regardless of its start index */
+void
+_pango_attr_list_append (PangoAttrList  *list,
+                         PangoAttribute *attr)
+{
+  node_link (list, node_new (attr), NULL);
+}
+
 G_DEFINE_BOXED_TYPE (PangoAttrList, pango_attr_list,
                      pango_attr_list_copy,
                      pango_attr_list_unref);
@@ -1832,7 +2261,9 @@ void
 _pango_attr_list_init (PangoAttrList *list)
 {
   list->ref_count = 1;
-  list->attributes = NULL;
+  list->n_attrs = 0;
+  list->serial = 0;
+  list->root = NULL;
 }
 
 /**
@@ -1880,19 +2311,18 @@ pango_attr_list_ref (PangoAttrList *list)
 void
 _pango_attr_list_destroy (PangoAttrList *list)
 {
-  guint i, p;
-
-  if (!list->attributes)
-    return;
-
-  for (i = 0, p = list->attributes->len; i < p; i++)
-    {
-      PangoAttribute *attr = g_ptr_array_index (list->attributes, i);
-
-      attr->klass->destroy (attr);
-    }
+  node_free (list->root, TRUE);
+  list->root = NULL;
+  list->n_attrs = 0;
+}
 
-  g_ptr_array_free (list->attributes, TRUE);
+/* For lists that only borrow their attributes */
+void
+_pango_attr_list_release (PangoAttrList *list)
+{
+  node_free (list->root, FALSE);
+  list->root = NULL;
+  list->n_attrs = 0;
 }
 
 /**
@@ -1940,56 +2370,36 @@ pango_attr_list_copy (PangoAttrList *list)
     return NULL;
 
   new = pango_attr_list_new ();
-  if (!list->attributes || list->attributes->len == 0)
-    return new;
-
-  new->attributes = g_ptr_array_copy (list->attributes, (GCopyFunc)pango_attribute_copy, NULL);
+  new->root = node_copy (list->root, NULL);
+  new->n_attrs = list->n_attrs;
+  new->serial = list->serial;
 
   return new;
 }
 
-static void
+static PangoAttrNode *
 pango_attr_list_insert_internal (PangoAttrList  *list,
                                  PangoAttribute *attr,
                                  gboolean        before)
 {
   const guint start_index = attr->start_index;
-  PangoAttribute *last_attr;
-
-  if (G_UNLIKELY (!list->attributes))
-    list->attributes = g_ptr_array_new ();
+  PangoAttrNode *node, *last, *next;
 
-  if (list->attributes->len == 0)
-    {
-      g_ptr_array_add (list->attributes, attr);
-      return;
-    }
+  node = node_new (attr);
+  last = node_last (list->root);
 
-  g_assert (list->attributes->len > 0);
-
-  last_attr = g_ptr_array_index (list->attributes, list->attributes->len - 1);
-
-  if (last_attr->start_index < start_index ||
-      (!before && last_attr->start_index == start_index))
-    {
-      g_ptr_array_add (list->attributes, attr);
-    }
+  if (!last ||
+      last->attr->start_index < start_index ||
+      (!before && last->attr->start_index == start_index))
+    next = NULL;
+  else if (before)
+    next = node_find_next (list, NULL, TRUE, start_index);
   else
-    {
-      guint i, p;
+    next = node_find_start_after (list, start_index);
 
-      for (i = 0, p = list->attributes->len; i < p; i++)
-        {
-          PangoAttribute *cur = g_ptr_array_index (list->attributes, i);
+  node_link (list, node, next);
 
-          if (cur->start_index > start_index ||
-              (before && cur->start_index == start_index))
-            {
-              g_ptr_array_insert (list->attributes, i, attr);
-              break;
-            }
-        }
-    }
+  return node;
 }
 
 /**
@@ -2032,6 +2442,99 @@ pango_attr_list_insert_before (PangoAttrList  *list,
   pango_attr_list_insert_internal (list, attr, TRUE);
 }
 
+static int
+compare_start_index (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+  const PangoAttribute *attr_a = *(const PangoAttribute **) a;
+  const PangoAttribute *attr_b = *(const PangoAttribute **) b;
+
+  if (attr_a->start_index < attr_b->start_index)
+    return -1;
+  else if (attr_a->start_index > attr_b->start_index)
+    return 1;
+  else
+    return 0;
+}
+
+/**
+ * pango_attr_list_insert_array:
+ * @list: a `PangoAttrList`
+ * @attrs: (array length=n_attrs) (transfer full): the attributes to insert
+ * @n_attrs: the number of attributes in @attrs
+ *
+ * Insert the given attributes into the `PangoAttrList`.
+ *
+ * The result is the same as inserting each of the attributes
+ * with [method@Pango.AttrList.insert], in order. When the
+ * attributes are sorted by start index and start after the
+ * attributes that are already in @list, which is the common
+ * case when building a list from scratch, this takes time
+ * linear in the number of attributes.
+ *
+ * The list takes ownership of the attributes, but not of
+ * the @attrs array itself.
+ *
+ * Since: 1.52
+ */
+void
+pango_attr_list_insert_array (PangoAttrList   *list,
+                              PangoAttribute **attrs,
+                              guint            n_attrs)
+{
+  PangoAttribute **sorted;
+  PangoAttrNode **nodes;
+  PangoAttrNode *last;
+  guint i;
+
+  g_return_if_fail (list != NULL);
+  g_return_if_fail (attrs != NULL || n_attrs == 0);
+
+  if (n_attrs == 0)
+    return;
+
+  sorted = attrs;
+  for (i = 1; i < n_attrs; i++)
+    {
+      if (attrs[i - 1]->start_index > attrs[i]->start_index)
+        {
+          /* The sort is stable, so attributes with the same
+           * start index stay in the order they were given
+           */
+          sorted = g_memdup2 (attrs, n_attrs * sizeof (PangoAttribute *));
+          g_qsort_with_data (sorted, n_attrs, sizeof (PangoAttribute *),
+                             compare_start_index, NULL);
+          break;
+        }
+    }
+
+  last = node_last (list->root);
+  if (last && last->attr->start_index > sorted[0]->start_index)
+    {
+      for (i = 0; i < n_attrs; i++)
+        pango_attr_list_insert_internal (list, sorted[i], FALSE);
+    }
+  else
+    {
+      nodes = g_new (PangoAttrNode *, n_attrs);
+      for (i = 0; i < n_attrs; i++)
+        {
+          nodes[i] = node_new (sorted[i]);
+          nodes[i]->priority = next_priority (list);
+        }
+
+      list->root = node_merge (list->root, node_build (nodes, n_attrs));
+      list->root->parent = NULL;
+      list->n_attrs += n_attrs;
+
+      g_free (nodes);
+    }
+
+  if (sorted != attrs)
+    g_free (sorted);
+}
+
 /**
  * pango_attr_list_change:
  * @list: a `PangoAttrList`
@@ -2054,10 +2557,11 @@ void
 pango_attr_list_change (PangoAttrList  *list,
                         PangoAttribute *attr)
 {
-  guint i, p;
+  PangoAttrNode *node, *next;
+  PangoAttrNode *attr_node;
+  PangoAttrNode *prev;
   guint start_index = attr->start_index;
   guint end_index = attr->end_index;
-  gboolean inserted;
 
   g_return_if_fail (list != NULL);
 
@@ -2067,31 +2571,37 @@ pango_attr_list_change (PangoAttrList  *list,
       return;
     }
 
-  if (!list->attributes || list->attributes->len == 0)
+  if (!list->root)
     {
       pango_attr_list_insert (list, attr);
       return;
     }
 
-  inserted = FALSE;
-  for (i = 0, p = list->attributes->len; i < p; i++)
+  list->serial++;
+
+  /* Look at the attributes that overlap the start of the new
+   * one, up to the first attribute that starts after it.
+   * The fixups below start after @prev.
+   */
+  attr_node = NULL;
+  prev = NULL;
+  for (node = node_find_next (list, NULL, FALSE, start_index);
+       node;
+       node = node_find_next (list, node, FALSE, start_index))
     {
-      PangoAttribute *tmp_attr = g_ptr_array_index (list->attributes, i);
+      PangoAttribute *tmp_attr = node->attr;
 
       if (tmp_attr->start_index > start_index)
         {
-          g_ptr_array_insert (list->attributes, i, attr);
-          inserted = TRUE;
+          attr_node = node_new (attr);
+          node_link (list, attr_node, node);
+          prev = attr_node;
           break;
         }
 
       if (tmp_attr->klass->type != attr->klass->type)
         continue;
 
-      if (tmp_attr->end_index < start_index)
-        continue; /* This attr does not overlap with the new one */
-
-      g_assert (tmp_attr->start_index <= start_index);
       g_assert (tmp_attr->end_index >= start_index);
 
       if (pango_attribute_equal (tmp_attr, attr))
@@ -2108,10 +2618,12 @@ pango_attr_list_change (PangoAttrList  *list,
             }
 
           tmp_attr->end_index = end_index;
+          node_update_path (node);
           pango_attribute_destroy (attr);
 
           attr = tmp_attr;
-          inserted = TRUE;
+          attr_node = node;
+          prev = node;
           break;
         }
       else
@@ -2128,32 +2640,40 @@ pango_attr_list_change (PangoAttrList  *list,
 
           if (tmp_attr->start_index == start_index)
             {
+              prev = node_prev (node);
+              node_unlink (list, node);
+              g_slice_free (PangoAttrNode, node);
               pango_attribute_destroy (tmp_attr);
-              g_ptr_array_remove_index (list->attributes, i);
               break;
             }
           else
             {
               tmp_attr->end_index = start_index;
+              node_update_path (node);
             }
         }
     }
 
-  if (!inserted)
-    /* we didn't insert attr yet */
-    pango_attr_list_insert (list, attr);
+  if (!attr_node)
+    {
+      /* we didn't insert attr yet */
+      attr_node = pango_attr_list_insert_internal (list, attr, FALSE);
+      if (!node)
+        prev = attr_node;
+    }
 
   /* We now have the range inserted into the list one way or the
    * other. Fix up the remainder
    */
-  /* Attention: No i = 0 here. */
-  for (i = i + 1, p = list->attributes->len; i < p; i++)
+  for (node = prev ? node_next (prev) : node_first (list->root); node; node = next)
     {
-      PangoAttribute *tmp_attr = g_ptr_array_index (list->attributes, i);
+      PangoAttribute *tmp_attr = node->attr;
 
       if (tmp_attr->start_index > end_index)
         break;
 
+      next = node_next (node);
+
       if (tmp_attr->klass->type != attr->klass->type)
         continue;
 
@@ -2164,12 +2684,11 @@ pango_attr_list_change (PangoAttrList  *list,
           pango_attribute_equal (tmp_attr, attr))
         {
           /* We can merge the new attribute with this attribute. */
-          attr->end_index = MAX (end_index, tmp_attr->end_index);
+          attr->end_index = MAX (attr->end_index, tmp_attr->end_index);
+          node_update_path (attr_node);
+          node_unlink (list, node);
+          g_slice_free (PangoAttrNode, node);
           pango_attribute_destroy (tmp_attr);
-          g_ptr_array_remove_index (list->attributes, i);
-          i--;
-          p--;
-          continue;
         }
       else
         {
@@ -2177,20 +2696,18 @@ pango_attr_list_change (PangoAttrList  *list,
            * of the new attribute. This may involve moving it in the list
            * to maintain the required non-decreasing order of start indices.
            */
-          int k, m;
+          PangoAttrNode *before;
 
           tmp_attr->start_index = attr->end_index;
 
-          for (k = i + 1, m = list->attributes->len; k < m; k++)
+          before = node_find_next (list, node, TRUE, tmp_attr->start_index);
+          if (before != node_next (node))
             {
-              PangoAttribute *tmp_attr2 = g_ptr_array_index (list->attributes, k);
-
-              if (tmp_attr2->start_index >= tmp_attr->start_index)
-                break;
-
-              g_ptr_array_index (list->attributes, k - 1) = tmp_attr2;
-              g_ptr_array_index (list->attributes, k) = tmp_attr;
+              node_unlink (list, node);
+              node_link (list, node, before);
             }
+          else
+            node_update_path (node);
         }
     }
 }
@@ -2225,57 +2742,62 @@ pango_attr_list_update (PangoAttrList *list,
                         int             remove,
                         int             add)
 {
-  guint i, p;
+  PangoAttrNode *node, *next;
 
   g_return_if_fail (pos >= 0);
   g_return_if_fail (remove >= 0);
   g_return_if_fail (add >= 0);
 
-  if (list->attributes)
-    for (i = 0, p = list->attributes->len; i < p; i++)
-      {
-        PangoAttribute *attr = g_ptr_array_index (list->attributes, i);
+  list->serial++;
 
-        if (attr->start_index >= pos &&
+  for (node = node_first (list->root); node; node = next)
+    {
+      PangoAttribute *attr = node->attr;
+
+      next = node_next (node);
+
+      if (attr->start_index >= pos &&
           attr->end_index < pos + remove)
-          {
-            pango_attribute_destroy (attr);
-            g_ptr_array_remove_index (list->attributes, i);
-            i--; /* Look at this index again */
-            p--;
-            continue;
-          }
+        {
+          /* The bounds of the nodes are updated below */
+          node_unlink (list, node);
+          g_slice_free (PangoAttrNode, node);
+          pango_attribute_destroy (attr);
+          continue;
+        }
 
-        if (attr->start_index != PANGO_ATTR_INDEX_FROM_TEXT_BEGINNING)
-          {
-            if (attr->start_index >= pos &&
-                attr->start_index < pos + remove)
-              {
-                attr->start_index = pos + add;
-              }
-            else if (attr->start_index >= pos + remove)
-              {
-                attr->start_index += add - remove;
-              }
-          }
+      if (attr->start_index != PANGO_ATTR_INDEX_FROM_TEXT_BEGINNING)
+        {
+          if (attr->start_index >= pos &&
+              attr->start_index < pos + remove)
+            {
+              attr->start_index = pos + add;
+            }
+          else if (attr->start_index >= pos + remove)
+            {
+              attr->start_index += add - remove;
+            }
+        }
 
-        if (attr->end_index != PANGO_ATTR_INDEX_TO_TEXT_END)
-          {
-            if (attr->end_index >= pos &&
-                attr->end_index < pos + remove)
-              {
-                attr->end_index = pos;
-              }
-            else if (attr->end_index >= pos + remove)
-              {
-                if (add > remove &&
-                    G_MAXUINT - attr->end_index < add - remove)
-                  attr->end_index = G_MAXUINT;
-                else
-                  attr->end_index += add - remove;
-              }
-          }
-      }
+      if (attr->end_index != PANGO_ATTR_INDEX_TO_TEXT_END)
+        {
+          if (attr->end_index >= pos &&
+              attr->end_index < pos + remove)
+            {
+              attr->end_index = pos;
+            }
+          else if (attr->end_index >= pos + remove)
+            {
+              if (add > remove &&
+                  G_MAXUINT - attr->end_index < add - remove)
+                attr->end_index = G_MAXUINT;
+              else
+                attr->end_index += add - remove;
+            }
+        }
+    }
+
+  node_update_all (list->root);
 }
 
 /**
@@ -2312,7 +2834,7 @@ pango_attr_list_splice (PangoAttrList *list,
                         gint           pos,
                         gint           len)
 {
-  guint i, p;
+  PangoAttrNode *node;
   guint upos, ulen;
   guint end;
 
@@ -2331,34 +2853,34 @@ pango_attr_list_splice (PangoAttrList *list,
 
   end = CLAMP_ADD (upos, ulen);
 
-  if (list->attributes)
-    for (i = 0, p = list->attributes->len; i < p; i++)
-      {
-        PangoAttribute *attr = g_ptr_array_index (list->attributes, i);;
+  list->serial++;
 
-        if (attr->start_index <= upos)
-          {
-            if (attr->end_index > upos)
-              attr->end_index = CLAMP_ADD (attr->end_index, ulen);
-          }
-        else
-          {
-            /* This could result in a zero length attribute if it
-             * gets squashed up against G_MAXUINT, but deleting such
-             * an element could (in theory) suprise the caller, so
-             * we don't delete it.
-             */
-            attr->start_index = CLAMP_ADD (attr->start_index, ulen);
+  for (node = node_first (list->root); node; node = node_next (node))
+    {
+      PangoAttribute *attr = node->attr;
+
+      if (attr->start_index <= upos)
+        {
+          if (attr->end_index > upos)
             attr->end_index = CLAMP_ADD (attr->end_index, ulen);
-         }
-      }
+        }
+      else
+        {
+          /* This could result in a zero length attribute if it
+           * gets squashed up against G_MAXUINT, but deleting such
+           * an element could (in theory) suprise the caller, so
+           * we don't delete it.
+           */
+          attr->start_index = CLAMP_ADD (attr->start_index, ulen);
+          attr->end_index = CLAMP_ADD (attr->end_index, ulen);
+       }
+    }
 
-  if (!other->attributes || other->attributes->len == 0)
-    return;
+  node_update_all (list->root);
 
-  for (i = 0, p = other->attributes->len; i < p; i++)
+  for (node = node_first (other->root); node; node = node_next (node))
     {
-      PangoAttribute *attr = pango_attribute_copy (g_ptr_array_index (other->attributes, i));
+      PangoAttribute *attr = pango_attribute_copy (node->attr);
       if (ulen > 0)
         {
           attr->start_index = MIN (CLAMP_ADD (attr->start_index, upos), end);
@@ -2395,19 +2917,12 @@ GSList *
 pango_attr_list_get_attributes (PangoAttrList *list)
 {
   GSList *result = NULL;
-  guint i, p;
+  PangoAttrNode *node;
 
   g_return_val_if_fail (list != NULL, NULL);
 
-  if (!list->attributes || list->attributes->len == 0)
-    return NULL;
-
-  for (i = 0, p = list->attributes->len; i < p; i++)
-    {
-      PangoAttribute *attr = g_ptr_array_index (list->attributes, i);
-
-      result = g_slist_prepend (result, pango_attribute_copy (attr));
-    }
+  for (node = node_first (list->root); node; node = node_next (node))
+    result = g_slist_prepend (result, pango_attribute_copy (node->attr));
 
   return g_slist_reverse (result);
 }
@@ -2433,9 +2948,8 @@ gboolean
 pango_attr_list_equal (PangoAttrList *list,
                        PangoAttrList *other_list)
 {
-  GPtrArray *attrs, *other_attrs;
+  PangoAttrNode *node;
   guint64 skip_bitmask = 0;
-  guint i;
 
   if (list == other_list)
     return TRUE;
@@ -2443,24 +2957,21 @@ pango_attr_list_equal (PangoAttrList *list,
   if (list == NULL || other_list == NULL)
     return FALSE;
 
-  if (list->attributes == NULL || other_list->attributes == NULL)
-    return list->attributes == other_list->attributes;
-
-  attrs = list->attributes;
-  other_attrs = other_list->attributes;
-
-  if (attrs->len != other_attrs->len)
+  if (list->n_attrs != other_list->n_attrs)
     return FALSE;
 
-  for (i = 0; i < attrs->len; i++)
+  for (node = node_first (list->root); node; node = node_next (node))
     {
-      PangoAttribute *attr = g_ptr_array_index (attrs, i);
+      PangoAttribute *attr = node->attr;
+      PangoAttrNode *other_node;
       gboolean attr_equal = FALSE;
       guint other_attr_index;
 
-      for (other_attr_index = 0; other_attr_index < other_attrs->len; other_attr_index++)
+      for (other_node = node_first (other_list->root), other_attr_index = 0;
+           other_node;
+           other_node = node_next (other_node), other_attr_index++)
         {
-          PangoAttribute *other_attr = g_ptr_array_index (other_attrs, other_attr_index);
+          PangoAttribute *other_attr = other_node->attr;
           guint64 other_attr_bitmask = other_attr_index < 64 ? 1 << other_attr_index : 0;
 
           if ((skip_bitmask & other_attr_bitmask) != 0)
@@ -2487,7 +2998,7 @@ pango_attr_list_equal (PangoAttrList *list,
 gboolean
 _pango_attr_list_has_attributes (const PangoAttrList *list)
 {
-  return list && list->attributes != NULL && list->attributes->len > 0;
+  return list && list->root != NULL;
 }
 
 /**
@@ -2514,30 +3025,22 @@ pango_attr_list_filter (PangoAttrList       *list,
 
 {
   PangoAttrList *new = NULL;
-  guint i, p;
+  PangoAttrNode *node, *next;
 
   g_return_val_if_fail (list != NULL, NULL);
 
-  if (!list->attributes || list->attributes->len == 0)
-    return NULL;
-
-  for (i = 0, p = list->attributes->len; i < p; i++)
+  for (node = node_first (list->root); node; node = next)
     {
-      PangoAttribute *tmp_attr = g_ptr_array_index (list->attributes, i);
+      next = node_next (node);
 
-      if ((*func) (tmp_attr, data))
+      if ((*func) (node->attr, data))
         {
-          g_ptr_array_remove_index (list->attributes, i);
-          i--; /* Need to look at this index again */
-          p--;
+          node_unlink (list, node);
 
           if (G_UNLIKELY (!new))
-            {
-              new = pango_attr_list_new ();
-              new->attributes = g_ptr_array_new ();
-            }
+            new = pango_attr_list_new ();
 
-          g_ptr_array_add (new->attributes, tmp_attr);
+          node_link (new, node, NULL);
         }
     }
 
@@ -2700,15 +3203,12 @@ pango_attr_list_to_string (PangoAttrList *list)
 
   s = g_string_new ("");
 
-  if (list->attributes)
-    for (int i = 0; i < list->attributes->len; i++)
-      {
-        PangoAttribute *attr = g_ptr_array_index (list->attributes, i);
-
-        if (i > 0)
-          g_string_append (s, "\n");
-        attr_print (s, attr);
-      }
+  for (PangoAttrNode *node = node_first (list->root); node; node = node_next (node))
+    {
+      if (s->len > 0)
+        g_string_append (s, "\n");
+      attr_print (s, node->attr);
+    }
 
   return g_string_free (s, FALSE);
 }
@@ -2791,8 +3291,6 @@ pango_attr_list_from_string (const char *text)
   if (*text == '\0')
     return list;
 
-  list->attributes = g_ptr_array_new ();
-
   p = text + strspn (text, " \t\n");
   while (*p)
     {
@@ -3065,7 +3563,7 @@ pango_attr_list_from_string (const char *text)
 
       attr->start_index = (guint)start_index;
       attr->end_index = (guint)end_index;
-      g_ptr_array_add (list->attributes, attr);
+      _pango_attr_list_append (list, attr);
 
       p = endp;
       if (*p)
@@ -3094,15 +3592,163 @@ G_DEFINE_BOXED_TYPE (PangoAttrIterator,
                      pango_attr_iterator_copy,
                      pango_attr_iterator_destroy)
 
+/* The font attributes at the current position, see ensure_font_memo() */
+struct _PangoAttrFontMemo
+{
+  guint serial;
+  PangoFontDescription *desc;
+  PangoLanguage *language;
+  double scale;
+  guint have_scale : 1;
+  guint copy_family : 1;
+};
+
+static gboolean
+is_font_attr (const PangoAttribute *attr)
+{
+  switch ((int) attr->klass->type)
+    {
+    case PANGO_ATTR_FONT_DESC:
+    case PANGO_ATTR_FAMILY:
+    case PANGO_ATTR_STYLE:
+    case PANGO_ATTR_VARIANT:
+    case PANGO_ATTR_WEIGHT:
+    case PANGO_ATTR_STRETCH:
+    case PANGO_ATTR_SIZE:
+    case PANGO_ATTR_ABSOLUTE_SIZE:
+    case PANGO_ATTR_SCALE:
+    case PANGO_ATTR_LANGUAGE:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static void
+font_memo_free (PangoAttrFontMemo *memo)
+{
+  pango_font_description_free (memo->desc);
+  g_slice_free (PangoAttrFontMemo, memo);
+}
+
+/* The attributes that apply at the current position are kept
+ * in attribute_stack, in the order they were added. Attributes
+ * that run out are replaced by NULL, so that the order does not
+ * change, and the stack is compacted once most of it is unused.
+ *
+ * end_heap holds the positions of the live attributes in the
+ * stack, as a min-heap ordered by end index. This way, we find
+ * the end of the current range and the attributes that expire
+ * without looking at every attribute on the stack.
+ */
+#define STACK_ATTR(iterator, pos) \
+  ((PangoAttribute *) g_ptr_array_index ((iterator)->attribute_stack, (pos)))
+#define HEAP_END(iterator, i) \
+  (STACK_ATTR ((iterator), g_array_index ((iterator)->end_heap, guint, (i)))->end_index)
+
+static void
+end_heap_sift_down (PangoAttrIterator *iterator,
+                    guint              i)
+{
+  GArray *heap = iterator->end_heap;
+
+  while (TRUE)
+    {
+      guint left = 2 * i + 1;
+      guint right = left + 1;
+      guint smallest = i;
+      guint tmp;
+
+      if (left < heap->len && HEAP_END (iterator, left) < HEAP_END (iterator, smallest))
+        smallest = left;
+      if (right < heap->len && HEAP_END (iterator, right) < HEAP_END (iterator, smallest))
+        smallest = right;
+
+      if (smallest == i)
+        break;
+
+      tmp = g_array_index (heap, guint, i);
+      g_array_index (heap, guint, i) = g_array_index (heap, guint, smallest);
+      g_array_index (heap, guint, smallest) = tmp;
+      i = smallest;
+    }
+}
+
+static void
+end_heap_push (PangoAttrIterator *iterator,
+               guint              pos)
+{
+  GArray *heap = iterator->end_heap;
+  guint i;
+
+  g_array_append_val (heap, pos);
+
+  for (i = heap->len - 1; i > 0; i = (i - 1) / 2)
+    {
+      guint parent = (i - 1) / 2;
+      guint tmp;
+
+      if (HEAP_END (iterator, parent) <= HEAP_END (iterator, i))
+        break;
+
+      tmp = g_array_index (heap, guint, i);
+      g_array_index (heap, guint, i) = g_array_index (heap, guint, parent);
+      g_array_index (heap, guint, parent) = tmp;
+    }
+}
+
+static guint
+end_heap_pop (PangoAttrIterator *iterator)
+{
+  GArray *heap = iterator->end_heap;
+  guint pos;
+
+  pos = g_array_index (heap, guint, 0);
+  g_array_index (heap, guint, 0) = g_array_index (heap, guint, heap->len - 1);
+  g_array_set_size (heap, heap->len - 1);
+
+  if (heap->len > 1)
+    end_heap_sift_down (iterator, 0);
+
+  return pos;
+}
+
+/* Drops the removed attributes from the stack, and rebuilds
+ * the heap for the new positions.
+ */
+static void
+compact_attribute_stack (PangoAttrIterator *iterator)
+{
+  GPtrArray *stack = iterator->attribute_stack;
+  GArray *heap = iterator->end_heap;
+  guint i, len;
+
+  for (i = 0, len = 0; i < stack->len; i++)
+    {
+      if (g_ptr_array_index (stack, i))
+        g_ptr_array_index (stack, len++) = g_ptr_array_index (stack, i);
+    }
+
+  g_ptr_array_set_size (stack, len);
+
+  g_assert (len == heap->len);
+
+  for (i = 0; i < len; i++)
+    g_array_index (heap, guint, i) = i;
+
+  for (i = len / 2; i > 0; i--)
+    end_heap_sift_down (iterator, i - 1);
+}
+
 void
 _pango_attr_list_get_iterator (PangoAttrList     *list,
                                PangoAttrIterator *iterator)
 {
   iterator->attribute_stack = NULL;
-  iterator->attrs = list->attributes;
-  iterator->n_attrs = iterator->attrs ? iterator->attrs->len : 0;
-
-  iterator->attr_index = 0;
+  iterator->end_heap = NULL;
+  iterator->font_serial = 0;
+  iterator->font_memo = NULL;
+  iterator->next_node = node_first (list->root);
   iterator->start_index = 0;
   iterator->end_index = 0;
 
@@ -3173,38 +3819,43 @@ pango_attr_iterator_range (PangoAttrIterator *iterator,
 gboolean
 pango_attr_iterator_next (PangoAttrIterator *iterator)
 {
-  int i;
-
   g_return_val_if_fail (iterator != NULL, FALSE);
 
-  if (iterator->attr_index >= iterator->n_attrs &&
-      (!iterator->attribute_stack || iterator->attribute_stack->len == 0))
+  if (!iterator->next_node &&
+      (!iterator->end_heap || iterator->end_heap->len == 0))
     return FALSE;
 
   iterator->start_index = iterator->end_index;
   iterator->end_index = G_MAXUINT;
 
-  if (iterator->attribute_stack)
+  if (iterator->end_heap)
     {
-      for (i = iterator->attribute_stack->len - 1; i>= 0; i--)
+      while (iterator->end_heap->len > 0 &&
+             HEAP_END (iterator, 0) <= iterator->start_index)
         {
-          const PangoAttribute *attr = g_ptr_array_index (iterator->attribute_stack, i);
+          guint pos = end_heap_pop (iterator);
 
-          if (attr->end_index == iterator->start_index)
-            g_ptr_array_remove_index (iterator->attribute_stack, i); /* Can't use index_fast :( */
-          else
-            iterator->end_index = MIN (iterator->end_index, attr->end_index);
+          if (is_font_attr (g_ptr_array_index (iterator->attribute_stack, pos)))
+            iterator->font_serial++;
+
+          g_ptr_array_index (iterator->attribute_stack, pos) = NULL;
         }
+
+      if (iterator->end_heap->len < iterator->attribute_stack->len / 2)
+        compact_attribute_stack (iterator);
+
+      if (iterator->end_heap->len > 0)
+        iterator->end_index = HEAP_END (iterator, 0);
     }
 
   while (1)
     {
       PangoAttribute *attr;
 
-      if (iterator->attr_index >= iterator->n_attrs)
+      if (!iterator->next_node)
         break;
 
-      attr = g_ptr_array_index (iterator->attrs, iterator->attr_index);
+      attr = iterator->next_node->attr;
 
       if (attr->start_index != iterator->start_index)
         break;
@@ -3212,19 +3863,26 @@ pango_attr_iterator_next (PangoAttrIterator *iterator)
       if (attr->end_index > iterator->start_index)
         {
           if (G_UNLIKELY (!iterator->attribute_stack))
-            iterator->attribute_stack = g_ptr_array_new ();
+            {
+              iterator->attribute_stack = g_ptr_array_new ();
+              iterator->end_heap = g_array_new (FALSE, FALSE, sizeof (guint));
+            }
 
           g_ptr_array_add (iterator->attribute_stack, attr);
+          end_heap_push (iterator, iterator->attribute_stack->len - 1);
+
+          if (is_font_attr (attr))
+            iterator->font_serial++;
 
           iterator->end_index = MIN (iterator->end_index, attr->end_index);
         }
 
-      iterator->attr_index++; /* NEXT! */
+      iterator->next_node = node_next (iterator->next_node); /* NEXT! */
     }
 
-  if (iterator->attr_index < iterator->n_attrs)
-      {
-      PangoAttribute *attr = g_ptr_array_index (iterator->attrs, iterator->attr_index);
+  if (iterator->next_node)
+    {
+      PangoAttribute *attr = iterator->next_node->attr;
 
       iterator->end_index = MIN (iterator->end_index, attr->start_index);
     }
@@ -3254,9 +3912,17 @@ pango_attr_iterator_copy (PangoAttrIterator *iterator)
   *copy = *iterator;
 
   if (iterator->attribute_stack)
-    copy->attribute_stack = g_ptr_array_copy (iterator->attribute_stack, NULL, NULL);
+    {
+      copy->attribute_stack = g_ptr_array_copy (iterator->attribute_stack, NULL, NULL);
+      copy->end_heap = g_array_copy (iterator->end_heap);
+    }
   else
-    copy->attribute_stack = NULL;
+    {
+      copy->attribute_stack = NULL;
+      copy->end_heap = NULL;
+    }
+
+  copy->font_memo = NULL;
 
   return copy;
 }
@@ -3265,7 +3931,12 @@ void
 _pango_attr_iterator_destroy (PangoAttrIterator *iterator)
 {
   if (iterator->attribute_stack)
-    g_ptr_array_free (iterator->attribute_stack, TRUE);
+    {
+      g_ptr_array_free (iterator->attribute_stack, TRUE);
+      g_array_free (iterator->end_heap, TRUE);
+    }
+
+  g_clear_pointer (&iterator->font_memo, font_memo_free);
 }
 
 /**
@@ -3314,13 +3985,108 @@ pango_attr_iterator_get (PangoAttrIterator *iterator,
     {
       PangoAttribute *attr = g_ptr_array_index (iterator->attribute_stack, i);
 
-      if (attr->klass->type == type)
+      if (attr && attr->klass->type == type)
         return attr;
     }
 
   return NULL;
 }
 
+/* Collects the font attributes at the current position into
+ * a description that only has the fields set that come from
+ * attributes. The result only changes when font attributes
+ * enter or leave the stack, so we keep it around until then.
+ */
+static PangoAttrFontMemo *
+ensure_font_memo (PangoAttrIterator *iterator)
+{
+  PangoAttrFontMemo *memo = iterator->font_memo;
+  PangoFontDescription *desc;
+  int i;
+
+  if (memo && memo->serial == iterator->font_serial)
+    return memo;
+
+  if (!memo)
+    {
+      memo = g_slice_new0 (PangoAttrFontMemo);
+      iterator->font_memo = memo;
+    }
+  else
+    pango_font_description_free (memo->desc);
+
+  memo->serial = iterator->font_serial;
+  memo->desc = desc = pango_font_description_new ();
+  memo->language = NULL;
+  memo->scale = 0;
+  memo->have_scale = FALSE;
+  memo->copy_family = FALSE;
+
+  for (i = iterator->attribute_stack->len - 1; i >= 0; i--)
+    {
+      const PangoAttribute *attr = g_ptr_array_index (iterator->attribute_stack, i);
+      PangoFontMask mask;
+
+      if (!attr)
+        continue;
+
+      mask = pango_font_description_get_set_fields (desc);
+
+      switch ((int) attr->klass->type)
+        {
+        case PANGO_ATTR_FONT_DESC:
+          pango_font_description_merge_static (desc, ((PangoAttrFontDesc *)attr)->desc, FALSE);
+          break;
+        case PANGO_ATTR_FAMILY:
+          if (!(mask & PANGO_FONT_MASK_FAMILY))
+            {
+              pango_font_description_set_family_static (desc, ((PangoAttrString *)attr)->value);
+              memo->copy_family = TRUE;
+            }
+          break;
+        case PANGO_ATTR_STYLE:
+          if (!(mask & PANGO_FONT_MASK_STYLE))
+            pango_font_description_set_style (desc, ((PangoAttrInt *)attr)->value);
+          break;
+        case PANGO_ATTR_VARIANT:
+          if (!(mask & PANGO_FONT_MASK_VARIANT))
+            pango_font_description_set_variant (desc, ((PangoAttrInt *)attr)->value);
+          break;
+        case PANGO_ATTR_WEIGHT:
+          if (!(mask & PANGO_FONT_MASK_WEIGHT))
+            pango_font_description_set_weight (desc, ((PangoAttrInt *)attr)->value);
+          break;
+        case PANGO_ATTR_STRETCH:
+          if (!(mask & PANGO_FONT_MASK_STRETCH))
+            pango_font_description_set_stretch (desc, ((PangoAttrInt *)attr)->value);
+          break;
+        case PANGO_ATTR_SIZE:
+          if (!(mask & PANGO_FONT_MASK_SIZE))
+            pango_font_description_set_size (desc, ((PangoAttrSize *)attr)->size);
+          break;
+        case PANGO_ATTR_ABSOLUTE_SIZE:
+          if (!(mask & PANGO_FONT_MASK_SIZE))
+            pango_font_description_set_absolute_size (desc, ((PangoAttrSize *)attr)->size);
+          break;
+        case PANGO_ATTR_SCALE:
+          if (!memo->have_scale)
+            {
+              memo->have_scale = TRUE;
+              memo->scale = ((PangoAttrFloat *)attr)->value;
+            }
+          break;
+        case PANGO_ATTR_LANGUAGE:
+          if (!memo->language)
+            memo->language = ((PangoAttrLanguage *)attr)->value;
+          break;
+        default:
+          break;
+        }
+    }
+
+  return memo;
+}
+
 /**
  * pango_attr_iterator_get_font:
  * @iterator: a `PangoAttrIterator`
@@ -3349,10 +4115,7 @@ pango_attr_iterator_get_font (PangoAttrIterator     *iterator,
                               PangoLanguage        **language,
                               GSList               **extra_attrs)
 {
-  PangoFontMask mask = 0;
-  gboolean have_language = FALSE;
-  gdouble scale = 0;
-  gboolean have_scale = FALSE;
+  PangoAttrFontMemo *memo;
   int i;
 
   g_return_if_fail (iterator != NULL);
@@ -3367,128 +4130,60 @@ pango_attr_iterator_get_font (PangoAttrIterator     *iterator,
   if (!iterator->attribute_stack)
     return;
 
-  for (i = iterator->attribute_stack->len - 1; i >= 0; i--)
-    {
-      const PangoAttribute *attr = g_ptr_array_index (iterator->attribute_stack, i);
+  memo = ensure_font_memo (iterator);
 
-      switch ((int) attr->klass->type)
+  pango_font_description_merge_static (desc, memo->desc, TRUE);
+  if (memo->copy_family)
+    pango_font_description_set_family (desc, pango_font_description_get_family (desc));
+
+  if (language)
+    *language = memo->language;
+
+  if (extra_attrs)
+    {
+      for (i = iterator->attribute_stack->len - 1; i >= 0; i--)
         {
-        case PANGO_ATTR_FONT_DESC:
-          {
-            PangoFontMask new_mask = pango_font_description_get_set_fields (((PangoAttrFontDesc *)attr)->desc) & ~mask;
-            mask |= new_mask;
-            pango_font_description_unset_fields (desc, new_mask);
-            pango_font_description_merge_static (desc, ((PangoAttrFontDesc *)attr)->desc, FALSE);
+          const PangoAttribute *attr = g_ptr_array_index (iterator->attribute_stack, i);
+          gboolean found = FALSE;
 
-            break;
-          }
-        case PANGO_ATTR_FAMILY:
-          if (!(mask & PANGO_FONT_MASK_FAMILY))
-            {
-              mask |= PANGO_FONT_MASK_FAMILY;
-              pango_font_description_set_family (desc, ((PangoAttrString *)attr)->value);
-            }
-          break;
-        case PANGO_ATTR_STYLE:
-          if (!(mask & PANGO_FONT_MASK_STYLE))
-            {
-              mask |= PANGO_FONT_MASK_STYLE;
-              pango_font_description_set_style (desc, ((PangoAttrInt *)attr)->value);
-            }
-          break;
-        case PANGO_ATTR_VARIANT:
-          if (!(mask & PANGO_FONT_MASK_VARIANT))
-            {
-              mask |= PANGO_FONT_MASK_VARIANT;
-              pango_font_description_set_variant (desc, ((PangoAttrInt *)attr)->value);
-            }
-          break;
-        case PANGO_ATTR_WEIGHT:
-          if (!(mask & PANGO_FONT_MASK_WEIGHT))
-            {
-              mask |= PANGO_FONT_MASK_WEIGHT;
-              pango_font_description_set_weight (desc, ((PangoAttrInt *)attr)->value);
-            }
-          break;
-        case PANGO_ATTR_STRETCH:
-          if (!(mask & PANGO_FONT_MASK_STRETCH))
-            {
-              mask |= PANGO_FONT_MASK_STRETCH;
-              pango_font_description_set_stretch (desc, ((PangoAttrInt *)attr)->value);
-            }
-          break;
-        case PANGO_ATTR_SIZE:
-          if (!(mask & PANGO_FONT_MASK_SIZE))
-            {
-              mask |= PANGO_FONT_MASK_SIZE;
-              pango_font_description_set_size (desc, ((PangoAttrSize *)attr)->size);
-            }
-          break;
-        case PANGO_ATTR_ABSOLUTE_SIZE:
-          if (!(mask & PANGO_FONT_MASK_SIZE))
-            {
-              mask |= PANGO_FONT_MASK_SIZE;
-              pango_font_description_set_absolute_size (desc, ((PangoAttrSize *)attr)->size);
-            }
-          break;
-        case PANGO_ATTR_SCALE:
-          if (!have_scale)
-            {
-              have_scale = TRUE;
-              scale = ((PangoAttrFloat *)attr)->value;
-            }
-          break;
-        case PANGO_ATTR_LANGUAGE:
-          if (language)
-            {
-              if (!have_language)
-                {
-                  have_language = TRUE;
-                  *language = ((PangoAttrLanguage *)attr)->value;
-                }
-            }
-          break;
-        default:
-          if (extra_attrs)
-            {
-              gboolean found = FALSE;
+          if (!attr || is_font_attr (attr))
+            continue;
 
-              /* Hack: special-case FONT_FEATURES, BASELINE_SHIFT and FONT_SCALE.
-               * We don't want these to accumulate, not override each other,
-               * so we never merge them.
-               * This needs to be handled more systematically.
-               */
-              if (attr->klass->type != PANGO_ATTR_FONT_FEATURES &&
-                  attr->klass->type != PANGO_ATTR_BASELINE_SHIFT &&
-                  attr->klass->type != PANGO_ATTR_FONT_SCALE)
+          /* Hack: special-case FONT_FEATURES, BASELINE_SHIFT and FONT_SCALE.
+           * We don't want these to accumulate, not override each other,
+           * so we never merge them.
+           * This needs to be handled more systematically.
+           */
+          if (attr->klass->type != PANGO_ATTR_FONT_FEATURES &&
+              attr->klass->type != PANGO_ATTR_BASELINE_SHIFT &&
+              attr->klass->type != PANGO_ATTR_FONT_SCALE)
+            {
+              GSList *tmp_list = *extra_attrs;
+              while (tmp_list)
                 {
-                  GSList *tmp_list = *extra_attrs;
-                  while (tmp_list)
+                  PangoAttribute *old_attr = tmp_list->data;
+                  if (attr->klass->type == old_attr->klass->type)
                     {
-                      PangoAttribute *old_attr = tmp_list->data;
-                      if (attr->klass->type == old_attr->klass->type)
-                        {
-                          found = TRUE;
-                          break;
-                        }
-
-                      tmp_list = tmp_list->next;
+                      found = TRUE;
+                      break;
                     }
-                }
 
-              if (!found)
-                *extra_attrs = g_slist_prepend (*extra_attrs, pango_attribute_copy (attr));
+                  tmp_list = tmp_list->next;
+                }
             }
+
+          if (!found)
+            *extra_attrs = g_slist_prepend (*extra_attrs, pango_attribute_copy (attr));
         }
     }
 
-  if (have_scale)
+  if (memo->have_scale)
     {
       /* We need to use a local variable to ensure that the compiler won't
        * implicitly cast it to integer while the result is kept in registers,
        * leading to a wrong approximation in i386 (with 387 FPU)
        */
-      volatile double size = scale * pango_font_description_get_size (desc);
+      volatile double size = memo->scale * pango_font_description_get_size (desc);
 
       if (pango_font_description_get_size_is_absolute (desc))
         pango_font_description_set_absolute_size (desc, size);
@@ -3517,8 +4212,8 @@ pango_attr_iterator_get_attrs (PangoAttrIterator *iterator)
   GSList *attrs = NULL;
   int i;
 
-  if (!iterator->attribute_stack ||
-      iterator->attribute_stack->len == 0)
+  if (!iterator->end_heap ||
+      iterator->end_heap->len == 0)
     return NULL;
 
   for (i = iterator->attribute_stack->len - 1; i >= 0; i--)
@@ -3527,6 +4222,9 @@ pango_attr_iterator_get_attrs (PangoAttrIterator *iterator)
       GSList *tmp_list2;
       gboolean found = FALSE;
 
+      if (!attr)
+        continue;
+
       if (attr->klass->type != PANGO_ATTR_FONT_DESC &&
           attr->klass->type != PANGO_ATTR_BASELINE_SHIFT &&
           attr->klass->type != PANGO_ATTR_FONT_SCALE)
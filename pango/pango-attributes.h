@@ -681,6 +681,10 @@ void                    pango_attr_list_insert          (PangoAttrList         *
 PANGO_AVAILABLE_IN_ALL
 void                    pango_attr_list_insert_before   (PangoAttrList         *list,
                                                          PangoAttribute        *attr);
+PANGO_AVAILABLE_IN_1_52
+void                    pango_attr_list_insert_array    (PangoAttrList         *list,
+                                                         PangoAttribute       **attrs,
+                                                         guint                  n_attrs);
 PANGO_AVAILABLE_IN_ALL
 void                    pango_attr_list_change          (PangoAttrList         *list,
                                                          PangoAttribute        *attr);
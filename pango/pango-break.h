@@ -116,6 +116,27 @@ void                    pango_get_log_attrs     (const char    *text,
                                                  PangoLogAttr  *attrs,
                                                  int            attrs_len);
 
+PANGO_AVAILABLE_IN_1_52
+void                    pango_get_log_attrs_parallel (const char    *text,
+                                                      int            length,
+                                                      int            level,
+                                                      PangoLanguage *language,
+                                                      PangoLogAttr  *attrs,
+                                                      int            attrs_len,
+                                                      int            n_threads);
+
+PANGO_AVAILABLE_IN_1_52
+PangoLogAttr *          pango_update_log_attrs  (const char    *text,
+                                                 int            length,
+                                                 int            level,
+                                                 PangoLanguage *language,
+                                                 int            offset,
+                                                 int            n_removed,
+                                                 int            n_added,
+                                                 PangoLogAttr  *attrs,
+                                                 int            attrs_len,
+                                                 int           *new_attrs_len);
+
 PANGO_AVAILABLE_IN_ALL
 void                    pango_default_break     (const char    *text,
                                                  int            length,
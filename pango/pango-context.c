@@ -61,6 +61,8 @@ G_DEFINE_TYPE (PangoContext, pango_context, G_TYPE_OBJECT)
 static void
 pango_context_init (PangoContext *context)
 {
+  PangoFontDescription *desc;
+
   context->base_dir = PANGO_DIRECTION_WEAK_LTR;
   context->resolved_gravity = context->base_gravity = PANGO_GRAVITY_SOUTH;
   context->gravity_hint = PANGO_GRAVITY_HINT_NATURAL;
@@ -71,13 +73,16 @@ pango_context_init (PangoContext *context)
   context->font_map = NULL;
   context->round_glyph_positions = TRUE;
 
-  context->font_desc = pango_font_description_new ();
-  pango_font_description_set_family_static (context->font_desc, "serif");
-  pango_font_description_set_style (context->font_desc, PANGO_STYLE_NORMAL);
-  pango_font_description_set_variant (context->font_desc, PANGO_VARIANT_NORMAL);
-  pango_font_description_set_weight (context->font_desc, PANGO_WEIGHT_NORMAL);
-  pango_font_description_set_stretch (context->font_desc, PANGO_STRETCH_NORMAL);
-  pango_font_description_set_size (context->font_desc, 12 * PANGO_SCALE);
+  desc = pango_font_description_new ();
+  pango_font_description_set_family_static (desc, "serif");
+  pango_font_description_set_style (desc, PANGO_STYLE_NORMAL);
+  pango_font_description_set_variant (desc, PANGO_VARIANT_NORMAL);
+  pango_font_description_set_weight (desc, PANGO_WEIGHT_NORMAL);
+  pango_font_description_set_stretch (desc, PANGO_STRETCH_NORMAL);
+  pango_font_description_set_size (desc, 12 * PANGO_SCALE);
+
+  context->font_desc = _pango_font_description_intern (desc, 0);
+  pango_font_description_free (desc);
 }
 
 static void
@@ -353,7 +358,7 @@ pango_context_set_font_description (PangoContext               *context,
       context_changed (context);
 
       pango_font_description_free (context->font_desc);
-      context->font_desc = pango_font_description_copy (desc);
+      context->font_desc = _pango_font_description_intern (desc, 0);
     }
 }
 
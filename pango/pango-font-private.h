@@ -33,6 +33,10 @@ G_BEGIN_DECLS
 PANGO_AVAILABLE_IN_ALL
 PangoFontMetrics *pango_font_metrics_new (void);
 
+PANGO_AVAILABLE_IN_ALL
+PangoFontDescription *_pango_font_description_intern (const PangoFontDescription *desc,
+                                                      PangoFontMask               to_unset);
+
 typedef struct {
   PangoLanguage ** (* get_languages) (PangoFont *font);
 
@@ -33,6 +33,12 @@ G_BEGIN_DECLS
 /* String interning for static strings */
 #define I_(string) g_intern_static_string (string)
 
+/* Fontsets can set this qdata to an object that they share with
+ * other fontsets that have the same fonts. Itemization then keeps
+ * its cache of font choices there, instead of on each fontset.
+ */
+#define PANGO_FONT_CACHE_OWNER "pango-font-cache-owner"
+
 
 /* Some functions for handling PANGO_ATTR_SHAPE */
 void _pango_shape_shape (const char       *text,
@@ -38,6 +38,12 @@ G_BEGIN_DECLS
 
 #define PANGO_ANALYSIS_FLAG_HAS_CHAR_OFFSET (1 << 7)
 
+/* Set on runs that PangoLayout split off another run when
+ * applying attributes that only affect drawing, so that the
+ * split can be undone when only those attributes change.
+ */
+#define PANGO_ANALYSIS_FLAG_PAINT_SPLIT (1 << 6)
+
 typedef struct _PangoAnalysisPrivate PangoAnalysisPrivate;
 
 struct _PangoAnalysisPrivate
@@ -81,8 +81,17 @@ struct _PangoLayout
   /* Not copied during _copy() */
 
   PangoLogAttr *log_attrs;	/* Logical attributes for layout's text */
+  int log_attrs_end;		/* Offset of the first paragraph without log attrs */
   GSList *lines;
   guint line_count;		/* Number of lines in @lines. 0 if lines is %NULL */
+
+  /* The effective attributes, split by what they affect */
+  PangoAttrList *itemize_attrs;
+  PangoAttrList *shape_attrs;
+  PangoAttrList *paint_attrs;
+  guint attrs_serial;		/* Serial of @attrs when they were split */
+  guint attrs_split : 1;
+  guint lines_use_split : 1;	/* @lines were made from the split attributes */
 };
 
 typedef struct _Extents Extents;
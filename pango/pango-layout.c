@@ -177,8 +177,11 @@ static void layout_changed  (PangoLayout *layout);
 
 static void pango_layout_clear_lines (PangoLayout *layout);
 static void pango_layout_check_lines (PangoLayout *layout);
+static void ensure_log_attrs (PangoLayout *layout);
 
-static PangoAttrList *pango_layout_get_effective_attributes (PangoLayout *layout);
+static void ensure_attribute_split (PangoLayout *layout);
+static void clear_attribute_split (PangoLayout *layout);
+static gboolean update_paint_attributes (PangoLayout *layout, PangoAttrList *attrs);
 
 static PangoLayoutLine * pango_layout_line_new         (PangoLayout     *layout);
 static void              pango_layout_line_postprocess (PangoLayoutLine *line,
@@ -255,6 +258,7 @@ pango_layout_finalize (GObject *object)
 
   pango_layout_clear_lines (layout);
   g_free (layout->log_attrs);
+  clear_attribute_split (layout);
 
   if (layout->context)
     g_object_unref (layout->context);
@@ -719,6 +723,24 @@ pango_layout_set_attributes (PangoLayout   *layout,
 
   old_attrs = layout->attrs;
 
+  /* If only attributes that don't affect the layout changed,
+   * we can keep the lines and just apply the new attributes
+   */
+  if (update_paint_attributes (layout, attrs))
+    {
+      layout->attrs = attrs;
+      if (layout->attrs)
+        pango_attr_list_ref (layout->attrs);
+
+      layout->serial++;
+      if (layout->serial == 0)
+        layout->serial++;
+
+      if (old_attrs)
+        pango_attr_list_unref (old_attrs);
+      return;
+    }
+
   /* We always clear lines such that this function can be called
    * whenever attrs changes.
    */
@@ -727,6 +749,7 @@ pango_layout_set_attributes (PangoLayout   *layout,
     pango_attr_list_ref (layout->attrs);
 
   g_clear_pointer (&layout->log_attrs, g_free);
+  clear_attribute_split (layout);
   layout_changed (layout);
 
   if (old_attrs)
@@ -775,6 +798,7 @@ pango_layout_set_font_description (PangoLayout                *layout,
 
       layout->font_desc = desc ? pango_font_description_copy (desc) : NULL;
 
+      clear_attribute_split (layout);
       layout_changed (layout);
       layout->tab_width = -1;
     }
@@ -1095,6 +1119,7 @@ pango_layout_set_single_paragraph_mode (PangoLayout *layout,
   if (layout->single_paragraph != setting)
     {
       layout->single_paragraph = setting;
+      clear_attribute_split (layout);
       layout_changed (layout);
     }
 }
@@ -1559,6 +1584,7 @@ pango_layout_get_log_attrs (PangoLayout   *layout,
   g_return_if_fail (layout != NULL);
 
   pango_layout_check_lines (layout);
+  ensure_log_attrs (layout);
 
   if (attrs)
     {
@@ -1601,6 +1627,7 @@ pango_layout_get_log_attrs_readonly (PangoLayout *layout,
   g_return_val_if_fail (layout != NULL, NULL);
 
   pango_layout_check_lines (layout);
+  ensure_log_attrs (layout);
 
   if (n_attrs)
     *n_attrs = layout->n_chars + 1;
@@ -3321,7 +3348,6 @@ ensure_tab_width (PangoLayout *layout)
       PangoItem *item;
       GList *items;
       PangoAttribute *attr;
-      PangoAttrList *layout_attrs;
       PangoAttrList tmp_attrs;
       PangoFontDescription *font_desc = pango_font_description_copy_static (pango_context_get_font_description (layout->context));
       PangoLanguage *language = NULL;
@@ -3330,12 +3356,12 @@ ensure_tab_width (PangoLayout *layout)
       if (pango_context_get_round_glyph_positions (layout->context))
         shape_flags |= PANGO_SHAPE_ROUND_POSITIONS;
 
-      layout_attrs = pango_layout_get_effective_attributes (layout);
-      if (layout_attrs)
+      ensure_attribute_split (layout);
+      if (layout->itemize_attrs)
         {
           PangoAttrIterator iter;
 
-          _pango_attr_list_get_iterator (layout_attrs, &iter);
+          _pango_attr_list_get_iterator (layout->itemize_attrs, &iter);
           pango_attr_iterator_get_font (&iter, font_desc, &language, NULL);
           _pango_attr_iterator_destroy (&iter);
         }
@@ -3354,11 +3380,6 @@ ensure_tab_width (PangoLayout *layout)
 
       items = pango_itemize (layout->context, " ", 0, 1, &tmp_attrs, NULL);
 
-      if (layout_attrs != layout->attrs)
-        {
-          pango_attr_list_unref (layout_attrs);
-          layout_attrs = NULL;
-        }
       _pango_attr_list_destroy (&tmp_attrs);
 
       item = items->data;
@@ -4622,39 +4643,6 @@ get_items_log_attrs (const char    *text,
     }
 }
 
-static PangoAttrList *
-pango_layout_get_effective_attributes (PangoLayout *layout)
-{
-  PangoAttrList *attrs;
-
-  if (layout->attrs)
-    attrs = pango_attr_list_copy (layout->attrs);
-  else
-    attrs = NULL;
-
-  if (layout->font_desc)
-    {
-      PangoAttribute *attr = pango_attr_font_desc_new (layout->font_desc);
-
-      if (!attrs)
-        attrs = pango_attr_list_new ();
-
-      pango_attr_list_insert_before (attrs, attr);
-    }
-
-  if (layout->single_paragraph)
-    {
-      PangoAttribute *attr = pango_attr_show_new (PANGO_SHOW_LINE_BREAKS);
-
-      if (!attrs)
-        attrs = pango_attr_list_new ();
-
-      pango_attr_list_insert_before (attrs, attr);
-    }
-
-  return attrs;
-}
-
 static gboolean
 affects_itemization (PangoAttribute *attr,
                      gpointer        data)
@@ -4710,6 +4698,104 @@ affects_break_or_shape (PangoAttribute *attr,
     }
 }
 
+/* Splits the effective attributes of the layout, for the
+ * attribute list @attrs, into the ones that affect itemization,
+ * the ones that affect breaking and shaping, and the rest, which
+ * only matter for drawing.
+ */
+static void
+split_attributes (PangoLayout    *layout,
+                  PangoAttrList  *attrs,
+                  PangoAttrList **itemize_attrs,
+                  PangoAttrList **shape_attrs,
+                  PangoAttrList **paint_attrs)
+{
+  GSList *list, *l;
+
+  *itemize_attrs = NULL;
+  *shape_attrs = NULL;
+  *paint_attrs = NULL;
+
+  if (attrs)
+    list = pango_attr_list_get_attributes (attrs);
+  else
+    list = NULL;
+
+  for (l = list; l; l = l->next)
+    {
+      PangoAttribute *attr = l->data;
+      PangoAttrList **result;
+
+      if (affects_break_or_shape (attr, NULL))
+        result = shape_attrs;
+      else if (affects_itemization (attr, NULL))
+        result = itemize_attrs;
+      else
+        result = paint_attrs;
+
+      if (!*result)
+        *result = pango_attr_list_new ();
+
+      _pango_attr_list_append (*result, attr);
+    }
+
+  g_slist_free (list);
+
+  if (layout->font_desc)
+    {
+      PangoAttribute *attr = pango_attr_font_desc_new (layout->font_desc);
+
+      if (!*itemize_attrs)
+        *itemize_attrs = pango_attr_list_new ();
+
+      pango_attr_list_insert_before (*itemize_attrs, attr);
+    }
+
+  if (layout->single_paragraph)
+    {
+      PangoAttribute *attr = pango_attr_show_new (PANGO_SHOW_LINE_BREAKS);
+
+      if (!*shape_attrs)
+        *shape_attrs = pango_attr_list_new ();
+
+      pango_attr_list_insert_before (*shape_attrs, attr);
+    }
+}
+
+/* The split attributes are kept until the layout attributes
+ * change, so that relayouts don't have to copy all the
+ * attributes again.
+ */
+static void
+ensure_attribute_split (PangoLayout *layout)
+{
+  if (layout->attrs_split &&
+      (!layout->attrs || layout->attrs->serial == layout->attrs_serial))
+    return;
+
+  clear_attribute_split (layout);
+
+  split_attributes (layout,
+                    layout->attrs,
+                    &layout->itemize_attrs,
+                    &layout->shape_attrs,
+                    &layout->paint_attrs);
+
+  if (layout->attrs)
+    layout->attrs_serial = layout->attrs->serial;
+  layout->attrs_split = TRUE;
+}
+
+static void
+clear_attribute_split (PangoLayout *layout)
+{
+  g_clear_pointer (&layout->itemize_attrs, pango_attr_list_unref);
+  g_clear_pointer (&layout->shape_attrs, pango_attr_list_unref);
+  g_clear_pointer (&layout->paint_attrs, pango_attr_list_unref);
+  layout->attrs_split = FALSE;
+  layout->lines_use_split = FALSE;
+}
+
 static void
 apply_attributes_to_items (GList         *items,
                            PangoAttrList *attrs)
@@ -4756,6 +4842,17 @@ apply_attributes_to_runs (PangoLayout   *layout,
                                                    layout->text,
                                                    attrs);
 
+          /* Remember which runs were split off, so we can
+           * undo this in update_paint_attributes()
+           */
+          for (GSList *l = new_runs; l; l = l->next)
+            {
+              PangoGlyphItem *run = l->data;
+
+              if (run != glyph_item)
+                run->item->analysis.flags |= PANGO_ANALYSIS_FLAG_PAINT_SPLIT;
+            }
+
           line->runs = g_slist_concat (new_runs, line->runs);
         }
 
@@ -4763,6 +4860,289 @@ apply_attributes_to_runs (PangoLayout   *layout,
     }
 }
 
+/* Undoes the pango_glyph_item_split() call that split
+ * @split off the start of @orig, and frees @split.
+ */
+static void
+unsplit_run (PangoGlyphItem *orig,
+             PangoGlyphItem *split)
+{
+  int split_index = split->item->length;
+  int n_split = split->glyphs->num_glyphs;
+  int n_orig = orig->glyphs->num_glyphs;
+  int i;
+
+  pango_item_unsplit (orig->item, split_index, split->item->num_chars);
+  pango_glyph_string_set_size (orig->glyphs, n_orig + n_split);
+
+  if (orig->item->analysis.level % 2 == 0)
+    {
+      memmove (orig->glyphs->glyphs + n_split, orig->glyphs->glyphs,
+               n_orig * sizeof (PangoGlyphInfo));
+      memmove (orig->glyphs->log_clusters + n_split, orig->glyphs->log_clusters,
+               n_orig * sizeof (int));
+      for (i = n_split; i < n_orig + n_split; i++)
+        orig->glyphs->log_clusters[i] += split_index;
+
+      memcpy (orig->glyphs->glyphs, split->glyphs->glyphs,
+              n_split * sizeof (PangoGlyphInfo));
+      memcpy (orig->glyphs->log_clusters, split->glyphs->log_clusters,
+              n_split * sizeof (int));
+    }
+  else
+    {
+      for (i = 0; i < n_orig; i++)
+        orig->glyphs->log_clusters[i] += split_index;
+
+      memcpy (orig->glyphs->glyphs + n_orig, split->glyphs->glyphs,
+              n_split * sizeof (PangoGlyphInfo));
+      memcpy (orig->glyphs->log_clusters + n_orig, split->glyphs->log_clusters,
+              n_split * sizeof (int));
+    }
+
+  pango_glyph_item_free (split);
+}
+
+static gboolean
+affects_paint_only (PangoAttribute *attr,
+                    gpointer        data)
+{
+  return !affects_itemization (attr, data) && !affects_break_or_shape (attr, data);
+}
+
+/* Removes the attributes that were added by apply_attributes_to_runs()
+ * from the runs of @line, and joins the runs it split.
+ */
+static void
+unapply_attributes_to_runs (PangoLayoutLine *line)
+{
+  GSList *runs = NULL;
+  GSList *pending = NULL;
+  GSList *l;
+
+  for (l = line->runs; l; l = l->next)
+    {
+      PangoGlyphItem *run = l->data;
+      gboolean ltr = run->item->analysis.level % 2 == 0;
+
+      if (run->item->analysis.flags & PANGO_ANALYSIS_FLAG_PAINT_SPLIT)
+        {
+          run->item->analysis.flags &= ~PANGO_ANALYSIS_FLAG_PAINT_SPLIT;
+
+          /* Split off parts come before the rest of the run
+           * in logical order, so they are on its left for LTR
+           * runs, and on its right for RTL runs
+           */
+          if (ltr)
+            pending = g_slist_prepend (pending, run);
+          else
+            unsplit_run (runs->data, run);
+        }
+      else
+        {
+          GSList *p;
+
+          for (p = pending; p; p = p->next)
+            unsplit_run (run, p->data);
+          g_clear_pointer (&pending, g_slist_free);
+
+          runs = g_slist_prepend (runs, run);
+        }
+    }
+
+  g_assert (pending == NULL);
+
+  g_slist_free (line->runs);
+  line->runs = g_slist_reverse (runs);
+
+  for (l = line->runs; l; l = l->next)
+    {
+      PangoGlyphItem *run = l->data;
+      GSList **attrs = &run->item->analysis.extra_attrs;
+
+      while (*attrs)
+        {
+          GSList *link = *attrs;
+
+          if (affects_paint_only (link->data, NULL))
+            {
+              pango_attribute_destroy (link->data);
+              *attrs = link->next;
+              g_slist_free_1 (link);
+            }
+          else
+            attrs = &link->next;
+        }
+    }
+}
+
+/* If @attrs only differs from the current attributes of the layout
+ * in attributes that don't affect itemization, breaking or shaping,
+ * swaps in the new attributes and applies them to the existing runs,
+ * and returns %TRUE.
+ *
+ * We can only do this if the lines were made from the current split
+ * attributes, and nobody but the layout holds on to the lines.
+ */
+static gboolean
+update_paint_attributes (PangoLayout   *layout,
+                         PangoAttrList *attrs)
+{
+  PangoAttrList *itemize_attrs, *shape_attrs, *paint_attrs;
+  GSList *l;
+
+  if (!layout->lines || !layout->lines_use_split)
+    return FALSE;
+
+  if (layout->attrs && layout->attrs->serial != layout->attrs_serial)
+    return FALSE;
+
+  for (l = layout->lines; l; l = l->next)
+    {
+      PangoLayoutLinePrivate *line = l->data;
+
+      if (line->ref_count > 1)
+        return FALSE;
+    }
+
+  split_attributes (layout, attrs, &itemize_attrs, &shape_attrs, &paint_attrs);
+
+  if (!pango_attr_list_equal (itemize_attrs, layout->itemize_attrs) ||
+      !pango_attr_list_equal (shape_attrs, layout->shape_attrs))
+    {
+      pango_attr_list_unref (itemize_attrs);
+      pango_attr_list_unref (shape_attrs);
+      pango_attr_list_unref (paint_attrs);
+
+      return FALSE;
+    }
+
+  for (l = layout->lines; l; l = l->next)
+    {
+      PangoLayoutLinePrivate *line = l->data;
+
+      unapply_attributes_to_runs (l->data);
+
+      if (line->cache_status == CACHED)
+        line->cache_status = NOT_CACHED;
+    }
+
+  clear_attribute_split (layout);
+  layout->itemize_attrs = itemize_attrs;
+  layout->shape_attrs = shape_attrs;
+  layout->paint_attrs = paint_attrs;
+  if (attrs)
+    layout->attrs_serial = attrs->serial;
+  layout->attrs_split = TRUE;
+
+  apply_attributes_to_runs (layout, layout->paint_attrs);
+
+  layout->lines_use_split = TRUE;
+  layout->logical_rect_cached = FALSE;
+  layout->ink_rect_cached = FALSE;
+
+  return TRUE;
+}
+
+/* Log attrs are computed one paragraph at a time, in order, and
+ * only for paragraphs that are needed. layout->log_attrs_end is
+ * the offset of the first paragraph whose log attrs are missing,
+ * or n_chars + 1 if they are all there.
+ */
+static void
+get_paragraph_log_attrs (PangoLayout   *layout,
+                         const char    *start,
+                         int            start_offset,
+                         int            length,
+                         gboolean       last,
+                         GList         *items,
+                         PangoAttrList *attrs)
+{
+  if (start_offset != layout->log_attrs_end)
+    return;
+
+  get_items_log_attrs (layout->text,
+                       start - layout->text,
+                       length,
+                       items,
+                       attrs,
+                       layout->log_attrs + start_offset,
+                       layout->n_chars + 1 - start_offset);
+
+  if (last)
+    layout->log_attrs_end = layout->n_chars + 1;
+  else
+    layout->log_attrs_end = start_offset + pango_utf8_strlen (start, length);
+}
+
+/* Computes the log attrs for the paragraphs that
+ * pango_layout_check_lines() did not get to, e.g.
+ * because they are beyond the height limit.
+ */
+static void
+ensure_log_attrs (PangoLayout *layout)
+{
+  PangoAttrList *itemize_attrs;
+  PangoAttrList *shape_attrs;
+  const char *start;
+  gboolean done;
+
+  if (layout->log_attrs_end > layout->n_chars)
+    return;
+
+  ensure_attribute_split (layout);
+  itemize_attrs = layout->itemize_attrs;
+  shape_attrs = layout->shape_attrs;
+
+  start = g_utf8_offset_to_pointer (layout->text, layout->log_attrs_end);
+
+  do
+    {
+      int delimiter_index, next_para_index;
+      GList *items;
+
+      if (layout->single_paragraph)
+        {
+          delimiter_index = (layout->text + layout->length) - start;
+          next_para_index = delimiter_index;
+        }
+      else
+        {
+          pango_find_paragraph_boundary (start,
+                                         (layout->text + layout->length) - start,
+                                         &delimiter_index,
+                                         &next_para_index);
+        }
+
+      done = start + delimiter_index == layout->text + layout->length;
+
+      /* The base direction does not matter for log attrs */
+      items = pango_itemize_with_font (layout->context,
+                                       pango_context_get_base_dir (layout->context),
+                                       layout->text,
+                                       start - layout->text,
+                                       delimiter_index,
+                                       itemize_attrs,
+                                       NULL,
+                                       NULL);
+
+      apply_attributes_to_items (items, shape_attrs);
+
+      get_paragraph_log_attrs (layout,
+                               start,
+                               layout->log_attrs_end,
+                               next_para_index,
+                               done,
+                               items,
+                               shape_attrs);
+
+      g_list_free_full (items, (GDestroyNotify) pango_item_free);
+
+      start += next_para_index;
+    }
+  while (!done);
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
@@ -4772,14 +5152,12 @@ pango_layout_check_lines (PangoLayout *layout)
   const char *start;
   gboolean done = FALSE;
   int start_offset;
-  PangoAttrList *attrs;
   PangoAttrList *itemize_attrs;
   PangoAttrList *shape_attrs;
   PangoAttrIterator iter;
   PangoDirection prev_base_dir = PANGO_DIRECTION_NEUTRAL;
   PangoDirection base_dir = PANGO_DIRECTION_NEUTRAL;
   ParaBreakState state;
-  gboolean need_log_attrs;
 
   check_context_changed (layout);
 
@@ -4792,29 +5170,17 @@ pango_layout_check_lines (PangoLayout *layout)
   if (G_UNLIKELY (!layout->text))
     pango_layout_set_text (layout, NULL, 0);
 
-  attrs = pango_layout_get_effective_attributes (layout);
-  if (attrs)
-    {
-      shape_attrs = pango_attr_list_filter (attrs, affects_break_or_shape, NULL);
-      itemize_attrs = pango_attr_list_filter (attrs, affects_itemization, NULL);
+  ensure_attribute_split (layout);
+  itemize_attrs = layout->itemize_attrs;
+  shape_attrs = layout->shape_attrs;
 
-      if (itemize_attrs)
-        _pango_attr_list_get_iterator (itemize_attrs, &iter);
-    }
-  else
-    {
-      shape_attrs = NULL;
-      itemize_attrs = NULL;
-    }
+  if (itemize_attrs)
+    _pango_attr_list_get_iterator (itemize_attrs, &iter);
 
   if (!layout->log_attrs)
     {
       layout->log_attrs = g_new0 (PangoLogAttr, layout->n_chars + 1);
-      need_log_attrs = TRUE;
-    }
-  else
-    {
-      need_log_attrs = FALSE;
+      layout->log_attrs_end = 0;
     }
 
   start_offset = 0;
@@ -4902,14 +5268,13 @@ pango_layout_check_lines (PangoLayout *layout)
 
       apply_attributes_to_items (state.items, shape_attrs);
 
-      if (need_log_attrs)
-        get_items_log_attrs (layout->text,
-                             start - layout->text,
-                             delimiter_index + delim_len,
-                             state.items,
-                             shape_attrs,
-                             layout->log_attrs + start_offset,
-                             layout->n_chars + 1 - start_offset);
+      get_paragraph_log_attrs (layout,
+                               start,
+                               start_offset,
+                               delimiter_index + delim_len,
+                               done,
+                               state.items,
+                               shape_attrs);
 
       state.items = pango_itemize_post_process_items (layout->context,
                                                       layout->text,
@@ -4961,17 +5326,12 @@ pango_layout_check_lines (PangoLayout *layout)
   g_free (state.log_widths);
   g_list_free_full (state.baseline_shifts, g_free);
 
-  apply_attributes_to_runs (layout, attrs);
+  apply_attributes_to_runs (layout, layout->paint_attrs);
   layout->lines = g_slist_reverse (layout->lines);
+  layout->lines_use_split = TRUE;
 
   if (itemize_attrs)
-    {
-      pango_attr_list_unref (itemize_attrs);
-      _pango_attr_iterator_destroy (&iter);
-    }
-
-  pango_attr_list_unref (shape_attrs);
-  pango_attr_list_unref (attrs);
+    _pango_attr_iterator_destroy (&iter);
 
   int w, h;
   pango_layout_get_size (layout, &w, &h);
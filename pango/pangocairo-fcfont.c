@@ -273,5 +273,8 @@ _pango_cairo_fc_font_new (PangoCairoFcFontMap *cffontmap,
 
   ((PangoFcFont *)(cffont))->is_hinted = _pango_cairo_font_private_is_metrics_hinted (&cffont->cf_priv);
 
+  if (_pango_fc_font_map_is_thread_safe (PANGO_FC_FONT_MAP (cffontmap)))
+    _pango_cairo_font_private_make_thread_safe (&cffont->cf_priv);
+
   return (PangoFcFont *) cffont;
 }
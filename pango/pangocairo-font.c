@@ -60,38 +60,63 @@ _pango_cairo_font_private_scaled_font_data_destroy (PangoCairoFontPrivateScaledF
     }
 }
 
+/* The per-font mutex only exists for fonts from thread-safe
+ * fontmaps. It is a leaf lock: nothing that may take the fontmap
+ * lock, or this lock again, is called while holding it.
+ */
+static inline void
+_pango_cairo_font_private_lock (PangoCairoFontPrivate *cf_priv)
+{
+  if (cf_priv->mutex)
+    g_mutex_lock (cf_priv->mutex);
+}
+
+static inline void
+_pango_cairo_font_private_unlock (PangoCairoFontPrivate *cf_priv)
+{
+  if (cf_priv->mutex)
+    g_mutex_unlock (cf_priv->mutex);
+}
+
 cairo_scaled_font_t *
 _pango_cairo_font_private_get_scaled_font (PangoCairoFontPrivate *cf_priv)
 {
   cairo_font_face_t *font_face;
+  cairo_scaled_font_t *scaled_font = NULL;
 
-  if (G_LIKELY (cf_priv->scaled_font))
-    return cf_priv->scaled_font;
+  scaled_font = g_atomic_pointer_get (&cf_priv->scaled_font);
+  if (G_LIKELY (scaled_font))
+    return scaled_font;
 
   /* need to create it */
 
-  if (G_UNLIKELY (cf_priv->data == NULL))
+  _pango_cairo_font_private_lock (cf_priv);
+
+  if (G_UNLIKELY (cf_priv->scaled_font || cf_priv->data == NULL))
     {
-      /* we have tried to create and failed before */
-      return NULL;
+      /* another thread created it, or we have tried to
+       * create it and failed before
+       */
+      scaled_font = cf_priv->scaled_font;
+      _pango_cairo_font_private_unlock (cf_priv);
+      return scaled_font;
     }
 
   font_face = (* PANGO_CAIRO_FONT_GET_IFACE (cf_priv->cfont)->create_font_face) (cf_priv->cfont);
   if (G_UNLIKELY (font_face == NULL))
     goto done;
 
-  cf_priv->scaled_font = cairo_scaled_font_create (font_face,
-						   &cf_priv->data->font_matrix,
-						   &cf_priv->data->ctm,
-						   cf_priv->data->options);
+  scaled_font = cairo_scaled_font_create (font_face,
+					  &cf_priv->data->font_matrix,
+					  &cf_priv->data->ctm,
+					  cf_priv->data->options);
 
   cairo_font_face_destroy (font_face);
 
 done:
 
-  if (G_UNLIKELY (cf_priv->scaled_font == NULL || cairo_scaled_font_status (cf_priv->scaled_font) != CAIRO_STATUS_SUCCESS))
+  if (G_UNLIKELY (scaled_font == NULL || cairo_scaled_font_status (scaled_font) != CAIRO_STATUS_SUCCESS))
     {
-      cairo_scaled_font_t *scaled_font = cf_priv->scaled_font;
       PangoFont *font = PANGO_FONT (cf_priv->cfont);
       static GQuark warned_quark = 0; /* MT-safe */
       if (!warned_quark)
@@ -132,7 +157,11 @@ done:
   _pango_cairo_font_private_scaled_font_data_destroy (cf_priv->data);
   cf_priv->data = NULL;
 
-  return cf_priv->scaled_font;
+  g_atomic_pointer_set (&cf_priv->scaled_font, scaled_font);
+
+  _pango_cairo_font_private_unlock (cf_priv);
+
+  return scaled_font;
 }
 
 /**
@@ -216,155 +245,201 @@ typedef struct _PangoCairoFontMetricsInfo
   PangoFontMetrics *metrics;
 } PangoCairoFontMetricsInfo;
 
+/* Must be called with the font mutex held */
+static PangoFontMetrics *
+lookup_metrics (PangoCairoFontPrivate *cf_priv,
+                const char            *sample_str)
+{
+  GSList *tmp_list;
+
+  for (tmp_list = cf_priv->metrics_by_lang; tmp_list; tmp_list = tmp_list->next)
+    {
+      PangoCairoFontMetricsInfo *info = tmp_list->data;
+
+      if (info->sample_str == sample_str)    /* We _don't_ need strcmp */
+        return pango_font_metrics_ref (info->metrics);
+    }
+
+  return NULL;
+}
+
+/* Set while computing the approximate widths, to keep us from
+ * recursing from the layout that we use for that
+ */
+static GPrivate in_get_metrics;
+
 PangoFontMetrics *
 _pango_cairo_font_get_metrics (PangoFont     *font,
 			       PangoLanguage *language)
 {
   PangoCairoFont *cfont = (PangoCairoFont *) font;
   PangoCairoFontPrivate *cf_priv = PANGO_CAIRO_FONT_PRIVATE (font);
-  PangoCairoFontMetricsInfo *info = NULL; /* Quiet gcc */
-  GSList *tmp_list;
-  static int in_get_metrics;
+  PangoCairoFontMetricsInfo *info;
+  PangoFontMetrics *metrics, *cached;
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  cairo_font_options_t *font_options;
+  PangoLayout *layout;
+  PangoRectangle extents;
+  PangoFontDescription *desc;
+  cairo_scaled_font_t *scaled_font;
+  cairo_matrix_t cairo_matrix;
+  PangoMatrix pango_matrix;
+  PangoMatrix identity = PANGO_MATRIX_INIT;
+  glong sample_str_width;
+  int height, shift;
 
   const char *sample_str = pango_language_get_sample_string (language);
 
-  tmp_list = cf_priv->metrics_by_lang;
-  while (tmp_list)
-    {
-      info = tmp_list->data;
+  /* Computing metrics lays out text, which can come back here,
+   * so only look up and publish them under the font mutex.
+   */
+  _pango_cairo_font_private_lock (cf_priv);
+  metrics = lookup_metrics (cf_priv, sample_str);
+  _pango_cairo_font_private_unlock (cf_priv);
 
-      if (info->sample_str == sample_str)    /* We _don't_ need strcmp */
-	break;
+  if (metrics)
+    return metrics;
 
-      tmp_list = tmp_list->next;
-    }
+  /* XXX this is racy.  need a ref'ing getter... */
+  fontmap = pango_font_get_font_map (font);
+  if (!fontmap)
+    return pango_font_metrics_new ();
+  fontmap = g_object_ref (fontmap);
 
-  if (!tmp_list)
-    {
-      PangoFontMap *fontmap;
-      PangoContext *context;
-      cairo_font_options_t *font_options;
-      PangoLayout *layout;
-      PangoRectangle extents;
-      PangoFontDescription *desc;
-      cairo_scaled_font_t *scaled_font;
-      cairo_matrix_t cairo_matrix;
-      PangoMatrix pango_matrix;
-      PangoMatrix identity = PANGO_MATRIX_INIT;
-      glong sample_str_width;
+  scaled_font = _pango_cairo_font_private_get_scaled_font (cf_priv);
 
-      int height, shift;
+  context = pango_font_map_create_context (fontmap);
+  pango_context_set_language (context, language);
 
-      /* XXX this is racy.  need a ref'ing getter... */
-      fontmap = pango_font_get_font_map (font);
-      if (!fontmap)
-        return pango_font_metrics_new ();
-      fontmap = g_object_ref (fontmap);
+  font_options = cairo_font_options_create ();
+  cairo_scaled_font_get_font_options (scaled_font, font_options);
+  pango_cairo_context_set_font_options (context, font_options);
+  cairo_font_options_destroy (font_options);
 
-      info = g_slice_new0 (PangoCairoFontMetricsInfo);
+  metrics = (* PANGO_CAIRO_FONT_GET_IFACE (font)->create_base_metrics_for_context) (cfont, context);
+
+  /* We now need to adjust the base metrics for ctm */
+  cairo_scaled_font_get_ctm (scaled_font, &cairo_matrix);
+  pango_matrix.xx = cairo_matrix.xx;
+  pango_matrix.yx = cairo_matrix.yx;
+  pango_matrix.xy = cairo_matrix.xy;
+  pango_matrix.yy = cairo_matrix.yy;
+  pango_matrix.x0 = 0;
+  pango_matrix.y0 = 0;
+  if (G_UNLIKELY (0 != memcmp (&identity, &pango_matrix, 4 * sizeof (double))))
+    {
+      double xscale = pango_matrix_get_font_scale_factor (&pango_matrix);
+      if (xscale) xscale = 1 / xscale;
+
+      metrics->ascent *= xscale;
+      metrics->descent *= xscale;
+      metrics->height *= xscale;
+      metrics->underline_position *= xscale;
+      metrics->underline_thickness *= xscale;
+      metrics->strikethrough_position *= xscale;
+      metrics->strikethrough_thickness *= xscale;
+    }
 
-      cf_priv->metrics_by_lang = g_slist_prepend (cf_priv->metrics_by_lang, info);
+  /* Set the matrix on the context so we don't have to adjust the derived
+   * metrics. */
+  pango_context_set_matrix (context, &pango_matrix);
 
-      info->sample_str = sample_str;
+  /* We may actually reuse ascent/descent we got from cairo here.  that's
+   * in cf_priv->font_extents.
+   */
+  height = metrics->ascent + metrics->descent;
+  switch (cf_priv->gravity)
+    {
+      default:
+      case PANGO_GRAVITY_AUTO:
+      case PANGO_GRAVITY_SOUTH:
+	break;
+      case PANGO_GRAVITY_NORTH:
+	metrics->ascent = metrics->descent;
+	break;
+      case PANGO_GRAVITY_EAST:
+      case PANGO_GRAVITY_WEST:
+	{
+	  int ascent = height / 2;
+	  if (cf_priv->is_hinted)
+	    ascent = PANGO_UNITS_ROUND (ascent);
+	  metrics->ascent = ascent;
+	}
+    }
+  shift = (height - metrics->ascent) - metrics->descent;
+  metrics->descent += shift;
+  metrics->underline_position -= shift;
+  metrics->strikethrough_position -= shift;
+  metrics->ascent = height - metrics->descent;
 
-      scaled_font = _pango_cairo_font_private_get_scaled_font (cf_priv);
+  if (g_private_get (&in_get_metrics))
+    {
+      /* Called from the layout below, for this font or a fallback
+       * font. Return the metrics without approximate widths, but
+       * don't cache them.
+       */
+      g_object_unref (context);
+      g_object_unref (fontmap);
+      return metrics;
+    }
 
-      context = pango_font_map_create_context (fontmap);
-      pango_context_set_language (context, language);
+  /* Update approximate_*_width now */
+  g_private_set (&in_get_metrics, GINT_TO_POINTER (1));
 
-      font_options = cairo_font_options_create ();
-      cairo_scaled_font_get_font_options (scaled_font, font_options);
-      pango_cairo_context_set_font_options (context, font_options);
-      cairo_font_options_destroy (font_options);
+  layout = pango_layout_new (context);
+  desc = pango_font_describe_with_absolute_size (font);
+  pango_layout_set_font_description (layout, desc);
+  pango_font_description_free (desc);
 
-      info->metrics = (* PANGO_CAIRO_FONT_GET_IFACE (font)->create_base_metrics_for_context) (cfont, context);
+  pango_layout_set_text (layout, sample_str, -1);
+  pango_layout_get_extents (layout, NULL, &extents);
 
-      /* We now need to adjust the base metrics for ctm */
-      cairo_scaled_font_get_ctm (scaled_font, &cairo_matrix);
-      pango_matrix.xx = cairo_matrix.xx;
-      pango_matrix.yx = cairo_matrix.yx;
-      pango_matrix.xy = cairo_matrix.xy;
-      pango_matrix.yy = cairo_matrix.yy;
-      pango_matrix.x0 = 0;
-      pango_matrix.y0 = 0;
-      if (G_UNLIKELY (0 != memcmp (&identity, &pango_matrix, 4 * sizeof (double))))
-        {
-	  double xscale = pango_matrix_get_font_scale_factor (&pango_matrix);
-	  if (xscale) xscale = 1 / xscale;
-
-	  info->metrics->ascent *= xscale;
-	  info->metrics->descent *= xscale;
-	  info->metrics->height *= xscale;
-	  info->metrics->underline_position *= xscale;
-	  info->metrics->underline_thickness *= xscale;
-	  info->metrics->strikethrough_position *= xscale;
-	  info->metrics->strikethrough_thickness *= xscale;
-	}
+  sample_str_width = pango_utf8_strwidth (sample_str);
+  g_assert (sample_str_width > 0);
+  metrics->approximate_char_width = extents.width / sample_str_width;
 
-      /* Set the matrix on the context so we don't have to adjust the derived
-       * metrics. */
-      pango_context_set_matrix (context, &pango_matrix);
+  pango_layout_set_text (layout, "0123456789", -1);
+  metrics->approximate_digit_width = max_glyph_width (layout);
 
-      /* Ugly. We need to prevent recursion when we call into
-       * PangoLayout to determine approximate char width.
-       */
-      if (!in_get_metrics)
-        {
-          in_get_metrics = 1;
+  g_object_unref (layout);
 
-          /* Update approximate_*_width now */
-          layout = pango_layout_new (context);
-          desc = pango_font_describe_with_absolute_size (font);
-          pango_layout_set_font_description (layout, desc);
-          pango_font_description_free (desc);
+  g_private_set (&in_get_metrics, NULL);
 
-          pango_layout_set_text (layout, sample_str, -1);
-          pango_layout_get_extents (layout, NULL, &extents);
+  g_object_unref (context);
+  g_object_unref (fontmap);
 
-          sample_str_width = pango_utf8_strwidth (sample_str);
-          g_assert (sample_str_width > 0);
-          info->metrics->approximate_char_width = extents.width / sample_str_width;
+  /* Publish the result, unless another thread beat us to it */
+  _pango_cairo_font_private_lock (cf_priv);
 
-          pango_layout_set_text (layout, "0123456789", -1);
-          info->metrics->approximate_digit_width = max_glyph_width (layout);
+  cached = lookup_metrics (cf_priv, sample_str);
+  if (cached)
+    {
+      pango_font_metrics_unref (metrics);
+      metrics = cached;
+    }
+  else
+    {
+      info = g_slice_new0 (PangoCairoFontMetricsInfo);
+      info->sample_str = sample_str;
+      info->metrics = pango_font_metrics_ref (metrics);
 
-          g_object_unref (layout);
-          in_get_metrics = 0;
-        }
+      cf_priv->metrics_by_lang = g_slist_prepend (cf_priv->metrics_by_lang, info);
+    }
 
-      /* We may actually reuse ascent/descent we got from cairo here.  that's
-       * in cf_priv->font_extents.
-       */
-      height = info->metrics->ascent + info->metrics->descent;
-      switch (cf_priv->gravity)
-	{
-	  default:
-	  case PANGO_GRAVITY_AUTO:
-	  case PANGO_GRAVITY_SOUTH:
-	    break;
-	  case PANGO_GRAVITY_NORTH:
-	    info->metrics->ascent = info->metrics->descent;
-	    break;
-	  case PANGO_GRAVITY_EAST:
-	  case PANGO_GRAVITY_WEST:
-	    {
-	      int ascent = height / 2;
-	      if (cf_priv->is_hinted)
-	        ascent = PANGO_UNITS_ROUND (ascent);
-	      info->metrics->ascent = ascent;
-	    }
-	}
-      shift = (height - info->metrics->ascent) - info->metrics->descent;
-      info->metrics->descent += shift;
-      info->metrics->underline_position -= shift;
-      info->metrics->strikethrough_position -= shift;
-      info->metrics->ascent = height - info->metrics->descent;
+  _pango_cairo_font_private_unlock (cf_priv);
 
-      g_object_unref (context);
-      g_object_unref (fontmap);
-    }
+  return metrics;
+}
 
-  return pango_font_metrics_ref (info->metrics);
+static void
+_pango_cairo_font_hex_box_info_destroy (PangoCairoFontHexBoxInfo *hbi)
+{
+  if (hbi)
+    {
+      g_object_unref (hbi->font);
+      g_slice_free (PangoCairoFontHexBoxInfo, hbi);
+    }
 }
 
 static PangoCairoFontHexBoxInfo *
@@ -396,8 +471,9 @@ _pango_cairo_font_private_get_hex_box_info (PangoCairoFontPrivate *cf_priv)
   if (!cf_priv)
     return NULL;
 
-  if (cf_priv->hbi)
-    return cf_priv->hbi;
+  hbi = g_atomic_pointer_get (&cf_priv->hbi);
+  if (hbi)
+    return hbi;
 
   scaled_font = _pango_cairo_font_private_get_scaled_font (cf_priv);
   if (G_UNLIKELY (scaled_font == NULL || cairo_scaled_font_status (scaled_font) != CAIRO_STATUS_SUCCESS))
@@ -571,18 +647,17 @@ _pango_cairo_font_private_get_hex_box_info (PangoCairoFontPrivate *cf_priv)
        hbi->box_descent = HINT_Y (hbi->box_descent);
     }
 
-  cf_priv->hbi = hbi;
-  return hbi;
-}
-
-static void
-_pango_cairo_font_hex_box_info_destroy (PangoCairoFontHexBoxInfo *hbi)
-{
-  if (hbi)
+  /* This can't be done under the font mutex, since creating the
+   * mini font goes through the fontmap; if another thread won,
+   * use its info.
+   */
+  if (!g_atomic_pointer_compare_and_exchange (&cf_priv->hbi, NULL, hbi))
     {
-      g_object_unref (hbi->font);
-      g_slice_free (PangoCairoFontHexBoxInfo, hbi);
+      _pango_cairo_font_hex_box_info_destroy (hbi);
+      hbi = g_atomic_pointer_get (&cf_priv->hbi);
     }
+
+  return hbi;
 }
 
 PangoCairoFontHexBoxInfo *
@@ -635,6 +710,20 @@ _pango_cairo_font_private_initialize (PangoCairoFontPrivate      *cf_priv,
   cf_priv->hbi = NULL;
   cf_priv->glyph_extents_cache = NULL;
   cf_priv->metrics_by_lang = NULL;
+  cf_priv->mutex = NULL;
+}
+
+/* Called by backends for fonts that belong to a thread-safe
+ * fontmap, and can therefore be used from several threads.
+ */
+void
+_pango_cairo_font_private_make_thread_safe (PangoCairoFontPrivate *cf_priv)
+{
+  if (cf_priv->mutex)
+    return;
+
+  cf_priv->mutex = g_new (GMutex, 1);
+  g_mutex_init (cf_priv->mutex);
 }
 
 static void
@@ -663,6 +752,13 @@ _pango_cairo_font_private_finalize (PangoCairoFontPrivate *cf_priv)
   g_slist_foreach (cf_priv->metrics_by_lang, (GFunc)free_metrics_info, NULL);
   g_slist_free (cf_priv->metrics_by_lang);
   cf_priv->metrics_by_lang = NULL;
+
+  if (cf_priv->mutex)
+    {
+      g_mutex_clear (cf_priv->mutex);
+      g_free (cf_priv->mutex);
+      cf_priv->mutex = NULL;
+    }
 }
 
 gboolean
@@ -878,19 +974,44 @@ _pango_cairo_font_private_get_glyph_extents (PangoCairoFontPrivate *cf_priv,
 					     PangoRectangle        *ink_rect,
 					     PangoRectangle        *logical_rect)
 {
-  PangoCairoFontGlyphExtentsCacheEntry *entry;
+  PangoCairoFontGlyphExtentsCacheEntry entry;
 
-  if (!cf_priv ||
-      (cf_priv->glyph_extents_cache == NULL &&
-       !_pango_cairo_font_private_glyph_extents_cache_init (cf_priv)))
+  if (!cf_priv)
     {
       /* Get generic unknown-glyph extents. */
       pango_font_get_glyph_extents (NULL, glyph, ink_rect, logical_rect);
       return;
     }
 
+  if (cf_priv->mutex)
+    {
+      /* These take other locks, so get them
+       * before taking the font mutex.
+       */
+      pango_font_get_hb_font (PANGO_FONT (cf_priv->cfont));
+      if (G_UNLIKELY (!_pango_cairo_font_private_get_scaled_font (cf_priv)))
+        {
+          pango_font_get_glyph_extents (NULL, glyph, ink_rect, logical_rect);
+          return;
+        }
+    }
+
+  _pango_cairo_font_private_lock (cf_priv);
+
+  if (cf_priv->glyph_extents_cache == NULL &&
+      !_pango_cairo_font_private_glyph_extents_cache_init (cf_priv))
+    {
+      _pango_cairo_font_private_unlock (cf_priv);
+
+      /* Get generic unknown-glyph extents. */
+      pango_font_get_glyph_extents (NULL, glyph, ink_rect, logical_rect);
+      return;
+    }
+
   if (glyph == PANGO_GLYPH_EMPTY)
     {
+      _pango_cairo_font_private_unlock (cf_priv);
+
       if (ink_rect)
 	ink_rect->x = ink_rect->y = ink_rect->width = ink_rect->height = 0;
       if (logical_rect)
@@ -899,28 +1020,33 @@ _pango_cairo_font_private_get_glyph_extents (PangoCairoFontPrivate *cf_priv,
     }
   else if (glyph & PANGO_GLYPH_UNKNOWN_FLAG)
     {
+      _pango_cairo_font_private_unlock (cf_priv);
+
       _pango_cairo_font_private_get_glyph_extents_missing (cf_priv, glyph, ink_rect, logical_rect);
       return;
     }
 
-  entry = _pango_cairo_font_private_get_glyph_extents_cache_entry (cf_priv, glyph);
+  /* Copy the entry, another thread may reuse the slot */
+  entry = *_pango_cairo_font_private_get_glyph_extents_cache_entry (cf_priv, glyph);
+
+  _pango_cairo_font_private_unlock (cf_priv);
 
   if (ink_rect)
-    *ink_rect = entry->ink_rect;
+    *ink_rect = entry.ink_rect;
   if (logical_rect)
     {
       *logical_rect = cf_priv->font_extents;
       switch (cf_priv->gravity)
         {
         case PANGO_GRAVITY_SOUTH:
-          logical_rect->width = entry->width;
+          logical_rect->width = entry.width;
           break;
         case PANGO_GRAVITY_EAST:
           logical_rect->width = cf_priv->font_extents.height;
           logical_rect->x = - logical_rect->width;
           break;
         case PANGO_GRAVITY_NORTH:
-          logical_rect->width = entry->width;
+          logical_rect->width = entry.width;
           break;
         case PANGO_GRAVITY_WEST:
           logical_rect->width = - cf_priv->font_extents.height;
@@ -88,6 +88,8 @@ struct _PangoCairoFontPrivate
   PangoCairoFontGlyphExtentsCacheEntry *glyph_extents_cache;
 
   GSList *metrics_by_lang;
+
+  GMutex *mutex; /* NULL unless the font is shared between threads */
 };
 
 struct _PangoCairoFontIface
@@ -113,6 +115,7 @@ void _pango_cairo_font_private_initialize (PangoCairoFontPrivate      *cf_priv,
 					   const cairo_font_options_t *font_options,
 					   const PangoMatrix          *pango_ctm,
 					   const cairo_matrix_t       *font_matrix);
+void _pango_cairo_font_private_make_thread_safe (PangoCairoFontPrivate *cf_priv);
 void _pango_cairo_font_private_finalize (PangoCairoFontPrivate *cf_priv);
 cairo_scaled_font_t *_pango_cairo_font_private_get_scaled_font (PangoCairoFontPrivate *cf_priv);
 gboolean _pango_cairo_font_private_is_metrics_hinted (PangoCairoFontPrivate *cf_priv);
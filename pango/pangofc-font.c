@@ -49,6 +49,7 @@ static gboolean pango_fc_font_real_has_char  (PangoFcFont *font,
 static guint    pango_fc_font_real_get_glyph (PangoFcFont *font,
 					      gunichar     wc);
 
+static void                  pango_fc_font_dispose      (GObject          *object);
 static void                  pango_fc_font_finalize     (GObject          *object);
 static void                  pango_fc_font_set_property (GObject          *object,
 							 guint             prop_id,
@@ -96,6 +97,7 @@ pango_fc_font_class_init (PangoFcFontClass *class)
   class->get_glyph = pango_fc_font_real_get_glyph;
   class->get_unknown_glyph = NULL;
 
+  object_class->dispose = pango_fc_font_dispose;
   object_class->finalize = pango_fc_font_finalize;
   object_class->set_property = pango_fc_font_set_property;
   object_class->get_property = pango_fc_font_get_property;
@@ -154,6 +156,27 @@ free_metrics_info (PangoFcMetricsInfo *info)
   g_slice_free (PangoFcMetricsInfo, info);
 }
 
+static void
+pango_fc_font_dispose (GObject *object)
+{
+  PangoFcFont *fcfont = PANGO_FC_FONT (object);
+  PangoFcFontMap *fontmap;
+
+  /* Take the font out of the fontmap's font hash before the last
+   * reference goes away. In thread-safe mode, another thread may pick
+   * the font up from the hash until then; g_object_unref() notices
+   * that and skips finalization.
+   */
+  fontmap = g_weak_ref_get ((GWeakRef *) &fcfont->fontmap);
+  if (fontmap)
+    {
+      _pango_fc_font_map_forget (fontmap, fcfont);
+      g_object_unref (fontmap);
+    }
+
+  G_OBJECT_CLASS (pango_fc_font_parent_class)->dispose (object);
+}
+
 static void
 pango_fc_font_finalize (GObject *object)
 {
@@ -440,86 +463,127 @@ max_glyph_width (PangoLayout *layout)
   return max_width;
 }
 
+/* Returns the cached metrics of @fcfont for @sample_str, if any.
+ * Called with the fontmap lock held.
+ */
+static PangoFontMetrics *
+lookup_metrics (PangoFcFont *fcfont,
+                const char  *sample_str)
+{
+  GSList *tmp_list;
+
+  for (tmp_list = fcfont->metrics_by_lang; tmp_list; tmp_list = tmp_list->next)
+    {
+      PangoFcMetricsInfo *info = tmp_list->data;
+
+      if (info->sample_str == sample_str)    /* We _don't_ need strcmp */
+        return pango_font_metrics_ref (info->metrics);
+    }
+
+  return NULL;
+}
+
+/* Set while computing derived metrics in this thread, to avoid
+ * recursing from the layout that we use for that
+ */
+static GPrivate in_get_metrics;
+
 static PangoFontMetrics *
 pango_fc_font_get_metrics (PangoFont     *font,
 			   PangoLanguage *language)
 {
   PangoFcFont *fcfont = PANGO_FC_FONT (font);
-  PangoFcMetricsInfo *info = NULL; /* Quiet gcc */
-  GSList *tmp_list;
-  static int in_get_metrics;
+  PangoFcMetricsInfo *info;
+  PangoFontMap *fontmap;
+  PangoFontMetrics *metrics, *cached;
+  PangoContext *context;
 
   const char *sample_str = pango_language_get_sample_string (language);
 
-  tmp_list = fcfont->metrics_by_lang;
-  while (tmp_list)
-    {
-      info = tmp_list->data;
-
-      if (info->sample_str == sample_str)    /* We _don't_ need strcmp */
-	break;
+  fontmap = g_weak_ref_get ((GWeakRef *) &fcfont->fontmap);
+  if (!fontmap)
+    return pango_font_metrics_new ();
 
-      tmp_list = tmp_list->next;
-    }
+  /* metrics_by_lang is protected by the fontmap lock. We don't hold
+   * it while computing the metrics though, since that lays out text.
+   */
+  _pango_fc_font_map_lock (PANGO_FC_FONT_MAP (fontmap));
+  metrics = lookup_metrics (fcfont, sample_str);
+  _pango_fc_font_map_unlock (PANGO_FC_FONT_MAP (fontmap));
 
-  if (!tmp_list)
+  if (metrics)
     {
-      PangoFontMap *fontmap;
-      PangoContext *context;
+      g_object_unref (fontmap);
+      return metrics;
+    }
 
-      fontmap = g_weak_ref_get ((GWeakRef *) &fcfont->fontmap);
-      if (!fontmap)
-	return pango_font_metrics_new ();
+  context = pango_font_map_create_context (fontmap);
+  pango_context_set_language (context, language);
 
-      info = g_slice_new0 (PangoFcMetricsInfo);
+  metrics = pango_fc_font_create_base_metrics_for_context (fcfont, context);
 
-      /* Note: we need to add info to the list before calling
-       * into PangoLayout below, to prevent recursion
+  if (g_private_get (&in_get_metrics))
+    {
+      /* Called from the layout below, for this font or a fallback
+       * font. Return the base metrics, but don't cache them.
        */
-      fcfont->metrics_by_lang = g_slist_prepend (fcfont->metrics_by_lang,
-						 info);
+      g_object_unref (context);
+      g_object_unref (fontmap);
+      return metrics;
+    }
 
-      info->sample_str = sample_str;
+  /* Compute derived metrics */
+  {
+    PangoLayout *layout;
+    PangoRectangle extents;
+    PangoFontDescription *desc = pango_font_describe_with_absolute_size (font);
+    gulong sample_str_width;
 
-      context = pango_font_map_create_context (fontmap);
-      pango_context_set_language (context, language);
+    g_private_set (&in_get_metrics, GINT_TO_POINTER (1));
 
-      info->metrics = pango_fc_font_create_base_metrics_for_context (fcfont, context);
+    layout = pango_layout_new (context);
+    pango_layout_set_font_description (layout, desc);
+    pango_font_description_free (desc);
 
-      if (!in_get_metrics)
-        {
-          /* Compute derived metrics */
-          PangoLayout *layout;
-          PangoRectangle extents;
-          PangoFontDescription *desc = pango_font_describe_with_absolute_size (font);
-          gulong sample_str_width;
+    pango_layout_set_text (layout, sample_str, -1);
+    pango_layout_get_extents (layout, NULL, &extents);
 
-          in_get_metrics = 1;
+    sample_str_width = pango_utf8_strwidth (sample_str);
+    g_assert (sample_str_width > 0);
+    metrics->approximate_char_width = extents.width / sample_str_width;
 
-          layout = pango_layout_new (context);
-          pango_layout_set_font_description (layout, desc);
-          pango_font_description_free (desc);
+    pango_layout_set_text (layout, "0123456789", -1);
+    metrics->approximate_digit_width = max_glyph_width (layout);
 
-          pango_layout_set_text (layout, sample_str, -1);
-          pango_layout_get_extents (layout, NULL, &extents);
+    g_object_unref (layout);
 
-          sample_str_width = pango_utf8_strwidth (sample_str);
-          g_assert (sample_str_width > 0);
-          info->metrics->approximate_char_width = extents.width / sample_str_width;
+    g_private_set (&in_get_metrics, NULL);
+  }
 
-          pango_layout_set_text (layout, "0123456789", -1);
-          info->metrics->approximate_digit_width = max_glyph_width (layout);
+  g_object_unref (context);
 
-          g_object_unref (layout);
+  /* Publish the result, unless another thread beat us to it */
+  _pango_fc_font_map_lock (PANGO_FC_FONT_MAP (fontmap));
 
-          in_get_metrics = 0;
-        }
+  cached = lookup_metrics (fcfont, sample_str);
+  if (cached)
+    {
+      pango_font_metrics_unref (metrics);
+      metrics = cached;
+    }
+  else
+    {
+      info = g_slice_new0 (PangoFcMetricsInfo);
+      info->sample_str = sample_str;
+      info->metrics = pango_font_metrics_ref (metrics);
 
-      g_object_unref (context);
-      g_object_unref (fontmap);
+      fcfont->metrics_by_lang = g_slist_prepend (fcfont->metrics_by_lang, info);
     }
 
-  return pango_font_metrics_ref (info->metrics);
+  _pango_fc_font_map_unlock (PANGO_FC_FONT_MAP (fontmap));
+  g_object_unref (fontmap);
+
+  return metrics;
 }
 
 static PangoFontMap *
@@ -1013,7 +1077,7 @@ pango_fc_font_create_hb_font (PangoFont *font)
   x_scale = 1. / x_scale_inv;
   y_scale = 1. / y_scale_inv;
 
-  hb_face = pango_fc_font_map_get_hb_face (PANGO_FC_FONT_MAP (fc_font->fontmap), fc_font);
+  hb_face = _pango_fc_font_map_ref_hb_face (PANGO_FC_FONT_MAP (fc_font->fontmap), fc_font);
 
   hb_font = hb_font_create (hb_face);
   hb_font_set_scale (hb_font,
@@ -1067,6 +1131,8 @@ pango_fc_font_create_hb_font (PangoFont *font)
     }
 
 done:
+  hb_face_destroy (hb_face);
+
   return hb_font;
 }
 
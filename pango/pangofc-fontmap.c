@@ -30,10 +30,23 @@
  * deriving from this base class will take advantage of the wide
  * range of shapers implemented using FreeType that come with Pango.
  */
-#define FONTSET_CACHE_SIZE 256
+#define DEFAULT_MAX_FONTSETS 256
+
+/* Fontsets for variation instances come and go when an axis
+ * is animated, so we keep only a few of them around, to not
+ * push the other fontsets out of the cache.
+ */
+#define MAX_VARIED_FONTSETS 16
+
+/* Variation coordinates are rounded to this fraction of a design
+ * unit, well below a visible difference, so that nearby values
+ * share one instance.
+ */
+#define VARIATION_QUANTUM 16
 
 #include "config.h"
 #include <math.h>
+#include <string.h>
 
 #include <gio/gio.h>
 
@@ -45,6 +58,8 @@
 #include "pango-enum-types.h"
 #include "pango-coverage-private.h"
 #include "pango-trace-private.h"
+#include "pangofc-sort-cache-private.h"
+#include "pangofc-shared-face-private.h"
 #include <hb-ft.h>
 
 
@@ -60,7 +75,8 @@
  * - All FcPattern's referenced by any object in the fontmap are uniquified
  *   and cached in the fontmap.  This both speeds lookups based on patterns
  *   faster, and saves memory.  This is handled by fontmap->priv->pattern_hash.
- *   The patterns are cached indefinitely.
+ *   The patterns are cached until pango_fc_font_map_trim() finds that no
+ *   other cache uses them anymore.
  *
  * - The results of a FcFontSort() are used to populate fontsets.  However,
  *   FcFontSort() relies on the search pattern only, which includes the font
@@ -75,20 +91,61 @@
  *   without trimming, and do the trimming lazily as we go.  Only pattern sets
  *   already referenced by a fontset are cached.
  *
+ * - The FcFontSetMatch() and FcFontSetSort() calls for new patterns are
+ *   queued in a small, shared pool of worker threads, with matches ahead
+ *   of sorts.  When a fontset needs a result whose job has not started
+ *   yet, it runs the job itself instead of waiting.
+ *
  * - A number of most-recently-used fontsets are cached and reused when
  *   needed.  This is achieved using fontmap->priv->fontset_hash and
- *   fontmap->priv->fontset_cache.
+ *   fontmap->priv->fontset_cache.  The number of cached fontsets is
+ *   limited by fontmap->priv->max_fontsets, and that of fontsets with
+ *   font variations by MAX_VARIED_FONTSETS.
+ *
+ * - Font variations are quantized and kept out of the patterns that
+ *   we sort, so all variation instances of a font description share
+ *   one sort result.  They only become part of the font key, and of
+ *   the font pattern, for faces that have variation axes.  Fonts for
+ *   other faces are shared between the instances.  The font patterns
+ *   with variations are not uniquified, so that they go away with
+ *   their fonts; font keys compare by the match they were made from.
+ *
+ * - Each fontset merges the coverage of its fonts into a per-block index
+ *   (PangoFcFontsetBlock), so that finding the font for a character does
+ *   not probe every font before it in the fallback list each time.  The
+ *   coverage is read from the FC_CHARSET of the font patterns, and fonts
+ *   are only created once they are selected.
+ *
+ * - The fonts, coverages and block index of a fontset live in a
+ *   PangoFcFontsetChain.  Fontsets for different languages that sort to
+ *   the same list of fonts share one chain, found through
+ *   fontmap->priv->chain_hash, along with the itemization cache.
  *
  * - All fonts created by any of our fontsets are also cached and reused.
  *   This is what fontmap->priv->font_hash does.
  *
  * - Data that only depends on the font file and face index is cached and
  *   reused by multiple fonts.  This includes coverage and cmap cache info.
- *   This is done using fontmap->priv->font_face_data_hash.
+ *   This is done using fontmap->priv->font_face_data_hash.  The expensive
+ *   parts of it (coverage and hb_face) are kept in an LRU list,
+ *   fontmap->priv->face_data_lru, and dropped again once their estimated
+ *   size goes over fontmap->priv->max_face_data_size.  The coverage and
+ *   hb_face themselves live in a process-wide registry of faces (see
+ *   pangofc-shared-face.c), so all fontmaps share them.
+ *
+ * - The list of families is built on first use, or in a separate thread
+ *   after pango_fc_font_map_load_families_in_background(), see
+ *   PangoFcFamilyLoader.  The fonts of the configuration, grouped by
+ *   family, are kept in the sort cache when that is enabled.
+ *
+ * - pango_fc_font_map_trim() can be used to shrink the fontset and face data
+ *   caches in response to memory pressure, without invalidating anything.
  *
  * Upon a cache_clear() request, all caches are emptied.  All objects (fonts,
  * fontsets, faces, families) having a reference from outside will still live
  * and may reference the fontmap still, but will not be reused by the fontmap.
+ * When fonts are only added to the configuration, config_changed() drops just
+ * the fontsets that the new fonts could change, see pango_fc_font_map_add_fonts().
  *
  *
  * Todo:
@@ -126,6 +183,8 @@ typedef struct _PangoFcFamily       PangoFcFamily;
 typedef struct _PangoFcFindFuncInfo PangoFcFindFuncInfo;
 typedef struct _PangoFcPatterns     PangoFcPatterns;
 typedef struct _PangoFcFontset      PangoFcFontset;
+typedef struct _PangoFcFontsetChain PangoFcFontsetChain;
+typedef struct _PangoFcFamilyLoader PangoFcFamilyLoader;
 
 #define PANGO_FC_TYPE_FAMILY            (pango_fc_family_get_type ())
 #define PANGO_FC_FAMILY(object)         (G_TYPE_CHECK_INSTANCE_CAST ((object), PANGO_FC_TYPE_FAMILY, PangoFcFamily))
@@ -139,26 +198,41 @@ typedef struct _PangoFcFontset      PangoFcFontset;
 #define PANGO_FC_FONTSET(object)        (G_TYPE_CHECK_INSTANCE_CAST ((object), PANGO_FC_TYPE_FONTSET, PangoFcFontset))
 #define PANGO_FC_IS_FONTSET(object)     (G_TYPE_CHECK_INSTANCE_TYPE ((object), PANGO_FC_TYPE_FONTSET))
 
+#define PANGO_FC_TYPE_FONTSET_CHAIN     (pango_fc_fontset_chain_get_type ())
+
 struct _PangoFcFontMapPrivate
 {
   GHashTable *fontset_hash;	/* Maps PangoFcFontsetKey -> PangoFcFontset  */
   GQueue *fontset_cache;	/* Recently used fontsets */
+  guint n_varied_fontsets;	/* Fontsets in fontset_cache with variations */
 
   GHashTable *font_hash;	/* Maps PangoFcFontKey -> PangoFcFont */
 
   GHashTable *patterns_hash;	/* Maps FcPattern -> PangoFcPatterns */
 
+  GHashTable *chain_hash;	/* Set of shared PangoFcFontsetChains */
+
   /* pattern_hash is used to make sure we only store one copy of
    * each identical pattern. (Speeds up lookup).
    */
   GHashTable *pattern_hash;
 
   GHashTable *font_face_data_hash; /* Maps font file name/id -> data */
+  GQueue face_data_lru;            /* Face data holding coverage or hb_face */
+  gsize face_data_size;            /* Estimated size of face_data_lru */
+
+  guint max_fontsets;
+  gsize max_face_data_size;        /* 0 == unlimited */
 
   /* List of all families available */
   PangoFcFamily **families;
   int n_families;		/* -1 == uninitialized */
 
+  /* See pango_fc_font_map_load_families_in_background() */
+  PangoFcFamilyLoader *loader;	/* Thread finding families, if any */
+  GSource *families_source;	/* Pending publish_families(), under loader_mutex */
+  int n_items;			/* Families announced as list items, -1 == all */
+
   double dpi;
 
   /* Decoders */
@@ -168,8 +242,42 @@ struct _PangoFcFontMapPrivate
 
   FcConfig *config;
   FcFontSet *fonts;
+
+  PangoFcSortCache *sort_cache;
+  guint sort_cache_checked : 1;
+
+  /* In thread-safe mode, this protects all of the above,
+   * and the fontsets, families and faces of the fontmap
+   */
+  guint thread_safe : 1;
+  GRecMutex lock;
 };
 
+/* The lock is recursive, since the fontmap calls back into
+ * itself through fonts and fontsets. Code holding it must not
+ * call out to anything that could take the locks of fonts, or
+ * emit signals.
+ */
+void
+_pango_fc_font_map_lock (PangoFcFontMap *fcfontmap)
+{
+  if (fcfontmap->priv->thread_safe)
+    g_rec_mutex_lock (&fcfontmap->priv->lock);
+}
+
+void
+_pango_fc_font_map_unlock (PangoFcFontMap *fcfontmap)
+{
+  if (fcfontmap->priv->thread_safe)
+    g_rec_mutex_unlock (&fcfontmap->priv->lock);
+}
+
+gboolean
+_pango_fc_font_map_is_thread_safe (PangoFcFontMap *fcfontmap)
+{
+  return fcfontmap->priv->thread_safe;
+}
+
 struct _PangoFcFontFaceData
 {
   /* Key */
@@ -181,7 +289,12 @@ struct _PangoFcFontFaceData
   PangoCoverage *coverage;
   PangoLanguage **languages;
 
-  hb_face_t *hb_face;
+  PangoFcSharedFace *shared;
+  hb_face_t *hb_face;  /* Acquired from shared */
+  gboolean hb_face_pinned; /* Handed out by pango_fc_font_map_get_hb_face() */
+
+  GList lru_link;      /* In priv->face_data_lru, data is NULL otherwise */
+  gsize size;          /* Estimated size of coverage and hb_face */
 };
 
 struct _PangoFcFace
@@ -222,6 +335,7 @@ struct _PangoFcFindFuncInfo
 static GType    pango_fc_family_get_type     (void);
 static GType    pango_fc_face_get_type       (void);
 static GType    pango_fc_fontset_get_type    (void);
+static GType    pango_fc_fontset_chain_get_type (void);
 
 static void          pango_fc_font_map_finalize      (GObject                      *object);
 static PangoFont *   pango_fc_font_map_load_font     (PangoFontMap                 *fontmap,
@@ -251,6 +365,14 @@ static void pango_fc_font_map_changed (PangoFontMap *fontmap);
 static guint    pango_fc_font_face_data_hash  (PangoFcFontFaceData *key);
 static gboolean pango_fc_font_face_data_equal (PangoFcFontFaceData *key1,
 					       PangoFcFontFaceData *key2);
+static PangoCoverage *pango_fc_font_map_get_pattern_coverage (PangoFcFontMap *fcfontmap,
+                                                              FcPattern      *font_pattern);
+static gboolean pango_fc_coverage_get_page    (PangoCoverage       *coverage,
+                                               FcChar32             start,
+                                               FcChar32             map[FC_CHARSET_MAP_SIZE]);
+static void     pango_fc_font_face_data_trim  (PangoFcFontMap      *fcfontmap,
+                                               gsize                max_size,
+                                               PangoFcFontFaceData *keep);
 
 static void               pango_fc_fontset_key_init  (PangoFcFontsetKey          *key,
 						      PangoFcFontMap             *fcfontmap,
@@ -322,7 +444,10 @@ pango_fc_font_face_data_free (PangoFcFontFaceData *data)
 
   g_free (data->languages);
 
-  hb_face_destroy (data->hb_face);
+  if (data->hb_face)
+    pango_fc_shared_face_release_hb_face (data->shared);
+
+  pango_fc_shared_face_unref (data->shared);
 
   g_slice_free (PangoFcFontFaceData, data);
 }
@@ -395,11 +520,89 @@ struct _PangoFcFontsetKey {
 struct _PangoFcFontKey {
   PangoFcFontMap *fontmap;
   FcPattern *pattern;
+  FcPattern *match;  /* Uniquified, what pattern was made from */
   PangoMatrix matrix;
   gpointer context_key;
   char *variations;
 };
 
+static int
+compare_variations (gconstpointer a,
+                    gconstpointer b)
+{
+  const hb_variation_t *va = a;
+  const hb_variation_t *vb = b;
+
+  return va->tag < vb->tag ? -1 : va->tag > vb->tag;
+}
+
+/* Returns @variations with one quantized setting per axis, sorted
+ * by axis, so that equivalent strings give equal keys. Like in
+ * parse_variations(), later settings for an axis win.
+ */
+static char *
+canonicalize_variations (const char *variations)
+{
+  GArray *vars;
+  GString *str;
+  const char *p;
+  const char *end;
+  guint i;
+
+  if (!variations)
+    return NULL;
+
+  vars = g_array_new (FALSE, FALSE, sizeof (hb_variation_t));
+
+  p = variations;
+  while (p && *p)
+    {
+      hb_variation_t var;
+
+      end = strchr (p, ',');
+      if (hb_variation_from_string (p, end ? end - p: -1, &var))
+        {
+          var.value = roundf (var.value * VARIATION_QUANTUM) / VARIATION_QUANTUM;
+
+          for (i = 0; i < vars->len; i++)
+            {
+              if (g_array_index (vars, hb_variation_t, i).tag == var.tag)
+                break;
+            }
+
+          if (i < vars->len)
+            g_array_index (vars, hb_variation_t, i).value = var.value;
+          else
+            g_array_append_val (vars, var);
+        }
+
+      p = end ? end + 1 : NULL;
+    }
+
+  if (vars->len == 0)
+    {
+      g_array_unref (vars);
+      return NULL;
+    }
+
+  g_array_sort (vars, compare_variations);
+
+  str = g_string_new ("");
+  for (i = 0; i < vars->len; i++)
+    {
+      char buf[128];
+
+      hb_variation_to_string (&g_array_index (vars, hb_variation_t, i), buf, sizeof (buf));
+      if (i > 0)
+        g_string_append_c (str, ',');
+      g_string_append (str, buf);
+    }
+
+  g_array_unref (vars);
+
+  return g_string_free (str, FALSE);
+}
+
 static void
 pango_fc_fontset_key_init (PangoFcFontsetKey          *key,
 			   PangoFcFontMap             *fcfontmap,
@@ -415,9 +618,8 @@ pango_fc_fontset_key_init (PangoFcFontsetKey          *key,
   key->pixelsize = get_scaled_size (fcfontmap, context, desc);
   key->resolution = pango_fc_font_map_get_resolution (fcfontmap, context);
   key->language = language;
-  key->variations = g_strdup (pango_font_description_get_variations (desc));
-  key->desc = pango_font_description_copy_static (desc);
-  pango_font_description_unset_fields (key->desc, PANGO_FONT_MASK_SIZE | PANGO_FONT_MASK_VARIATIONS);
+  key->variations = canonicalize_variations (pango_font_description_get_variations (desc));
+  key->desc = _pango_font_description_intern (desc, PANGO_FONT_MASK_SIZE | PANGO_FONT_MASK_VARIATIONS);
 
   if (context && PANGO_FC_FONT_MAP_GET_CLASS (fcfontmap)->context_key_get)
     key->context_key = (gpointer)PANGO_FC_FONT_MAP_GET_CLASS (fcfontmap)->context_key_get (fcfontmap, context);
@@ -491,7 +693,7 @@ pango_fc_fontset_key_copy (const PangoFcFontsetKey *old)
 
   key->fontmap = old->fontmap;
   key->language = old->language;
-  key->desc = pango_font_description_copy (old->desc);
+  key->desc = _pango_font_description_intern (old->desc, 0);
   key->matrix = old->matrix;
   key->pixelsize = old->pixelsize;
   key->resolution = old->resolution;
@@ -612,7 +814,7 @@ static gboolean
 pango_fc_font_key_equal (const PangoFcFontKey *key_a,
 			 const PangoFcFontKey *key_b)
 {
-  if (key_a->pattern == key_b->pattern &&
+  if (key_a->match == key_b->match &&
       ((key_a->variations == NULL && key_b->variations == NULL) ||
        (key_a->variations && key_b->variations && (strcmp (key_a->variations, key_b->variations) == 0))) &&
       0 == memcmp (&key_a->matrix, &key_b->matrix, 4 * sizeof (double)))
@@ -643,7 +845,7 @@ pango_fc_font_key_hash (const PangoFcFontKey *key)
       hash ^= PANGO_FC_FONT_MAP_GET_CLASS (key->fontmap)->context_key_hash (key->fontmap,
 									    key->context_key);
 
-    return (hash ^ GPOINTER_TO_UINT (key->pattern));
+    return (hash ^ GPOINTER_TO_UINT (key->match));
 }
 
 static void
@@ -652,6 +854,9 @@ pango_fc_font_key_free (PangoFcFontKey *key)
   if (key->pattern)
     FcPatternDestroy (key->pattern);
 
+  if (key->match)
+    FcPatternDestroy (key->match);
+
   if (key->context_key)
     PANGO_FC_FONT_MAP_GET_CLASS (key->fontmap)->context_key_free (key->fontmap,
 								  key->context_key);
@@ -669,6 +874,8 @@ pango_fc_font_key_copy (const PangoFcFontKey *old)
   key->fontmap = old->fontmap;
   FcPatternReference (old->pattern);
   key->pattern = old->pattern;
+  FcPatternReference (old->match);
+  key->match = old->match;
   key->matrix = old->matrix;
   key->variations = g_strdup (old->variations);
   if (old->context_key)
@@ -688,6 +895,7 @@ pango_fc_font_key_init (PangoFcFontKey    *key,
 {
   key->fontmap = fcfontmap;
   key->pattern = pattern;
+  key->match = pattern;
   key->matrix = *pango_fc_fontset_key_get_matrix (fontset_key);
   key->variations = fontset_key->variations;
   key->context_key = pango_fc_fontset_key_get_context_key (fontset_key);
@@ -756,9 +964,11 @@ pango_fc_font_key_get_variations (const PangoFcFontKey *key)
 struct _PangoFcPatterns {
   PangoFcFontMap *fontmap;
 
-  /* match and fontset are initialized in a thread,
-   * and are protected by a mutex. The thread signals
-   * the cond when match or fontset become available.
+  /* match and fontset are initialized by jobs in the
+   * worker pool, and are protected by a mutex. The jobs
+   * signal the cond when match or fontset become available.
+   * If nobody has started a job by the time we need its
+   * result, we run it ourselves.
    */
   GMutex mutex;
   GCond cond;
@@ -766,6 +976,9 @@ struct _PangoFcPatterns {
   FcPattern *pattern;
   FcPattern *match;
   FcFontSet *fontset;
+
+  guint match_started : 1;
+  guint sort_started : 1;
 };
 
 static FcFontSet *
@@ -787,18 +1000,29 @@ font_set_copy (FcFontSet *fontset)
   return copy;
 }
 
+typedef enum {
+  JOB_MATCH,
+  JOB_SORT
+} JobKind;
+
 typedef struct {
+  JobKind kind;
+  guint seq;
   FcConfig *config;
   FcFontSet *fonts;
   FcPattern *pattern;
   PangoFcPatterns *patterns;
+  PangoFcSortCache *sort_cache;
 } ThreadData;
 
 static FcFontSet *pango_fc_font_map_get_config_fonts (PangoFcFontMap *fcfontmap);
+static PangoFcSortCache *pango_fc_font_map_get_sort_cache (PangoFcFontMap *fcfontmap);
 
 static ThreadData *
-thread_data_new (PangoFcPatterns *patterns)
+thread_data_new (PangoFcPatterns *patterns,
+                 JobKind          kind)
 {
+  static int seq;
   ThreadData *td;
   PangoFcFontMap *fontmap = patterns->fontmap;
 
@@ -806,10 +1030,15 @@ thread_data_new (PangoFcPatterns *patterns)
   g_object_ref (fontmap);
 
   td = g_new (ThreadData, 1);
+  td->kind = kind;
+  td->seq = (guint) g_atomic_int_add (&seq, 1);
   td->patterns = pango_fc_patterns_ref (patterns);
   td->pattern = FcPatternDuplicate (patterns->pattern);
   td->config = FcConfigReference (pango_fc_font_map_get_config (patterns->fontmap));
   td->fonts = font_set_copy (pango_fc_font_map_get_config_fonts (patterns->fontmap));
+  td->sort_cache = NULL;
+  if (kind == JOB_SORT && pango_fc_font_map_get_sort_cache (fontmap))
+    td->sort_cache = pango_fc_sort_cache_ref (pango_fc_font_map_get_sort_cache (fontmap));
 
   return td;
 }
@@ -821,6 +1050,7 @@ thread_data_free (gpointer data)
   PangoFcFontMap *fontmap = td->patterns->fontmap;
 
   g_clear_pointer (&td->fonts, FcFontSetDestroy);
+  g_clear_pointer (&td->sort_cache, pango_fc_sort_cache_unref);
   FcPatternDestroy (td->pattern);
   FcConfigDestroy (td->config);
   pango_fc_patterns_unref (td->patterns);
@@ -829,67 +1059,132 @@ thread_data_free (gpointer data)
   g_object_unref (fontmap);
 }
 
-static gpointer
-match_in_thread (gpointer task_data)
+static void
+do_match (PangoFcPatterns *pats,
+          FcConfig        *config,
+          FcFontSet       *fonts,
+          FcPattern       *pattern)
 {
-  ThreadData *td = task_data;
   FcResult result;
   FcPattern *match;
   gint64 before G_GNUC_UNUSED;
 
   before = PANGO_TRACE_CURRENT_TIME;
 
-  match = FcFontSetMatch (td->config,
-                          &td->fonts, 1,
-                          td->pattern,
-                          &result);
+  match = FcFontSetMatch (config, &fonts, 1, pattern, &result);
 
   pango_trace_mark (before, "FcFontSetMatch", NULL);
 
-  g_mutex_lock (&td->patterns->mutex);
-  td->patterns->match = match;
-  g_cond_signal (&td->patterns->cond);
-  g_mutex_unlock (&td->patterns->mutex);
-
-  thread_data_free (td);
-
-  return NULL;
+  g_mutex_lock (&pats->mutex);
+  pats->match = match;
+  g_cond_broadcast (&pats->cond);
+  g_mutex_unlock (&pats->mutex);
 }
 
-static gpointer
-sort_in_thread (gpointer task_data)
+static void
+do_sort (PangoFcPatterns  *pats,
+         FcConfig         *config,
+         FcFontSet        *fonts,
+         FcPattern        *pattern,
+         PangoFcSortCache *sort_cache)
 {
-  ThreadData *td = task_data;
   FcResult result;
   FcFontSet *fontset;
   gint64 before G_GNUC_UNUSED;
 
   before = PANGO_TRACE_CURRENT_TIME;
 
-  fontset = FcFontSetSort (td->config,
-                           &td->fonts, 1,
-                           td->pattern,
-                           FcTrue,
-                           NULL,
-                           &result);
+  fontset = FcFontSetSort (config, &fonts, 1, pattern, FcTrue, NULL, &result);
 
   pango_trace_mark (before, "FcFontSetSort", NULL);
 
-  g_mutex_lock (&td->patterns->mutex);
-  td->patterns->fontset = fontset;
-  g_cond_signal (&td->patterns->cond);
-  g_mutex_unlock (&td->patterns->mutex);
+  if (sort_cache)
+    pango_fc_sort_cache_add (sort_cache, pattern, fontset);
+
+  g_mutex_lock (&pats->mutex);
+  pats->fontset = fontset;
+  g_cond_broadcast (&pats->cond);
+  g_mutex_unlock (&pats->mutex);
+}
+
+static void
+run_job (gpointer data,
+         gpointer user_data)
+{
+  ThreadData *td = data;
+  PangoFcPatterns *pats = td->patterns;
+  gboolean started;
+
+  g_mutex_lock (&pats->mutex);
+  if (td->kind == JOB_MATCH)
+    {
+      started = pats->match_started;
+      pats->match_started = TRUE;
+    }
+  else
+    {
+      started = pats->sort_started;
+      pats->sort_started = TRUE;
+    }
+  g_mutex_unlock (&pats->mutex);
+
+  /* Somebody who needed the result ran the job already */
+  if (!started)
+    {
+      if (td->kind == JOB_MATCH)
+        do_match (pats, td->config, td->fonts, td->pattern);
+      else
+        do_sort (pats, td->config, td->fonts, td->pattern, td->sort_cache);
+    }
 
   thread_data_free (td);
+}
 
-  return NULL;
+/* Matches are needed before sorts, since the first font of
+ * a fontset comes from the match. Otherwise, jobs run in the
+ * order they were queued.
+ */
+static int
+compare_jobs (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  const ThreadData *td1 = a;
+  const ThreadData *td2 = b;
+
+  if (td1->kind != td2->kind)
+    return td1->kind == JOB_MATCH ? -1 : 1;
+
+  return td1->seq < td2->seq ? -1 : (td1->seq > td2->seq ? 1 : 0);
+}
+
+#define MAX_FC_THREADS 4
+
+static void
+queue_job (ThreadData *td)
+{
+  static GThreadPool *pool;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *p;
+
+      p = g_thread_pool_new (run_job, NULL,
+                             CLAMP (g_get_num_processors (), 1, MAX_FC_THREADS),
+                             FALSE, NULL);
+      g_thread_pool_set_sort_function (p, compare_jobs, NULL);
+
+      g_once_init_leave (&pool, p);
+    }
+
+  g_thread_pool_push (pool, td, NULL);
 }
 
 static PangoFcPatterns *
 pango_fc_patterns_new (FcPattern *pat, PangoFcFontMap *fontmap)
 {
   PangoFcPatterns *pats;
-  GThread *thread;
+  PangoFcSortCache *sort_cache;
 
   pat = uniquify_pattern (fontmap, pat);
   pats = g_hash_table_lookup (fontmap->priv->patterns_hash, pat);
@@ -906,11 +1201,21 @@ pango_fc_patterns_new (FcPattern *pat, PangoFcFontMap *fontmap)
   g_mutex_init (&pats->mutex);
   g_cond_init (&pats->cond);
 
-  thread = g_thread_new ("[pango] FcFontSetMatch", match_in_thread, thread_data_new (pats));
-  g_thread_unref (thread);
+  sort_cache = pango_fc_font_map_get_sort_cache (fontmap);
+  if (sort_cache)
+    pats->fontset = pango_fc_sort_cache_lookup (sort_cache, pat);
 
-  thread = g_thread_new ("[pango] FcFontSetSort", sort_in_thread, thread_data_new (pats));
-  g_thread_unref (thread);
+  if (pats->fontset)
+    {
+      /* The first sorted font is what the match would give us */
+      pats->match_started = TRUE;
+      pats->sort_started = TRUE;
+    }
+  else
+    {
+      queue_job (thread_data_new (pats, JOB_MATCH));
+      queue_job (thread_data_new (pats, JOB_SORT));
+    }
 
   g_hash_table_insert (fontmap->priv->patterns_hash,
                        pats->pattern, pats);
@@ -952,7 +1257,14 @@ free_patterns (gpointer data)
 static void
 pango_fc_patterns_unref (PangoFcPatterns *pats)
 {
+  PangoFcFontMap *fontmap = pats->fontmap;
+
+  /* Lookups in patterns_hash take a reference with the lock held,
+   * so the last reference must only go away with the lock held
+   */
+  _pango_fc_font_map_lock (fontmap);
   g_atomic_rc_box_release_full (pats, free_patterns);
+  _pango_fc_font_map_unlock (fontmap);
 }
 
 static FcPattern *
@@ -961,6 +1273,19 @@ pango_fc_patterns_get_pattern (PangoFcPatterns *pats)
   return pats->pattern;
 }
 
+/* Returns the sort result if it is available, without waiting for it */
+static FcFontSet *
+pango_fc_patterns_peek_fontset (PangoFcPatterns *pats)
+{
+  FcFontSet *fontset;
+
+  g_mutex_lock (&pats->mutex);
+  fontset = pats->fontset;
+  g_mutex_unlock (&pats->mutex);
+
+  return fontset;
+}
+
 static gboolean
 pango_fc_is_supported_font_format (FcPattern* pattern)
 {
@@ -1019,6 +1344,42 @@ filter_by_format (FcFontSet **sets, int nsets)
   return result;
 }
 
+/* Returns whether pango_fc_patterns_get_font_pattern() can
+ * return the pattern at position @i without waiting
+ */
+static gboolean
+pango_fc_patterns_has_font_pattern (PangoFcPatterns *pats, int i)
+{
+  gboolean ready;
+
+  g_mutex_lock (&pats->mutex);
+  ready = pats->fontset != NULL || (i == 0 && pats->match != NULL);
+  g_mutex_unlock (&pats->mutex);
+
+  return ready;
+}
+
+/* Runs a job in the calling thread. This only takes the fontmap
+ * lock to collect what the job needs, so it must not be called
+ * with the lock held in thread-safe mode.
+ */
+static void
+run_job_now (PangoFcPatterns *pats,
+             JobKind          kind)
+{
+  ThreadData *td;
+
+  _pango_fc_font_map_lock (pats->fontmap);
+  td = thread_data_new (pats, kind);
+  _pango_fc_font_map_unlock (pats->fontmap);
+
+  run_job (td, NULL);
+}
+
+/* In thread-safe mode, this must not be called with the fontmap
+ * lock held, unless pango_fc_patterns_has_font_pattern() says that
+ * it won't wait
+ */
 static FcPattern *
 pango_fc_patterns_get_font_pattern (PangoFcPatterns *pats, int i, gboolean *prepare)
 {
@@ -1034,6 +1395,14 @@ pango_fc_patterns_get_font_pattern (PangoFcPatterns *pats, int i, gboolean *prep
 
       g_mutex_lock (&pats->mutex);
 
+      if (!pats->match && !pats->fontset && !pats->match_started)
+        {
+          /* Don't wait for the pool to get to it */
+          g_mutex_unlock (&pats->mutex);
+          run_job_now (pats, JOB_MATCH);
+          g_mutex_lock (&pats->mutex);
+        }
+
       while (!pats->match && !pats->fontset)
         {
           waited = TRUE;
@@ -1063,6 +1432,13 @@ pango_fc_patterns_get_font_pattern (PangoFcPatterns *pats, int i, gboolean *prep
 
       g_mutex_lock (&pats->mutex);
 
+      if (!pats->fontset && !pats->sort_started)
+        {
+          g_mutex_unlock (&pats->mutex);
+          run_job_now (pats, JOB_SORT);
+          g_mutex_lock (&pats->mutex);
+        }
+
       while (!pats->fontset)
         {
           waited = TRUE;
@@ -1109,170 +1485,443 @@ struct _PangoFcFontset
   PangoFcFontsetKey *key;
 
   PangoFcPatterns *patterns;
-  int patterns_i;
 
-  GPtrArray *fonts;
-  GPtrArray *coverages;
+  PangoFcFontsetChain *chain;
+  guint chain_checked : 1;
+  guint pending       : 1;
 
   GList *cache_link;
 };
 
-typedef PangoFontsetClass PangoFcFontsetClass;
+/* The fallback chain of a fontset.
+ *
+ * Fontsets start out with a chain of their own. Once the sort result
+ * for a fontset is available, it looks for a chain with the same key
+ * apart from the language, the same search pattern apart from FC_LANG
+ * and the same sorted fonts. If there is one, it switches to it,
+ * otherwise it offers its own chain to other fontsets. A fontset
+ * never switches chains more than once.
+ */
+struct _PangoFcFontsetChain
+{
+  GObject parent_instance;
 
-G_DEFINE_TYPE (PangoFcFontset, pango_fc_fontset, PANGO_TYPE_FONTSET)
+  PangoFcFontMap *fontmap;
 
-static PangoFcFontset *
-pango_fc_fontset_new (PangoFcFontsetKey *key,
-		      PangoFcPatterns   *patterns)
-{
-  PangoFcFontset *fontset;
+  /* Only set once the chain is in chain_hash */
+  PangoFcFontsetKey *key;       /* without language */
+  FcPattern *pattern;           /* without FC_LANG */
+  FcFontSet *sorted;
 
-  fontset = g_object_new (PANGO_FC_TYPE_FONTSET, NULL);
+  /* One entry per font pattern seen so far. Fonts are only created
+   * when they are needed, coverage is read from the patterns.
+   */
+  GPtrArray *fonts;
+  GPtrArray *coverages;
 
-  fontset->key = pango_fc_fontset_key_copy (key);
-  fontset->patterns = pango_fc_patterns_ref (patterns);
+  GHashTable *blocks;   /* Maps wc >> 8 -> PangoFcFontsetBlock */
+};
 
-  return fontset;
-}
+/* A merged coverage index for a block of 256 codepoints.
+ *
+ * The coverages of the first @depth fonts of the fontset have been
+ * merged into @font, which holds the position of the font to use
+ * plus one, or 0 if that is not known yet. Once all fonts have been
+ * merged, the remaining entries are resolved one by one, as there is
+ * no exact coverage for them.
+ */
+typedef struct
+{
+  guint depth;
+  guint16 font[256];
+} PangoFcFontsetBlock;
 
-static PangoFcFontsetKey *
-pango_fc_fontset_get_key (PangoFcFontset *fontset)
+typedef GObjectClass PangoFcFontsetChainClass;
+
+G_DEFINE_TYPE (PangoFcFontsetChain, pango_fc_fontset_chain, G_TYPE_OBJECT)
+
+static void
+pango_fc_fontset_chain_init (PangoFcFontsetChain *chain)
 {
-  return fontset->key;
+  chain->fonts = g_ptr_array_new ();
+  chain->coverages = g_ptr_array_new ();
+  chain->blocks = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 }
 
-static PangoFont *
-pango_fc_fontset_load_next_font (PangoFcFontset *fontset)
+static void
+pango_fc_fontset_chain_finalize (GObject *object)
 {
-  FcPattern *pattern, *font_pattern;
-  PangoFont *font;
-  gboolean prepare;
+  PangoFcFontsetChain *chain = (PangoFcFontsetChain *) object;
+  PangoFcFontMapPrivate *priv = chain->fontmap->priv;
+  unsigned int i;
 
-  pattern = pango_fc_patterns_get_pattern (fontset->patterns);
-  font_pattern = pango_fc_patterns_get_font_pattern (fontset->patterns,
-						     fontset->patterns_i++,
-						     &prepare);
-  if (G_UNLIKELY (!font_pattern))
-    return NULL;
+  /* Only remove from fontmap hash if we are in it.  This is not necessarily
+   * the case after a cache_clear() call. */
+  if (chain->key && priv->chain_hash &&
+      chain == g_hash_table_lookup (priv->chain_hash, chain))
+    g_hash_table_remove (priv->chain_hash, chain);
 
-  if (prepare)
+  for (i = 0; i < chain->fonts->len; i++)
     {
-      font_pattern = FcFontRenderPrepare (fontset->key->fontmap->priv->config, pattern, font_pattern);
+      PangoFont *font = g_ptr_array_index (chain->fonts, i);
+      if (font)
+        g_object_unref (font);
+    }
+  g_ptr_array_free (chain->fonts, TRUE);
 
-      if (G_UNLIKELY (!font_pattern))
-	return NULL;
+  for (i = 0; i < chain->coverages->len; i++)
+    {
+      PangoCoverage *coverage = g_ptr_array_index (chain->coverages, i);
+      if (coverage)
+	g_object_unref (coverage);
     }
+  g_ptr_array_free (chain->coverages, TRUE);
 
-  font = pango_fc_font_map_new_font (fontset->key->fontmap,
-                                     fontset->key,
-                                     font_pattern);
+  g_hash_table_destroy (chain->blocks);
 
-  if (prepare)
-    FcPatternDestroy (font_pattern);
+  if (chain->key)
+    pango_fc_fontset_key_free (chain->key);
+  if (chain->pattern)
+    FcPatternDestroy (chain->pattern);
+  if (chain->sorted)
+    FcFontSetDestroy (chain->sorted);
 
-  return font;
+  G_OBJECT_CLASS (pango_fc_fontset_chain_parent_class)->finalize (object);
 }
 
-static PangoFont *
-pango_fc_fontset_get_font_at (PangoFcFontset *fontset,
-			      unsigned int    i)
+static void
+pango_fc_fontset_chain_class_init (PangoFcFontsetChainClass *class)
 {
-  while (i >= fontset->fonts->len)
-    {
-      PangoFont *font = pango_fc_fontset_load_next_font (fontset);
-      g_ptr_array_add (fontset->fonts, font);
-      g_ptr_array_add (fontset->coverages, NULL);
-      if (!font)
-        return NULL;
-    }
+  GObjectClass *object_class = G_OBJECT_CLASS (class);
 
-  return g_ptr_array_index (fontset->fonts, i);
+  object_class->finalize = pango_fc_fontset_chain_finalize;
 }
 
-static void
-pango_fc_fontset_class_init (PangoFcFontsetClass *class)
+static PangoFcFontsetChain *
+pango_fc_fontset_chain_new (PangoFcFontMap *fontmap)
 {
-  GObjectClass *object_class = G_OBJECT_CLASS (class);
-  PangoFontsetClass *fontset_class = PANGO_FONTSET_CLASS (class);
+  PangoFcFontsetChain *chain;
 
-  object_class->finalize = pango_fc_fontset_finalize;
+  chain = g_object_new (PANGO_FC_TYPE_FONTSET_CHAIN, NULL);
+  chain->fontmap = fontmap;
 
-  fontset_class->get_font = pango_fc_fontset_get_font;
-  fontset_class->get_language = pango_fc_fontset_get_language;
-  fontset_class->foreach = pango_fc_fontset_foreach;
+  return chain;
 }
 
 static void
-pango_fc_fontset_init (PangoFcFontset *fontset)
+pango_fc_fontset_chain_unref (PangoFcFontsetChain *chain)
 {
-  fontset->fonts = g_ptr_array_new ();
-  fontset->coverages = g_ptr_array_new ();
+  PangoFcFontMap *fontmap = chain->fontmap;
+
+  /* Lookups in chain_hash take a reference with the lock held */
+  _pango_fc_font_map_lock (fontmap);
+  g_object_unref (chain);
+  _pango_fc_font_map_unlock (fontmap);
 }
 
-static void
-pango_fc_fontset_finalize (GObject *object)
+static guint
+pango_fc_fontset_chain_hash (const PangoFcFontsetChain *chain)
 {
-  PangoFcFontset *fontset = PANGO_FC_FONTSET (object);
-  unsigned int i;
-
-  for (i = 0; i < fontset->fonts->len; i++)
-  {
-    PangoFont *font = g_ptr_array_index(fontset->fonts, i);
-    if (font)
-      g_object_unref (font);
-  }
-  g_ptr_array_free (fontset->fonts, TRUE);
-
-  for (i = 0; i < fontset->coverages->len; i++)
-    {
-      PangoCoverage *coverage = g_ptr_array_index (fontset->coverages, i);
-      if (coverage)
-	g_object_unref (coverage);
-    }
-  g_ptr_array_free (fontset->coverages, TRUE);
+  guint hash;
+  int i;
 
-  if (fontset->key)
-    pango_fc_fontset_key_free (fontset->key);
+  hash = pango_fc_fontset_key_hash (chain->key) ^ GPOINTER_TO_UINT (chain->pattern);
 
-  if (fontset->patterns)
-    pango_fc_patterns_unref (fontset->patterns);
+  /* The sorted patterns come from the font list of the config,
+   * so equal lists have the same pointers
+   */
+  for (i = 0; i < chain->sorted->nfont; i++)
+    hash = hash * 31 + GPOINTER_TO_UINT (chain->sorted->fonts[i]);
 
-  G_OBJECT_CLASS (pango_fc_fontset_parent_class)->finalize (object);
+  return hash;
 }
 
-static PangoLanguage *
-pango_fc_fontset_get_language (PangoFontset  *fontset)
+static gboolean
+pango_fc_fontset_chain_equal (const PangoFcFontsetChain *chain_a,
+                              const PangoFcFontsetChain *chain_b)
 {
-  PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
-
-  return pango_fc_fontset_key_get_language (pango_fc_fontset_get_key (fcfontset));
+  return chain_a->pattern == chain_b->pattern &&
+         chain_a->sorted->nfont == chain_b->sorted->nfont &&
+         memcmp (chain_a->sorted->fonts, chain_b->sorted->fonts,
+                 sizeof (FcPattern *) * chain_a->sorted->nfont) == 0 &&
+         pango_fc_fontset_key_equal (chain_a->key, chain_b->key);
 }
 
-static PangoFont *
-pango_fc_fontset_get_font (PangoFontset  *fontset,
-			   guint          wc)
-{
-  PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
-  PangoCoverageLevel best_level = PANGO_COVERAGE_NONE;
-  PangoCoverageLevel level;
+typedef PangoFontsetClass PangoFcFontsetClass;
+
+G_DEFINE_TYPE (PangoFcFontset, pango_fc_fontset, PANGO_TYPE_FONTSET)
+
+static PangoFcFontset *
+pango_fc_fontset_new (PangoFcFontsetKey *key,
+		      PangoFcPatterns   *patterns)
+{
+  PangoFcFontset *fontset;
+
+  fontset = g_object_new (PANGO_FC_TYPE_FONTSET, NULL);
+
+  fontset->key = pango_fc_fontset_key_copy (key);
+  fontset->patterns = pango_fc_patterns_ref (patterns);
+  fontset->chain = pango_fc_fontset_chain_new (key->fontmap);
+
+  return fontset;
+}
+
+/* Once the sort result is available, switch to the shared chain
+ * for it, or share ours. This never waits for the sort, and must
+ * only be called on entry to the fontset, since it may drop the
+ * chain that the fontset used until now.
+ */
+static void
+pango_fc_fontset_share_chain (PangoFcFontset *fontset)
+{
+  PangoFcFontMap *fcfontmap = fontset->key->fontmap;
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  PangoFcFontsetChain *chain = fontset->chain;
+  PangoFcFontsetChain *shared;
+  FcFontSet *sorted;
+  FcPattern *pattern;
+  static GQuark owner_quark = 0; /* MT-safe */
+
+  if (G_LIKELY (fontset->chain_checked))
+    return;
+
+  sorted = pango_fc_patterns_peek_fontset (fontset->patterns);
+  if (!sorted)
+    return;
+
+  fontset->chain_checked = TRUE;
+
+  /* The chain may already be gone from a cleared fontmap */
+  if (G_UNLIKELY (!priv->chain_hash))
+    return;
+
+  pattern = FcPatternDuplicate (pango_fc_patterns_get_pattern (fontset->patterns));
+  FcPatternDel (pattern, FC_LANG);
+  chain->pattern = uniquify_pattern (fcfontmap, pattern);
+  FcPatternReference (chain->pattern);
+  FcPatternDestroy (pattern);
+
+  chain->key = pango_fc_fontset_key_copy (fontset->key);
+  chain->key->language = NULL;
+  chain->sorted = font_set_copy (sorted);
+
+  shared = g_hash_table_lookup (priv->chain_hash, chain);
+  if (shared)
+    {
+      fontset->chain = g_object_ref (shared);
+      g_object_unref (chain);
+    }
+  else
+    g_hash_table_add (priv->chain_hash, chain);
+
+  /* Let itemization cache its font choices in the chain */
+  if (G_UNLIKELY (!owner_quark))
+    owner_quark = g_quark_from_static_string (PANGO_FONT_CACHE_OWNER);
+  g_object_set_qdata (G_OBJECT (fontset), owner_quark, fontset->chain);
+}
+
+static PangoFcFontsetKey *
+pango_fc_fontset_get_key (PangoFcFontset *fontset)
+{
+  return fontset->key;
+}
+
+static FcPattern *
+pango_fc_fontset_get_pattern_at (PangoFcFontset *fontset,
+                                 unsigned int    i,
+                                 gboolean       *prepare)
+{
+  return pango_fc_patterns_get_font_pattern (fontset->patterns, i, prepare);
+}
+
+/* Returns whether the fontset has a font at position @i,
+ * without creating any fonts.
+ *
+ * In thread-safe mode, this does not wait for the patterns with
+ * the fontmap lock held. It sets fontset->pending and returns FALSE
+ * instead, and the caller has to wait for them without the lock
+ * and start over.
+ */
+static gboolean
+pango_fc_fontset_has_position (PangoFcFontset *fontset,
+                               unsigned int    i)
+{
+  PangoFcFontsetChain *chain = fontset->chain;
+
+  while (i >= chain->fonts->len)
+    {
+      gboolean prepare;
+
+      if (fontset->key->fontmap->priv->thread_safe &&
+          !pango_fc_patterns_has_font_pattern (fontset->patterns, chain->fonts->len))
+        {
+          fontset->pending = TRUE;
+          return FALSE;
+        }
+
+      if (!pango_fc_fontset_get_pattern_at (fontset, chain->fonts->len, &prepare))
+        return FALSE;
+
+      g_ptr_array_add (chain->fonts, NULL);
+      g_ptr_array_add (chain->coverages, NULL);
+    }
+
+  return TRUE;
+}
+
+static PangoFont *
+pango_fc_fontset_load_font (PangoFcFontset *fontset,
+                            unsigned int    i)
+{
+  FcPattern *pattern, *font_pattern;
   PangoFont *font;
+  gboolean prepare;
+
+  pattern = pango_fc_patterns_get_pattern (fontset->patterns);
+  font_pattern = pango_fc_fontset_get_pattern_at (fontset, i, &prepare);
+  if (G_UNLIKELY (!font_pattern))
+    return NULL;
+
+  if (prepare)
+    {
+      font_pattern = FcFontRenderPrepare (fontset->key->fontmap->priv->config, pattern, font_pattern);
+
+      if (G_UNLIKELY (!font_pattern))
+	return NULL;
+    }
+
+  font = pango_fc_font_map_new_font (fontset->key->fontmap,
+                                     fontset->key,
+                                     font_pattern);
+
+  if (prepare)
+    FcPatternDestroy (font_pattern);
+
+  return font;
+}
+
+static PangoFont *
+pango_fc_fontset_get_font_at (PangoFcFontset *fontset,
+			      unsigned int    i)
+{
+  PangoFont *font;
+
+  if (!pango_fc_fontset_has_position (fontset, i))
+    return NULL;
+
+  font = g_ptr_array_index (fontset->chain->fonts, i);
+  if (font == NULL)
+    {
+      font = pango_fc_fontset_load_font (fontset, i);
+      g_ptr_array_index (fontset->chain->fonts, i) = font;
+    }
+
+  return font;
+}
+
+/* Must only be called after pango_fc_fontset_has_position()
+ * returned TRUE for @i
+ */
+static PangoCoverage *
+pango_fc_fontset_get_coverage_at (PangoFcFontset *fontset,
+                                  unsigned int    i)
+{
+  PangoFcFontMap *fcfontmap = fontset->key->fontmap;
+  PangoCoverage *coverage;
+
+  coverage = g_ptr_array_index (fontset->chain->coverages, i);
+
+  if (coverage == NULL)
+    {
+      PangoFont *font = g_ptr_array_index (fontset->chain->fonts, i);
+
+      /* Custom decoders compute the charset from the font,
+       * otherwise the pattern has all we need
+       */
+      if (font == NULL && fcfontmap->priv->findfuncs == NULL)
+        {
+          gboolean prepare;
+
+          coverage = pango_fc_font_map_get_pattern_coverage (fcfontmap,
+                                                             pango_fc_fontset_get_pattern_at (fontset, i, &prepare));
+        }
+      else
+        {
+          font = pango_fc_fontset_get_font_at (fontset, i);
+          if (font)
+            coverage = pango_font_get_coverage (font, fontset->key->language);
+        }
+
+      if (coverage == NULL)
+        coverage = pango_coverage_new ();
+
+      g_ptr_array_index (fontset->chain->coverages, i) = coverage;
+    }
+
+  return coverage;
+}
+
+static void
+pango_fc_fontset_class_init (PangoFcFontsetClass *class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (class);
+  PangoFontsetClass *fontset_class = PANGO_FONTSET_CLASS (class);
+
+  object_class->finalize = pango_fc_fontset_finalize;
+
+  fontset_class->get_font = pango_fc_fontset_get_font;
+  fontset_class->get_language = pango_fc_fontset_get_language;
+  fontset_class->foreach = pango_fc_fontset_foreach;
+}
+
+static void
+pango_fc_fontset_init (PangoFcFontset *fontset)
+{
+}
+
+static void
+pango_fc_fontset_finalize (GObject *object)
+{
+  PangoFcFontset *fontset = PANGO_FC_FONTSET (object);
+
+  if (fontset->chain)
+    pango_fc_fontset_chain_unref (fontset->chain);
+
+  if (fontset->key)
+    pango_fc_fontset_key_free (fontset->key);
+
+  if (fontset->patterns)
+    pango_fc_patterns_unref (fontset->patterns);
+
+  G_OBJECT_CLASS (pango_fc_fontset_parent_class)->finalize (object);
+}
+
+static PangoLanguage *
+pango_fc_fontset_get_language (PangoFontset  *fontset)
+{
+  PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
+
+  return pango_fc_fontset_key_get_language (pango_fc_fontset_get_key (fcfontset));
+}
+
+/* Finds the first font with the best coverage for @wc by probing
+ * the fonts one by one. Returns -1 if the fontset is empty.
+ */
+static int
+pango_fc_fontset_find_font (PangoFcFontset *fontset,
+                            guint           wc)
+{
+  PangoCoverageLevel best_level = PANGO_COVERAGE_NONE;
+  PangoCoverageLevel level;
   PangoCoverage *coverage;
   int result = -1;
   unsigned int i;
 
   for (i = 0;
-       pango_fc_fontset_get_font_at (fcfontset, i);
+       pango_fc_fontset_has_position (fontset, i);
        i++)
     {
-      coverage = g_ptr_array_index (fcfontset->coverages, i);
-
-      if (coverage == NULL)
-	{
-	  font = g_ptr_array_index (fcfontset->fonts, i);
-
-	  coverage = pango_font_get_coverage (font, fcfontset->key->language);
-	  g_ptr_array_index (fcfontset->coverages, i) = coverage;
-	}
+      coverage = pango_fc_fontset_get_coverage_at (fontset, i);
 
       level = pango_coverage_get (coverage, wc);
 
@@ -1285,28 +1934,192 @@ pango_fc_fontset_get_font (PangoFontset  *fontset,
 	}
     }
 
-  if (G_UNLIKELY (result == -1))
+  return result;
+}
+
+static void
+pango_fc_fontset_merge_coverage (PangoFcFontset      *fontset,
+                                 PangoFcFontsetBlock *block,
+                                 guint                start)
+{
+  PangoCoverage *coverage;
+  FcChar32 map[FC_CHARSET_MAP_SIZE];
+  guint c;
+
+  coverage = pango_fc_fontset_get_coverage_at (fontset, block->depth);
+
+  if (pango_fc_coverage_get_page (coverage, start, map))
+    {
+      for (c = 0; c < 256; c++)
+        {
+          if (block->font[c] == 0 && (map[c >> 5] & (1u << (c & 31))))
+            block->font[c] = block->depth + 1;
+        }
+    }
+  else
+    {
+      for (c = 0; c < 256; c++)
+        {
+          if (block->font[c] == 0 &&
+              pango_coverage_get (coverage, start + c) == PANGO_COVERAGE_EXACT)
+            block->font[c] = block->depth + 1;
+        }
+    }
+
+  block->depth++;
+}
+
+static PangoFont *
+pango_fc_fontset_get_font_locked (PangoFontset *fontset,
+                                  guint         wc)
+{
+  PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
+  PangoFcFontsetBlock *block;
+  PangoFont *font;
+  int result;
+
+  pango_fc_fontset_share_chain (fcfontset);
+
+  block = g_hash_table_lookup (fcfontset->chain->blocks, GUINT_TO_POINTER (wc >> 8));
+  if (G_UNLIKELY (block == NULL))
+    {
+      block = g_new0 (PangoFcFontsetBlock, 1);
+      g_hash_table_insert (fcfontset->chain->blocks, GUINT_TO_POINTER (wc >> 8), block);
+    }
+
+  /* Merge in the coverage of more fonts, loading them as needed,
+   * until one of them covers wc. This never loads more fonts than
+   * probing them one by one would.
+   */
+  while (block->font[wc & 0xff] == 0 &&
+         block->depth < G_MAXUINT16 - 1 &&
+         pango_fc_fontset_has_position (fcfontset, block->depth))
+    pango_fc_fontset_merge_coverage (fcfontset, block, wc & ~0xffu);
+
+  if (G_UNLIKELY (fcfontset->pending))
+    return NULL;
+
+  if (G_LIKELY (block->font[wc & 0xff] != 0))
+    result = block->font[wc & 0xff] - 1;
+  else
+    {
+      /* No font covers wc exactly, look for the best partial coverage */
+      result = pango_fc_fontset_find_font (fcfontset, wc);
+      if (G_UNLIKELY (result == -1 || fcfontset->pending))
+        return NULL;
+
+      if (result < G_MAXUINT16 - 1)
+        block->font[wc & 0xff] = result + 1;
+    }
+
+  font = pango_fc_fontset_get_font_at (fcfontset, result);
+  if (G_UNLIKELY (font == NULL))
     return NULL;
 
-  font = g_ptr_array_index (fcfontset->fonts, result);
   return g_object_ref (font);
 }
 
+static PangoFont *
+pango_fc_fontset_get_font (PangoFontset  *fontset,
+			   guint          wc)
+{
+  PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
+  PangoFcFontMap *fcfontmap = fcfontset->key->fontmap;
+  PangoFont *font;
+  gboolean prepare;
+  int i;
+
+  if (!fcfontmap->priv->thread_safe)
+    return pango_fc_fontset_get_font_locked (fontset, wc);
+
+  /* Wait for the match without holding the lock, and for the sort
+   * too if it turns out we need more than the first font. The patterns
+   * of a fontset never change, and our caller holds a reference on
+   * the fontset, so we can get at them without the lock. Everything
+   * else may have changed while we waited, so we start over.
+   */
+  for (i = 0; ; i++)
+    {
+      pango_fc_patterns_get_font_pattern (fcfontset->patterns, i, &prepare);
+
+      _pango_fc_font_map_lock (fcfontmap);
+      fcfontset->pending = FALSE;
+      font = pango_fc_fontset_get_font_locked (fontset, wc);
+      if (!fcfontset->pending || i > 0)
+        break;
+      _pango_fc_font_map_unlock (fcfontmap);
+    }
+
+  fcfontset->pending = FALSE;
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return font;
+}
+
 static void
 pango_fc_fontset_foreach (PangoFontset           *fontset,
 			  PangoFontsetForeachFunc func,
 			  gpointer                data)
 {
   PangoFcFontset *fcfontset = PANGO_FC_FONTSET (fontset);
+  PangoFcFontMap *fcfontmap = fcfontset->key->fontmap;
   PangoFont *font;
   unsigned int i;
 
-  for (i = 0;
-       (font = pango_fc_fontset_get_font_at (fcfontset, i));
-       i++)
+  if (!fcfontmap->priv->thread_safe)
+    {
+      PangoFcFontsetChain *chain;
+
+      pango_fc_fontset_share_chain (fcfontset);
+
+      /* func may call back into the fontset and make it switch
+       * chains; keep the fonts we hand out alive until we are done
+       */
+      chain = g_object_ref (fcfontset->chain);
+
+      for (i = 0;
+           pango_fc_fontset_has_position (fcfontset, i);
+           i++)
+        {
+          font = pango_fc_fontset_get_font_at (fcfontset, i);
+          if (font && (*func) (fontset, font, data))
+            break;
+        }
+
+      g_object_unref (chain);
+    }
+  else
     {
-      if ((*func) (fontset, font, data))
-	return;
+      GPtrArray *fonts;
+      gboolean prepare;
+
+      /* We need all the fonts, so wait for the sort before taking
+       * the lock, see pango_fc_fontset_get_font()
+       */
+      pango_fc_patterns_get_font_pattern (fcfontset->patterns, 1, &prepare);
+
+      /* Don't call out with the lock held */
+      fonts = g_ptr_array_new_with_free_func (g_object_unref);
+
+      _pango_fc_font_map_lock (fcfontmap);
+      pango_fc_fontset_share_chain (fcfontset);
+      for (i = 0;
+           pango_fc_fontset_has_position (fcfontset, i);
+           i++)
+        {
+          font = pango_fc_fontset_get_font_at (fcfontset, i);
+          if (font)
+            g_ptr_array_add (fonts, g_object_ref (font));
+        }
+      _pango_fc_font_map_unlock (fcfontmap);
+
+      for (i = 0; i < fonts->len; i++)
+        {
+          if ((*func) (fontset, g_ptr_array_index (fonts, i), data))
+            break;
+        }
+
+      g_ptr_array_unref (fonts);
     }
 }
 
@@ -1327,10 +2140,24 @@ static guint
 pango_fc_font_map_get_n_items (GListModel *list)
 {
   PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (list);
+  guint n_items;
 
-  ensure_families (fcfontmap);
+  _pango_fc_font_map_lock (fcfontmap);
+
+  /* While families are loaded in the background, we only
+   * report the ones that we announced with ::items-changed
+   */
+  if (fcfontmap->priv->n_items >= 0)
+    n_items = fcfontmap->priv->n_items;
+  else
+    {
+      ensure_families (fcfontmap);
+      n_items = fcfontmap->priv->n_families;
+    }
 
-  return fcfontmap->priv->n_families;
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return n_items;
 }
 
 static gpointer
@@ -1338,13 +2165,26 @@ pango_fc_font_map_get_item (GListModel *list,
                             guint       position)
 {
   PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (list);
+  gpointer item = NULL;
 
-  ensure_families (fcfontmap);
+  _pango_fc_font_map_lock (fcfontmap);
+
+  if (fcfontmap->priv->n_items >= 0)
+    {
+      if (position < fcfontmap->priv->n_items)
+        item = g_object_ref (fcfontmap->priv->families[position]);
+    }
+  else
+    {
+      ensure_families (fcfontmap);
 
-  if (position < fcfontmap->priv->n_families)
-    return g_object_ref (fcfontmap->priv->families[position]);
+      if (position < fcfontmap->priv->n_families)
+        item = g_object_ref (fcfontmap->priv->families[position]);
+    }
 
-  return NULL;
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return item;
 }
 
 static void
@@ -1401,18 +2241,80 @@ wait_for_fc_init (void)
   gint64 before G_GNUC_UNUSED;
   gboolean waited = FALSE;
 
-  before = PANGO_TRACE_CURRENT_TIME;
+  before = PANGO_TRACE_CURRENT_TIME;
+
+  g_mutex_lock (&fc_init_mutex);
+  while (fc_initialized < DEFAULT_CONFIG_INITIALIZED)
+    {
+      waited = TRUE;
+      g_cond_wait (&fc_init_cond, &fc_init_mutex);
+    }
+  g_mutex_unlock (&fc_init_mutex);
+
+  if (waited)
+    pango_trace_mark (before, "wait for FcInit", NULL);
+}
+
+/* Finds the families of a fontmap in a separate thread, see
+ * pango_fc_font_map_load_families_in_background(). The thread
+ * adds them to @pending, and schedules publish_families() in
+ * @context to move them to the fontmap. ensure_families() can
+ * also take them, once the thread is done.
+ */
+struct _PangoFcFamilyLoader
+{
+  PangoFcFontMap *fontmap;  /* Not a reference, fini() joins the thread */
+  FcConfig *config;
+  PangoFcSortCache *sort_cache;
+  GMainContext *context;
+  GThread *thread;
+  int cancelled;            /* Atomic */
+
+  /* Under loader_mutex */
+  GPtrArray *pending;
+  gboolean done;
+};
+
+static GMutex loader_mutex;
+static GCond loader_cond;
+
+static void
+pango_fc_family_loader_free (PangoFcFamilyLoader *loader)
+{
+  guint i;
+
+  for (i = 0; i < loader->pending->len; i++)
+    g_object_unref (g_ptr_array_index (loader->pending, i));
+  g_ptr_array_unref (loader->pending);
+
+  if (loader->config)
+    FcConfigDestroy (loader->config);
+  g_clear_pointer (&loader->sort_cache, pango_fc_sort_cache_unref);
+  g_main_context_unref (loader->context);
+
+  g_free (loader);
+}
+
+/* Stops the loader thread, and drops whatever it found */
+static void
+pango_fc_font_map_stop_loading_families (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
 
-  g_mutex_lock (&fc_init_mutex);
-  while (fc_initialized < DEFAULT_CONFIG_INITIALIZED)
+  if (priv->loader)
     {
-      waited = TRUE;
-      g_cond_wait (&fc_init_cond, &fc_init_mutex);
+      g_atomic_int_set (&priv->loader->cancelled, TRUE);
+      g_thread_join (priv->loader->thread);
+      g_clear_pointer (&priv->loader, pango_fc_family_loader_free);
     }
-  g_mutex_unlock (&fc_init_mutex);
 
-  if (waited)
-    pango_trace_mark (before, "wait for FcInit", NULL);
+  g_mutex_lock (&loader_mutex);
+  if (priv->families_source)
+    {
+      g_source_destroy (priv->families_source);
+      g_clear_pointer (&priv->families_source, g_source_unref);
+    }
+  g_mutex_unlock (&loader_mutex);
 }
 
 static void
@@ -1423,6 +2325,7 @@ pango_fc_font_map_init (PangoFcFontMap *fcfontmap)
   priv = fcfontmap->priv = pango_fc_font_map_get_instance_private (fcfontmap);
 
   priv->n_families = -1;
+  priv->n_items = -1;
 
   priv->font_hash = g_hash_table_new ((GHashFunc)pango_fc_font_key_hash,
 				      (GEqualFunc)pango_fc_font_key_equal);
@@ -1433,8 +2336,15 @@ pango_fc_font_map_init (PangoFcFontMap *fcfontmap)
 					      (GDestroyNotify)g_object_unref);
   priv->fontset_cache = g_queue_new ();
 
+  /* The cache limits survive cache_clear() */
+  if (priv->max_fontsets == 0)
+    priv->max_fontsets = DEFAULT_MAX_FONTSETS;
+
   priv->patterns_hash = g_hash_table_new (NULL, NULL);
 
+  priv->chain_hash = g_hash_table_new ((GHashFunc) pango_fc_fontset_chain_hash,
+                                       (GEqualFunc) pango_fc_fontset_chain_equal);
+
   priv->pattern_hash = g_hash_table_new_full ((GHashFunc) FcPatternHash,
 					      (GEqualFunc) FcPatternEqual,
 					      (GDestroyNotify) FcPatternDestroy,
@@ -1455,10 +2365,15 @@ pango_fc_font_map_fini (PangoFcFontMap *fcfontmap)
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
   int i;
 
+  pango_fc_font_map_stop_loading_families (fcfontmap);
+
   g_clear_pointer (&priv->fonts, FcFontSetDestroy);
+  g_clear_pointer (&priv->sort_cache, pango_fc_sort_cache_unref);
+  priv->sort_cache_checked = FALSE;
 
   g_queue_free (priv->fontset_cache);
   priv->fontset_cache = NULL;
+  priv->n_varied_fontsets = 0;
 
   g_hash_table_destroy (priv->fontset_hash);
   priv->fontset_hash = NULL;
@@ -1466,9 +2381,16 @@ pango_fc_font_map_fini (PangoFcFontMap *fcfontmap)
   g_hash_table_destroy (priv->patterns_hash);
   priv->patterns_hash = NULL;
 
+  g_hash_table_destroy (priv->chain_hash);
+  priv->chain_hash = NULL;
+
   g_hash_table_destroy (priv->font_hash);
   priv->font_hash = NULL;
 
+  /* The links are embedded in the face data, which the hash table frees */
+  g_queue_init (&priv->face_data_lru);
+  priv->face_data_size = 0;
+
   g_hash_table_destroy (priv->font_face_data_hash);
   priv->font_face_data_hash = NULL;
 
@@ -1480,6 +2402,7 @@ pango_fc_font_map_fini (PangoFcFontMap *fcfontmap)
   g_free (priv->families);
   priv->n_families = -1;
   priv->families = NULL;
+  priv->n_items = -1;
 }
 
 static void
@@ -1489,6 +2412,8 @@ pango_fc_font_map_class_init (PangoFcFontMapClass *class)
   PangoFontMapClass *fontmap_class = PANGO_FONT_MAP_CLASS (class);
 
   object_class->finalize = pango_fc_font_map_finalize;
+  object_class->set_property = pango_fc_font_map_set_property;
+  object_class->get_property = pango_fc_font_map_get_property;
   fontmap_class->load_font = pango_fc_font_map_load_font;
   fontmap_class->load_fontset = pango_fc_font_map_load_fontset;
   fontmap_class->list_families = pango_fc_font_map_list_families;
@@ -1496,6 +2421,31 @@ pango_fc_font_map_class_init (PangoFcFontMapClass *class)
   fontmap_class->get_face = pango_fc_font_map_get_face;
   fontmap_class->shape_engine_type = PANGO_RENDER_TYPE_FC;
   fontmap_class->changed = pango_fc_font_map_changed;
+
+  /**
+   * PangoFcFontMap:thread-safe:
+   *
+   * Whether the font map can be used from multiple threads at once.
+   *
+   * By default, a font map and the fonts, fontsets and families
+   * it creates must only be used from one thread at a time, and
+   * multi-threaded programs use one font map per thread. A
+   * thread-safe font map protects its caches with a lock, so that
+   * all threads can share them.
+   *
+   * Contexts and layouts are still not thread-safe, each thread
+   * must use its own. Clearing the caches or changing the
+   * configuration of the font map while other threads use it
+   * is not supported.
+   *
+   * Since: 1.52
+   */
+  g_object_class_install_property (object_class, PROP_THREAD_SAFE,
+                                   g_param_spec_boolean ("thread-safe", "", "",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -1536,7 +2486,9 @@ pango_fc_font_map_add_decoder_find_func (PangoFcFontMap        *fcfontmap,
   info->user_data = user_data;
   info->dnotify = dnotify;
 
+  _pango_fc_font_map_lock (fcfontmap);
   priv->findfuncs = g_slist_append (priv->findfuncs, info);
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 /**
@@ -1558,22 +2510,32 @@ PangoFcDecoder *
 pango_fc_font_map_find_decoder (PangoFcFontMap *fcfontmap,
                                 FcPattern      *pattern)
 {
-  GSList *l;
+  PangoFcDecoder *decoder = NULL;
+  GSList *findfuncs, *l;
 
   g_return_val_if_fail (PANGO_IS_FC_FONT_MAP (fcfontmap), NULL);
   g_return_val_if_fail (pattern != NULL, NULL);
 
-  for (l = fcfontmap->priv->findfuncs; l && l->data; l = l->next)
+  /* The infos stay around until the fontmap is finalized,
+   * so we only need the lock to copy the list. Don't call
+   * out to the find funcs with the lock held.
+   */
+  _pango_fc_font_map_lock (fcfontmap);
+  findfuncs = g_slist_copy (fcfontmap->priv->findfuncs);
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  for (l = findfuncs; l && l->data; l = l->next)
     {
       PangoFcFindFuncInfo *info = l->data;
-      PangoFcDecoder *decoder;
 
       decoder = info->findfunc (pattern, info->user_data);
       if (decoder)
-	return decoder;
+	break;
     }
 
-  return NULL;
+  g_slist_free (findfuncs);
+
+  return decoder;
 }
 
 static void
@@ -1581,169 +2543,586 @@ pango_fc_font_map_finalize (GObject *object)
 {
   PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (object);
 
-  pango_fc_font_map_shutdown (fcfontmap);
+  pango_fc_font_map_shutdown (fcfontmap);
+
+  if (fcfontmap->substitute_destroy)
+    fcfontmap->substitute_destroy (fcfontmap->substitute_data);
+
+  if (fcfontmap->priv->thread_safe)
+    g_rec_mutex_clear (&fcfontmap->priv->lock);
+
+  G_OBJECT_CLASS (pango_fc_font_map_parent_class)->finalize (object);
+}
+
+enum {
+  PROP_0,
+  PROP_THREAD_SAFE
+};
+
+static void
+pango_fc_font_map_set_property (GObject      *object,
+                                guint         property_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+  PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (object);
+
+  switch (property_id)
+    {
+    case PROP_THREAD_SAFE:
+      fcfontmap->priv->thread_safe = g_value_get_boolean (value);
+      if (fcfontmap->priv->thread_safe)
+        g_rec_mutex_init (&fcfontmap->priv->lock);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+pango_fc_font_map_get_property (GObject    *object,
+                                guint       property_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+  PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (object);
+
+  switch (property_id)
+    {
+    case PROP_THREAD_SAFE:
+      g_value_set_boolean (value, fcfontmap->priv->thread_safe);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+/* Add a mapping from key to fcfont */
+static void
+pango_fc_font_map_add (PangoFcFontMap *fcfontmap,
+		       PangoFcFontKey *key,
+		       PangoFcFont    *fcfont)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  PangoFcFontKey *key_copy;
+
+  key_copy = pango_fc_font_key_copy (key);
+  _pango_fc_font_set_font_key (fcfont, key_copy);
+  g_hash_table_insert (priv->font_hash, key_copy, fcfont);
+}
+
+/* Remove mapping from fcfont->key to fcfont */
+/* Closely related to shutdown_font() */
+void
+_pango_fc_font_map_remove (PangoFcFontMap *fcfontmap,
+			   PangoFcFont    *fcfont)
+{
+  PangoFcFontKey *key;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  key = _pango_fc_font_get_font_key (fcfont);
+  if (key)
+    {
+      _pango_fc_font_map_forget (fcfontmap, fcfont);
+      _pango_fc_font_set_font_key (fcfont, NULL);
+      pango_fc_font_key_free (key);
+    }
+
+  _pango_fc_font_map_unlock (fcfontmap);
+}
+
+/* Drop the fontmap's weak reference to fcfont, keeping its key.
+ * In thread-safe mode this runs from the font's dispose, so that
+ * load_font() on another thread either finds the font before this
+ * point (and resurrects it) or misses it and creates a new one.
+ */
+void
+_pango_fc_font_map_forget (PangoFcFontMap *fcfontmap,
+                           PangoFcFont    *fcfont)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  PangoFcFontKey *key;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  key = _pango_fc_font_get_font_key (fcfont);
+
+  /* Only remove from fontmap hash if we are in it.  This is not necessarily
+   * the case after a cache_clear() call. */
+  if (key && priv->font_hash &&
+      fcfont == g_hash_table_lookup (priv->font_hash, key))
+    g_hash_table_remove (priv->font_hash, key);
+
+  _pango_fc_font_map_unlock (fcfontmap);
+}
+
+static PangoFcFamily *
+create_family (PangoFcFontMap *fcfontmap,
+	       const char     *family_name,
+	       int             spacing)
+{
+  PangoFcFamily *family = g_object_new (PANGO_FC_TYPE_FAMILY, NULL);
+  family->fontmap = fcfontmap;
+  family->family_name = g_strdup (family_name);
+  family->spacing = spacing;
+  family->variable = FALSE;
+  family->patterns = FcFontSetCreate ();
+
+  return family;
+}
+
+static gboolean
+is_alias_family (const char *family_name)
+{
+  switch (family_name[0])
+    {
+    case 'c':
+    case 'C':
+      return (g_ascii_strcasecmp (family_name, "cursive") == 0);
+    case 'f':
+    case 'F':
+      return (g_ascii_strcasecmp (family_name, "fantasy") == 0);
+    case 'm':
+    case 'M':
+      return (g_ascii_strcasecmp (family_name, "monospace") == 0);
+    case 's':
+    case 'S':
+      return (g_ascii_strcasecmp (family_name, "sans") == 0 ||
+	      g_ascii_strcasecmp (family_name, "serif") == 0 ||
+	      g_ascii_strcasecmp (family_name, "system-ui") == 0);
+    default:
+      return FALSE;
+    }
+
+  return FALSE;
+}
+
+static const char *
+get_family_name (FcPattern *pattern)
+{
+  const char *name;
+
+  if (FcPatternGetString (pattern, FC_FAMILY, 0, (FcChar8 **)(void*)&name) != FcResultMatch)
+    return NULL;
+
+  return name;
+}
+
+/* Groups @fonts by their first family name, in the order in which
+ * the families first appear, and leaves out the generic aliases
+ */
+static FcFontSet *
+group_fonts_by_family (FcFontSet *fonts)
+{
+  GHashTable *groups;
+  GPtrArray *order;
+  FcFontSet *grouped;
+  int i;
+  guint j, k;
+
+  groups = g_hash_table_new (g_str_hash, g_str_equal);
+  order = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+
+  for (i = 0; i < fonts->nfont; i++)
+    {
+      const char *name = get_family_name (fonts->fonts[i]);
+      GPtrArray *group;
+
+      if (!name || is_alias_family (name))
+        continue;
+
+      group = g_hash_table_lookup (groups, name);
+      if (!group)
+        {
+          group = g_ptr_array_new ();
+          g_hash_table_insert (groups, (gpointer) name, group);
+          g_ptr_array_add (order, group);
+        }
+
+      g_ptr_array_add (group, fonts->fonts[i]);
+    }
+
+  grouped = FcFontSetCreate ();
+  for (j = 0; j < order->len; j++)
+    {
+      GPtrArray *group = g_ptr_array_index (order, j);
+
+      for (k = 0; k < group->len; k++)
+        {
+          FcPatternReference (g_ptr_array_index (group, k));
+          FcFontSetAdd (grouped, g_ptr_array_index (group, k));
+        }
+    }
+
+  g_ptr_array_unref (order);
+  g_hash_table_destroy (groups);
+
+  return grouped;
+}
+
+/* Returns @fonts grouped by family, from @cache if it has them */
+static FcFontSet *
+get_fonts_by_family (FcFontSet        *fonts,
+                     PangoFcSortCache *cache)
+{
+  FcFontSet *grouped = NULL;
+
+  if (cache)
+    grouped = pango_fc_sort_cache_lookup_families (cache);
+
+  if (!grouped)
+    {
+      grouped = group_fonts_by_family (fonts);
+
+      if (cache)
+        pango_fc_sort_cache_add_families (cache, grouped);
+    }
+
+  return grouped;
+}
+
+/* Creates the family for the fonts with the same family name
+ * that start at *@start in @grouped, and moves *@start past
+ * them. Returns %NULL at the end of @grouped. Families found
+ * in @keep, by name, are reused instead.
+ */
+static PangoFcFamily *
+create_next_family (PangoFcFontMap *fcfontmap,
+                    FcConfig       *config,
+                    FcFontSet      *grouped,
+                    GHashTable     *keep,
+                    int            *start)
+{
+  FcObjectSet *os;
+  FcPattern *pat;
+  FcFontSet run, *sets[1];
+  FcFontSet *fontset;
+  const char *name;
+  PangoFcFamily *family;
+  int spacing;
+  int end, i;
+
+  if (*start >= grouped->nfont)
+    return NULL;
+
+  name = get_family_name (grouped->fonts[*start]);
+  for (end = *start + 1; end < grouped->nfont; end++)
+    {
+      if (g_strcmp0 (get_family_name (grouped->fonts[end]), name) != 0)
+        break;
+    }
+
+  run.nfont = run.sfont = end - *start;
+  run.fonts = grouped->fonts + *start;
+  sets[0] = &run;
+
+  *start = end;
+
+  if (keep && name && (family = g_hash_table_lookup (keep, name)))
+    return g_object_ref (family);
+
+  os = FcObjectSetBuild (FC_FAMILY, FC_SPACING, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT,
+                         FC_VARIABLE,
+                         FC_FONTFORMAT,
+                         NULL);
+  pat = FcPatternCreate ();
+  fontset = FcFontSetList (config, sets, 1, pat, os);
+  FcPatternDestroy (pat);
+  FcObjectSetDestroy (os);
+
+  if (fontset->nfont == 0 ||
+      FcPatternGetInteger (fontset->fonts[0], FC_SPACING, 0, &spacing) != FcResultMatch)
+    spacing = FC_PROPORTIONAL;
+
+  family = create_family (fcfontmap, name ? name : "", spacing);
+
+  for (i = 0; i < fontset->nfont; i++)
+    {
+      int variable;
+
+      variable = FALSE;
+      variable = FcPatternGetBool (fontset->fonts[i], FC_VARIABLE, 0, &variable);
+      if (variable)
+        family->variable = TRUE;
+
+      FcPatternReference (fontset->fonts[i]);
+      FcFontSetAdd (family->patterns, fontset->fonts[i]);
+    }
+
+  FcFontSetDestroy (fontset);
+
+  return family;
+}
+
+static void
+add_alias_family (PangoFcFontMap *fcfontmap,
+                  GPtrArray      *families,
+                  GHashTable     *keep,
+                  const char     *name,
+                  int             spacing)
+{
+  PangoFcFamily *family = NULL;
+
+  if (keep)
+    family = g_hash_table_lookup (keep, name);
+
+  if (family)
+    g_ptr_array_add (families, g_object_ref (family));
+  else
+    g_ptr_array_add (families, create_family (fcfontmap, name, spacing));
+}
+
+static void
+add_alias_families (PangoFcFontMap *fcfontmap,
+                    GPtrArray      *families,
+                    GHashTable     *keep)
+{
+  add_alias_family (fcfontmap, families, keep, "Sans", FC_PROPORTIONAL);
+  add_alias_family (fcfontmap, families, keep, "Serif", FC_PROPORTIONAL);
+  add_alias_family (fcfontmap, families, keep, "Monospace", FC_MONO);
+  add_alias_family (fcfontmap, families, keep, "System-ui", FC_PROPORTIONAL);
+}
+
+/* Builds the list of families for the fonts of the configuration */
+static GPtrArray *
+pango_fc_font_map_build_families (PangoFcFontMap *fcfontmap,
+                                  GHashTable     *keep)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  GPtrArray *families;
+  FcFontSet *grouped;
+  PangoFcFamily *family;
+  int start;
+
+  grouped = get_fonts_by_family (pango_fc_font_map_get_config_fonts (fcfontmap),
+                                 pango_fc_font_map_get_sort_cache (fcfontmap));
+
+  families = g_ptr_array_new ();
+
+  start = 0;
+  while ((family = create_next_family (fcfontmap, priv->config, grouped, keep, &start)))
+    g_ptr_array_add (families, family);
+
+  FcFontSetDestroy (grouped);
+
+  add_alias_families (fcfontmap, families, keep);
+
+  return families;
+}
+
+static gboolean publish_families (gpointer data);
+
+/* Called with loader_mutex held */
+static void
+schedule_publish_families (PangoFcFamilyLoader *loader)
+{
+  PangoFcFontMapPrivate *priv = loader->fontmap->priv;
+
+  if (priv->families_source)
+    return;
+
+  priv->families_source = g_idle_source_new ();
+  g_source_set_callback (priv->families_source, publish_families, loader->fontmap, NULL);
+  g_source_attach (priv->families_source, loader->context);
+}
+
+static gpointer
+pango_fc_family_loader_run (gpointer data)
+{
+  PangoFcFamilyLoader *loader = data;
+  FcFontSet *sets[2];
+  FcFontSet *fonts, *grouped;
+  PangoFcFamily *family;
+  int start;
+
+  wait_for_fc_init ();
+
+  /* Not the fontmap's own font set, which is not protected against
+   * use from several threads. It has the same fonts in the same order,
+   * so the fontmap's sort cache applies to it.
+   */
+  sets[0] = FcConfigGetFonts (loader->config, 0);
+  sets[1] = FcConfigGetFonts (loader->config, 1);
+  fonts = filter_by_format (sets, 2);
+
+  grouped = get_fonts_by_family (fonts, loader->sort_cache);
+
+  start = 0;
+  while (!g_atomic_int_get (&loader->cancelled) &&
+         (family = create_next_family (loader->fontmap, loader->config, grouped, NULL, &start)))
+    {
+      g_mutex_lock (&loader_mutex);
+      g_ptr_array_add (loader->pending, family);
+      schedule_publish_families (loader);
+      g_mutex_unlock (&loader_mutex);
+    }
+
+  FcFontSetDestroy (grouped);
+  FcFontSetDestroy (fonts);
 
-  if (fcfontmap->substitute_destroy)
-    fcfontmap->substitute_destroy (fcfontmap->substitute_data);
+  g_mutex_lock (&loader_mutex);
+  add_alias_families (loader->fontmap, loader->pending, NULL);
+  loader->done = TRUE;
+  schedule_publish_families (loader);
+  g_cond_broadcast (&loader_cond);
+  g_mutex_unlock (&loader_mutex);
 
-  G_OBJECT_CLASS (pango_fc_font_map_parent_class)->finalize (object);
+  return NULL;
 }
 
-/* Add a mapping from key to fcfont */
+/* Moves the families that the loader found so far to
+ * the fontmap, and drops the loader once it is done
+ */
 static void
-pango_fc_font_map_add (PangoFcFontMap *fcfontmap,
-		       PangoFcFontKey *key,
-		       PangoFcFont    *fcfont)
+pango_fc_font_map_take_families (PangoFcFontMap *fcfontmap)
 {
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
-  PangoFcFontKey *key_copy;
-
-  key_copy = pango_fc_font_key_copy (key);
-  _pango_fc_font_set_font_key (fcfont, key_copy);
-  g_hash_table_insert (priv->font_hash, key_copy, fcfont);
+  PangoFcFamilyLoader *loader = priv->loader;
+  GPtrArray *pending;
+  gboolean done;
+
+  g_mutex_lock (&loader_mutex);
+  pending = loader->pending;
+  loader->pending = g_ptr_array_new ();
+  done = loader->done;
+  g_mutex_unlock (&loader_mutex);
+
+  priv->families = g_renew (PangoFcFamily *, priv->families, priv->n_families + pending->len);
+  memcpy (priv->families + priv->n_families, pending->pdata, pending->len * sizeof (PangoFcFamily *));
+  priv->n_families += pending->len;
+  g_ptr_array_unref (pending);
+
+  if (done)
+    {
+      g_thread_join (loader->thread);
+      g_clear_pointer (&priv->loader, pango_fc_family_loader_free);
+    }
 }
 
-/* Remove mapping from fcfont->key to fcfont */
-/* Closely related to shutdown_font() */
-void
-_pango_fc_font_map_remove (PangoFcFontMap *fcfontmap,
-			   PangoFcFont    *fcfont)
+static gboolean
+publish_families (gpointer data)
 {
+  PangoFcFontMap *fcfontmap = g_object_ref (data);
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
-  PangoFcFontKey *key;
+  guint position, added;
 
-  key = _pango_fc_font_get_font_key (fcfont);
-  if (key)
-    {
-      /* Only remove from fontmap hash if we are in it.  This is not necessarily
-       * the case after a cache_clear() call. */
-      if (priv->font_hash &&
-	  fcfont == g_hash_table_lookup (priv->font_hash, key))
-        {
-	  g_hash_table_remove (priv->font_hash, key);
-	}
-      _pango_fc_font_set_font_key (fcfont, NULL);
-      pango_fc_font_key_free (key);
-    }
-}
+  g_mutex_lock (&loader_mutex);
+  g_clear_pointer (&priv->families_source, g_source_unref);
+  g_mutex_unlock (&loader_mutex);
 
-static PangoFcFamily *
-create_family (PangoFcFontMap *fcfontmap,
-	       const char     *family_name,
-	       int             spacing)
-{
-  PangoFcFamily *family = g_object_new (PANGO_FC_TYPE_FAMILY, NULL);
-  family->fontmap = fcfontmap;
-  family->family_name = g_strdup (family_name);
-  family->spacing = spacing;
-  family->variable = FALSE;
-  family->patterns = FcFontSetCreate ();
+  _pango_fc_font_map_lock (fcfontmap);
 
-  return family;
-}
+  if (priv->loader)
+    pango_fc_font_map_take_families (fcfontmap);
 
-static gboolean
-is_alias_family (const char *family_name)
-{
-  switch (family_name[0])
+  position = priv->n_items;
+  added = priv->n_families - priv->n_items;
+  priv->n_items = priv->n_families;
+
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  if (added > 0)
     {
-    case 'c':
-    case 'C':
-      return (g_ascii_strcasecmp (family_name, "cursive") == 0);
-    case 'f':
-    case 'F':
-      return (g_ascii_strcasecmp (family_name, "fantasy") == 0);
-    case 'm':
-    case 'M':
-      return (g_ascii_strcasecmp (family_name, "monospace") == 0);
-    case 's':
-    case 'S':
-      return (g_ascii_strcasecmp (family_name, "sans") == 0 ||
-	      g_ascii_strcasecmp (family_name, "serif") == 0 ||
-	      g_ascii_strcasecmp (family_name, "system-ui") == 0);
-    default:
-      return FALSE;
+      g_list_model_items_changed (G_LIST_MODEL (fcfontmap), position, 0, added);
+      g_object_notify (G_OBJECT (fcfontmap), "n-items");
     }
 
-  return FALSE;
+  g_object_unref (fcfontmap);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
 ensure_families (PangoFcFontMap *fcfontmap)
 {
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
-  FcFontSet *fontset;
-  int i;
-  int count;
 
   wait_for_fc_init ();
 
-  if (priv->n_families < 0)
+  _pango_fc_font_map_lock (fcfontmap);
+
+  if (priv->loader)
     {
-      FcObjectSet *os = FcObjectSetBuild (FC_FAMILY, FC_SPACING, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT,
-                                          FC_VARIABLE,
-                                          FC_FONTFORMAT,
-                                          NULL);
-      FcPattern *pat = FcPatternCreate ();
-      GHashTable *temp_family_hash;
-      FcFontSet *fonts;
+      /* The list items are still announced by publish_families() */
+      g_mutex_lock (&loader_mutex);
+      while (!priv->loader->done)
+        g_cond_wait (&loader_cond, &loader_mutex);
+      g_mutex_unlock (&loader_mutex);
 
-      fonts = pango_fc_font_map_get_config_fonts (fcfontmap);
-      fontset = FcFontSetList (priv->config, &fonts, 1, pat, os);
+      pango_fc_font_map_take_families (fcfontmap);
+    }
+  else if (priv->n_families < 0)
+    {
+      GPtrArray *families;
 
-      FcPatternDestroy (pat);
-      FcObjectSetDestroy (os);
+      families = pango_fc_font_map_build_families (fcfontmap, NULL);
 
-      priv->families = g_new (PangoFcFamily *, fontset->nfont + 4); /* 4 standard aliases */
-      temp_family_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      priv->n_families = families->len;
+      priv->families = (PangoFcFamily **) g_ptr_array_free (families, FALSE);
+    }
 
-      count = 0;
-      for (i = 0; i < fontset->nfont; i++)
-	{
-	  char *s;
-	  FcResult res;
-	  int spacing;
-          int variable;
-	  PangoFcFamily *temp_family;
+  _pango_fc_font_map_unlock (fcfontmap);
+}
 
-	  res = FcPatternGetString (fontset->fonts[i], FC_FAMILY, 0, (FcChar8 **)(void*)&s);
-	  g_assert (res == FcResultMatch);
+/**
+ * pango_fc_font_map_load_families_in_background:
+ * @fcfontmap: a `PangoFcFontMap`
+ *
+ * Starts finding the font families of @fcfontmap in a separate thread.
+ *
+ * Normally, the families are found the first time they are needed,
+ * which takes a while with large font configurations. After calling
+ * this function, the `GListModel` implementation of @fcfontmap lists
+ * the families as they are found, and emits [signal@Gio.ListModel::items-changed]
+ * for them in the thread-default main context of the caller.
+ * Functions that need all families, such as [method@Pango.FontMap.list_families],
+ * wait for the thread to finish.
+ *
+ * This function does nothing if the families have already been found.
+ *
+ * Since: 1.52
+ */
+void
+pango_fc_font_map_load_families_in_background (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv;
+  PangoFcFamilyLoader *loader;
 
-	  temp_family = g_hash_table_lookup (temp_family_hash, s);
-	  if (!is_alias_family (s) && !temp_family)
-	    {
-	      res = FcPatternGetInteger (fontset->fonts[i], FC_SPACING, 0, &spacing);
-	      g_assert (res == FcResultMatch || res == FcResultNoMatch);
-	      if (res == FcResultNoMatch)
-		spacing = FC_PROPORTIONAL;
-
-	      temp_family = create_family (fcfontmap, s, spacing);
-	      g_hash_table_insert (temp_family_hash, g_strdup (s), temp_family);
-	      priv->families[count++] = temp_family;
-	    }
+  g_return_if_fail (PANGO_IS_FC_FONT_MAP (fcfontmap));
 
-	  if (temp_family)
-	    {
-              variable = FALSE;
-              variable = FcPatternGetBool (fontset->fonts[i], FC_VARIABLE, 0, &variable);
-              if (variable)
-                temp_family->variable = TRUE;
+  priv = fcfontmap->priv;
 
-	      FcPatternReference (fontset->fonts[i]);
-	      FcFontSetAdd (temp_family->patterns, fontset->fonts[i]);
-	    }
-	}
+  _pango_fc_font_map_lock (fcfontmap);
 
-      FcFontSetDestroy (fontset);
-      g_hash_table_destroy (temp_family_hash);
+  if (priv->closed || priv->n_families >= 0)
+    {
+      _pango_fc_font_map_unlock (fcfontmap);
+      return;
+    }
 
-      priv->families[count++] = create_family (fcfontmap, "Sans", FC_PROPORTIONAL);
-      priv->families[count++] = create_family (fcfontmap, "Serif", FC_PROPORTIONAL);
-      priv->families[count++] = create_family (fcfontmap, "Monospace", FC_MONO);
-      priv->families[count++] = create_family (fcfontmap, "System-ui", FC_PROPORTIONAL);
+  loader = g_new0 (PangoFcFamilyLoader, 1);
+  loader->fontmap = fcfontmap;
+  if (priv->config)
+    loader->config = FcConfigReference (priv->config);
+  loader->context = g_main_context_ref_thread_default ();
+  loader->pending = g_ptr_array_new ();
 
-      priv->n_families = count;
-    }
+  /* The sort cache can be used from any thread. Sharing it keeps
+   * the thread from writing to the same file behind its back.
+   */
+  if (pango_fc_font_map_get_sort_cache (fcfontmap))
+    loader->sort_cache = pango_fc_sort_cache_ref (pango_fc_font_map_get_sort_cache (fcfontmap));
+
+  priv->loader = loader;
+  priv->n_families = 0;
+  priv->n_items = 0;
+
+  loader->thread = g_thread_new ("[pango] families", pango_fc_family_loader_run, loader);
+
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 static void
@@ -1754,6 +3133,8 @@ pango_fc_font_map_list_families (PangoFontMap      *fontmap,
   PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (fontmap);
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   if (priv->closed)
     {
       if (families)
@@ -1761,6 +3142,7 @@ pango_fc_font_map_list_families (PangoFontMap      *fontmap,
       if (n_families)
 	*n_families = 0;
 
+      _pango_fc_font_map_unlock (fcfontmap);
       return;
     }
 
@@ -1771,6 +3153,8 @@ pango_fc_font_map_list_families (PangoFontMap      *fontmap,
 
   if (families)
     *families = g_memdup2 (priv->families, priv->n_families * sizeof (PangoFontFamily *));
+
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 static PangoFontFamily *
@@ -1779,10 +3163,13 @@ pango_fc_font_map_get_family (PangoFontMap *fontmap,
 {
   PangoFcFontMap *fcfontmap = PANGO_FC_FONT_MAP (fontmap);
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  PangoFontFamily *result = NULL;
   int i;
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   if (priv->closed)
-    return NULL;
+    goto out;
 
   ensure_families (fcfontmap);
 
@@ -1790,10 +3177,16 @@ pango_fc_font_map_get_family (PangoFontMap *fontmap,
     {
       PangoFontFamily *family = PANGO_FONT_FAMILY (priv->families[i]);
       if (strcmp (name, pango_font_family_get_name (family)) == 0)
-        return family;
+        {
+          result = family;
+          break;
+        }
     }
 
-  return NULL;
+out:
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return result;
 }
 
 static double
@@ -1850,8 +3243,7 @@ static FcPattern *
 pango_fc_make_pattern (const  PangoFontDescription *description,
 		       PangoLanguage               *language,
 		       int                          pixel_size,
-		       double                       dpi,
-                       const char                  *variations)
+		       double                       dpi)
 {
   FcPattern *pattern;
   const char *prgname;
@@ -1892,9 +3284,6 @@ pango_fc_make_pattern (const  PangoFontDescription *description,
 			    FC_PIXEL_SIZE,  FcTypeDouble,  pixel_size / 1024.,
 			    NULL);
 
-  if (variations)
-    FcPatternAddString (pattern, FC_FONT_VARIATIONS, (FcChar8*) variations);
-
   if (pango_font_description_get_family (description))
     {
       families = g_strsplit (pango_font_description_get_family (description), ",", -1);
@@ -1968,6 +3357,53 @@ uniquify_pattern (PangoFcFontMap *fcfontmap,
     }
 }
 
+/* Whether @pattern is for a face with variation axes */
+static gboolean
+pattern_has_axes (FcPattern *pattern)
+{
+  FcBool variable;
+  int index;
+
+  if (FcPatternGetBool (pattern, FC_VARIABLE, 0, &variable) == FcResultMatch && variable)
+    return TRUE;
+
+  return FcPatternGetInteger (pattern, FC_INDEX, 0, &index) == FcResultMatch &&
+         (index >> 16) != 0;
+}
+
+/* Returns a new pattern for @match with @variations applied on top
+ * of the font variations that the configuration gave it. The backends
+ * only look at the first value, so we merge them into one string.
+ */
+static FcPattern *
+pango_fc_font_map_get_varied_pattern (PangoFcFontMap *fcfontmap,
+                                      FcPattern      *match,
+                                      const char     *variations)
+{
+  FcPattern *pattern;
+  GString *merged;
+  FcChar8 *s;
+  int i;
+
+  merged = g_string_new (NULL);
+  for (i = 0; FcPatternGetString (match, FC_FONT_VARIATIONS, i, &s) == FcResultMatch; i++)
+    {
+      if (*s == '\0')
+        continue;
+
+      g_string_append (merged, (const char *) s);
+      g_string_append_c (merged, ',');
+    }
+  g_string_append (merged, variations);
+
+  pattern = FcPatternDuplicate (match);
+  FcPatternDel (pattern, FC_FONT_VARIATIONS);
+  FcPatternAddString (pattern, FC_FONT_VARIATIONS, (const FcChar8 *) merged->str);
+  g_string_free (merged, TRUE);
+
+  return pattern;
+}
+
 static PangoFont *
 pango_fc_font_map_new_font (PangoFcFontMap    *fcfontmap,
 			    PangoFcFontsetKey *fontset_key,
@@ -1976,6 +3412,7 @@ pango_fc_font_map_new_font (PangoFcFontMap    *fcfontmap,
   PangoFcFontMapClass *class;
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
   FcPattern *pattern;
+  FcPattern *varied = NULL;
   PangoFcFont *fcfont;
   PangoFcFontKey key;
 
@@ -1986,10 +3423,22 @@ pango_fc_font_map_new_font (PangoFcFontMap    *fcfontmap,
 
   pango_fc_font_key_init (&key, fcfontmap, fontset_key, match);
 
+  /* Variations don't change faces without axes, so all
+   * instances share the font, and its caches, for them
+   */
+  if (key.variations && !pattern_has_axes (match))
+    key.variations = NULL;
+
   fcfont = g_hash_table_lookup (priv->font_hash, &key);
   if (fcfont)
     return g_object_ref (PANGO_FONT (fcfont));
 
+  /* There is no end to variation instances, so we don't
+   * uniquify their patterns. The key compares by match.
+   */
+  if (key.variations)
+    key.pattern = varied = pango_fc_font_map_get_varied_pattern (fcfontmap, match, key.variations);
+
   class = PANGO_FC_FONT_MAP_GET_CLASS (fcfontmap);
 
   if (class->create_font)
@@ -2009,7 +3458,7 @@ pango_fc_font_map_new_font (PangoFcFontMap    *fcfontmap,
       fc_matrix.yx = - pango_matrix->yx;
       fc_matrix.yy = pango_matrix->yy;
 
-      pattern = FcPatternDuplicate (match);
+      pattern = FcPatternDuplicate (key.pattern);
 
       for (i = 0; FcPatternGetMatrix (pattern, FC_MATRIX, i, &fc_matrix_val) == FcResultMatch; i++)
 	FcMatrixMultiply (&fc_matrix, &fc_matrix, fc_matrix_val);
@@ -2017,22 +3466,25 @@ pango_fc_font_map_new_font (PangoFcFontMap    *fcfontmap,
       FcPatternDel (pattern, FC_MATRIX);
       FcPatternAddMatrix (pattern, FC_MATRIX, &fc_matrix);
 
-      fcfont = class->new_font (fcfontmap, uniquify_pattern (fcfontmap, pattern));
+      fcfont = class->new_font (fcfontmap, varied ? pattern : uniquify_pattern (fcfontmap, pattern));
 
       FcPatternDestroy (pattern);
     }
 
-  if (!fcfont)
-    return NULL;
-
-  /* In case the backend didn't set the fontmap */
-  if (!fcfont->fontmap)
-    g_object_set (fcfont,
-		  "fontmap", fcfontmap,
-		  NULL);
+  if (fcfont)
+    {
+      /* In case the backend didn't set the fontmap */
+      if (!fcfont->fontmap)
+        g_object_set (fcfont,
+                      "fontmap", fcfontmap,
+                      NULL);
+
+      /* cache it on fontmap */
+      pango_fc_font_map_add (fcfontmap, &key, fcfont);
+    }
 
-  /* cache it on fontmap */
-  pango_fc_font_map_add (fcfontmap, &key, fcfont);
+  if (varied)
+    FcPatternDestroy (varied);
 
   return (PangoFont *)fcfont;
 }
@@ -2121,14 +3573,14 @@ pango_fc_font_map_get_resolution (PangoFcFontMap *fcfontmap,
   return fcfontmap->priv->dpi;
 }
 
+/* The variations are left out, see pango_fc_font_map_new_font() */
 static FcPattern *
 pango_fc_fontset_key_make_pattern (PangoFcFontsetKey *key)
 {
   return pango_fc_make_pattern (key->desc,
 				key->language,
 				key->pixelsize,
-				key->resolution,
-                                key->variations);
+				key->resolution);
 }
 
 static PangoFcPatterns *
@@ -2188,6 +3640,46 @@ pango_fc_font_map_load_font (PangoFontMap               *fontmap,
   return font;
 }
 
+static void
+pango_fc_fontset_cache_trim (PangoFcFontMap *fcfontmap,
+                             guint           max_length)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  GQueue *cache = priv->fontset_cache;
+
+  while (cache->length > max_length)
+    {
+      PangoFcFontset *tmp_fontset = g_queue_pop_tail (cache);
+      tmp_fontset->cache_link = NULL;
+      if (tmp_fontset->key->variations)
+        priv->n_varied_fontsets--;
+      g_hash_table_remove (priv->fontset_hash, tmp_fontset->key);
+    }
+}
+
+/* Drops the least recently used fontset with variations */
+static void
+pango_fc_fontset_cache_drop_varied (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  GQueue *cache = priv->fontset_cache;
+  GList *l;
+
+  for (l = cache->tail; l; l = l->prev)
+    {
+      PangoFcFontset *tmp_fontset = l->data;
+
+      if (tmp_fontset->key->variations)
+        {
+          g_queue_delete_link (cache, l);
+          tmp_fontset->cache_link = NULL;
+          priv->n_varied_fontsets--;
+          g_hash_table_remove (priv->fontset_hash, tmp_fontset->key);
+          break;
+        }
+    }
+}
+
 static void
 pango_fc_fontset_cache (PangoFcFontset *fontset,
 			PangoFcFontMap *fcfontmap)
@@ -2212,12 +3704,15 @@ pango_fc_fontset_cache (PangoFcFontset *fontset,
     {
       /* Add to cache initially
        */
-      if (cache->length == FONTSET_CACHE_SIZE)
-	{
-	  PangoFcFontset *tmp_fontset = g_queue_pop_tail (cache);
-	  tmp_fontset->cache_link = NULL;
-	  g_hash_table_remove (priv->fontset_hash, tmp_fontset->key);
-	}
+      if (fontset->key->variations)
+        {
+          if (priv->n_varied_fontsets >= MAX_VARIED_FONTSETS)
+            pango_fc_fontset_cache_drop_varied (fcfontmap);
+          priv->n_varied_fontsets++;
+        }
+
+      if (cache->length >= priv->max_fontsets)
+        pango_fc_fontset_cache_trim (fcfontmap, priv->max_fontsets - 1);
 
       fontset->cache_link = g_list_prepend (NULL, fontset);
     }
@@ -2238,6 +3733,8 @@ pango_fc_font_map_load_fontset (PangoFontMap                 *fontmap,
 
   pango_fc_fontset_key_init (&key, fcfontmap, context, desc, language);
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   fontset = g_hash_table_lookup (priv->fontset_hash, &key);
 
   if (G_UNLIKELY (!fontset))
@@ -2245,7 +3742,10 @@ pango_fc_font_map_load_fontset (PangoFontMap                 *fontmap,
       PangoFcPatterns *patterns = pango_fc_font_map_get_patterns (fontmap, &key);
 
       if (!patterns)
-	return NULL;
+        {
+          _pango_fc_font_map_unlock (fcfontmap);
+          return NULL;
+        }
 
       fontset = pango_fc_fontset_new (&key, patterns);
       g_hash_table_insert (priv->fontset_hash, pango_fc_fontset_get_key (fontset), fontset);
@@ -2253,12 +3753,180 @@ pango_fc_font_map_load_fontset (PangoFontMap                 *fontmap,
       pango_fc_patterns_unref (patterns);
     }
 
-  pango_fc_fontset_cache (fontset, fcfontmap);
-
-  pango_font_description_free (key.desc);
-  g_free (key.variations);
+  pango_fc_fontset_cache (fontset, fcfontmap);
+
+  g_object_ref (fontset);
+
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  pango_font_description_free (key.desc);
+  g_free (key.variations);
+
+  return PANGO_FONTSET (fontset);
+}
+
+/* Drops the uniquified patterns that none of our caches use anymore.
+ * Dropping one that is still used elsewhere is harmless, we only
+ * lose the chance to share it with new users.
+ */
+static void
+pango_fc_font_map_prune_patterns (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  GHashTable *used;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  used = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, priv->patterns_hash);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (used, key);
+
+  g_hash_table_iter_init (&iter, priv->chain_hash);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      PangoFcFontsetChain *chain = key;
+
+      g_hash_table_add (used, chain->pattern);
+    }
+
+  g_hash_table_iter_init (&iter, priv->font_hash);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      PangoFcFontKey *font_key = key;
+      PangoFcFont *fcfont = value;
+
+      g_hash_table_add (used, font_key->match);
+      g_hash_table_add (used, font_key->pattern);
+      g_hash_table_add (used, fcfont->font_pattern);
+    }
+
+  g_hash_table_iter_init (&iter, priv->pattern_hash);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (used, key))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_hash_table_destroy (used);
+}
+
+/**
+ * pango_fc_font_map_set_cache_limits:
+ * @fcfontmap: a `PangoFcFontMap`
+ * @max_fontsets: the maximum number of fontsets to keep cached,
+ *   or 0 to use the default
+ * @max_face_data_size: the approximate number of bytes to spend on
+ *   cached per-face data, or 0 for no limit
+ *
+ * Sets limits for the caches of @fcfontmap.
+ *
+ * Fontsets are cached in most-recently-used order, and the cached
+ * fontsets keep their fonts alive. Per-face data, such as coverage
+ * information and HarfBuzz faces, is dropped in least-recently-used
+ * order when its estimated size goes over @max_face_data_size,
+ * and recreated when it is needed again.
+ *
+ * The default is to cache 256 fontsets and not to limit the size
+ * of per-face data. Long-running processes that see many different
+ * fonts may want to set lower limits.
+ *
+ * The font patterns that @fcfontmap shares between fontsets and fonts
+ * don't count towards @max_face_data_size. They are only dropped by
+ * [method@PangoFc.FontMap.trim], once no cached fontset or font
+ * uses them anymore.
+ *
+ * Since: 1.52
+ */
+void
+pango_fc_font_map_set_cache_limits (PangoFcFontMap *fcfontmap,
+                                    guint           max_fontsets,
+                                    gsize           max_face_data_size)
+{
+  PangoFcFontMapPrivate *priv;
+
+  g_return_if_fail (PANGO_IS_FC_FONT_MAP (fcfontmap));
+
+  priv = fcfontmap->priv;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  priv->max_fontsets = max_fontsets != 0 ? max_fontsets : DEFAULT_MAX_FONTSETS;
+  priv->max_face_data_size = max_face_data_size;
+
+  if (priv->fontset_cache)
+    pango_fc_fontset_cache_trim (fcfontmap, priv->max_fontsets);
+
+  if (priv->max_face_data_size != 0)
+    pango_fc_font_face_data_trim (fcfontmap, priv->max_face_data_size, NULL);
+
+  _pango_fc_font_map_unlock (fcfontmap);
+}
+
+/**
+ * pango_fc_font_map_trim:
+ * @fcfontmap: a `PangoFcFontMap`
+ * @level: how much memory to release, from 0 to 255
+ *
+ * Releases cached data of @fcfontmap in response to memory pressure.
+ *
+ * The values of @level are meant to match those of
+ * `GMemoryMonitorWarningLevel`, so the level of a
+ * [signal@Gio.MemoryMonitor::low-memory-warning] can be passed
+ * on directly. Levels below 100 shrink the caches to half of their
+ * limits, higher levels empty them.
+ *
+ * This also drops the shared font patterns that no cached
+ * fontset or font uses anymore, at any level.
+ *
+ * Unlike [method@PangoFc.FontMap.cache_clear], this does not
+ * invalidate any fonts or fontsets, and does not cause the font
+ * map to emit a change notification. Fonts and fontsets that are
+ * still referenced elsewhere stay alive, and anything else is
+ * recreated when it is needed again.
+ *
+ * Since: 1.52
+ */
+void
+pango_fc_font_map_trim (PangoFcFontMap *fcfontmap,
+                        guint           level)
+{
+  PangoFcFontMapPrivate *priv;
+  guint max_fontsets;
+  gsize max_face_data_size;
+
+  g_return_if_fail (PANGO_IS_FC_FONT_MAP (fcfontmap));
+
+  priv = fcfontmap->priv;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  if (G_UNLIKELY (priv->closed))
+    {
+      _pango_fc_font_map_unlock (fcfontmap);
+      return;
+    }
+
+  if (level < 100)
+    {
+      max_fontsets = priv->max_fontsets / 2;
+      if (priv->max_face_data_size != 0)
+        max_face_data_size = priv->max_face_data_size / 2;
+      else
+        max_face_data_size = priv->face_data_size / 2;
+    }
+  else
+    {
+      max_fontsets = 0;
+      max_face_data_size = 0;
+    }
+
+  pango_fc_fontset_cache_trim (fcfontmap, max_fontsets);
+  pango_fc_font_face_data_trim (fcfontmap, max_face_data_size, NULL);
+  pango_fc_font_map_prune_patterns (fcfontmap);
 
-  return g_object_ref (PANGO_FONTSET (fontset));
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 /**
@@ -2282,7 +3950,12 @@ pango_fc_font_map_cache_clear (PangoFcFontMap *fcfontmap)
   if (G_UNLIKELY (fcfontmap->priv->closed))
     return;
 
-  removed = fcfontmap->priv->n_families;
+  _pango_fc_font_map_lock (fcfontmap);
+
+  if (fcfontmap->priv->n_items >= 0)
+    removed = fcfontmap->priv->n_items;
+  else
+    removed = fcfontmap->priv->n_families;
 
   pango_fc_font_map_fini (fcfontmap);
   pango_fc_font_map_init (fcfontmap);
@@ -2291,6 +3964,8 @@ pango_fc_font_map_cache_clear (PangoFcFontMap *fcfontmap)
 
   added = fcfontmap->priv->n_families;
 
+  _pango_fc_font_map_unlock (fcfontmap);
+
   g_list_model_items_changed (G_LIST_MODEL (fcfontmap), 0, removed, added);
   if (removed != added)
     g_object_notify (G_OBJECT (fcfontmap), "n-items");
@@ -2304,6 +3979,268 @@ pango_fc_font_map_changed (PangoFontMap *fontmap)
   /* we emit GListModel::changed in pango_fc_font_map_cache_clear() */
 }
 
+/* Whether the fonts in @added change the sort result of @pats.
+ *
+ * The result is trimmed, so a font only makes it in if it covers
+ * characters that the fonts ranked above it don't cover. Sorting
+ * the old result together with the new fonts gives the same answer
+ * for the new fonts as sorting all fonts: the old fonts that rank
+ * above a new one cover everything that the fonts dropped by the
+ * trim would cover. So the result changes if and only if one of the
+ * new fonts survives this smaller sort, either because it ranks
+ * higher than some old font for characters they both cover, or
+ * because it covers new characters.
+ */
+static gboolean
+pango_fc_patterns_affected_by (PangoFcPatterns *pats,
+                               FcConfig        *config,
+                               FcFontSet       *added)
+{
+  FcFontSet *sorted;
+  FcFontSet *fonts;
+  FcFontSet *resorted;
+  FcResult result;
+  gboolean affected = FALSE;
+  int i, j;
+
+  sorted = pango_fc_patterns_peek_fontset (pats);
+  if (!sorted)
+    return TRUE;
+
+  fonts = FcFontSetCreate ();
+  for (i = 0; i < sorted->nfont; i++)
+    {
+      FcPatternReference (sorted->fonts[i]);
+      FcFontSetAdd (fonts, sorted->fonts[i]);
+    }
+  for (i = 0; i < added->nfont; i++)
+    {
+      FcPatternReference (added->fonts[i]);
+      FcFontSetAdd (fonts, added->fonts[i]);
+    }
+
+  resorted = FcFontSetSort (config, &fonts, 1, pats->pattern, FcTrue, NULL, &result);
+  if (!resorted)
+    affected = TRUE;
+
+  for (i = 0; resorted && i < resorted->nfont && !affected; i++)
+    {
+      for (j = 0; j < added->nfont; j++)
+        {
+          if (resorted->fonts[i] == added->fonts[j])
+            {
+              affected = TRUE;
+              break;
+            }
+        }
+    }
+
+  if (resorted)
+    FcFontSetDestroy (resorted);
+  FcFontSetDestroy (fonts);
+
+  return affected;
+}
+
+/* Rebuilds the list of families after @added were added to the
+ * fonts, keeping the families that they don't change. Returns
+ * the range of changed list items.
+ */
+static void
+pango_fc_font_map_update_families (PangoFcFontMap *fcfontmap,
+                                   FcFontSet      *added,
+                                   guint          *position,
+                                   guint          *removed,
+                                   guint          *n_added)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  GHashTable *keep;
+  GPtrArray *families;
+  guint old_n, new_n;
+  guint prefix, suffix;
+  int i;
+
+  keep = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < priv->n_families; i++)
+    g_hash_table_insert (keep, priv->families[i]->family_name, priv->families[i]);
+  for (i = 0; i < added->nfont; i++)
+    {
+      const char *name = get_family_name (added->fonts[i]);
+
+      if (name)
+        g_hash_table_remove (keep, name);
+    }
+
+  families = pango_fc_font_map_build_families (fcfontmap, keep);
+
+  g_hash_table_destroy (keep);
+
+  old_n = priv->n_families;
+  new_n = families->len;
+
+  for (prefix = 0; prefix < MIN (old_n, new_n); prefix++)
+    {
+      if (priv->families[prefix] != g_ptr_array_index (families, prefix))
+        break;
+    }
+  for (suffix = 0; suffix < MIN (old_n, new_n) - prefix; suffix++)
+    {
+      if (priv->families[old_n - 1 - suffix] != g_ptr_array_index (families, new_n - 1 - suffix))
+        break;
+    }
+
+  for (i = 0; i < priv->n_families; i++)
+    g_object_unref (priv->families[i]);
+  g_free (priv->families);
+
+  priv->n_families = families->len;
+  priv->families = (PangoFcFamily **) g_ptr_array_free (families, FALSE);
+  if (priv->n_items >= 0)
+    priv->n_items = priv->n_families;
+
+  *position = prefix;
+  *removed = old_n - prefix - suffix;
+  *n_added = new_n - prefix - suffix;
+}
+
+/* Updates the caches of @fcfontmap for fonts that were added to its
+ * configuration. Only fontsets whose fonts the new ones could change
+ * are dropped; fonts, face data and the fontsets for other text stay.
+ * Returns %FALSE if fonts were removed, or if the fonts did not change
+ * at all, since then we don't know what did change.
+ */
+static gboolean
+pango_fc_font_map_add_fonts (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+  FcFontSet *sets[2];
+  FcFontSet *fonts;
+  FcFontSet *added;
+  GHashTable *old_fonts;
+  GHashTable *checked;
+  GHashTableIter iter;
+  FcConfig *config;
+  PangoFcPatterns *pats;
+  PangoFcFontset *fontset;
+  guint position = 0, removed = 0, n_added = 0;
+  gboolean families_built;
+  gboolean changed = FALSE;
+  int i;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  if (priv->closed || !priv->fonts || priv->loader)
+    {
+      _pango_fc_font_map_unlock (fcfontmap);
+      return FALSE;
+    }
+
+  sets[0] = FcConfigGetFonts (priv->config, 0);
+  sets[1] = FcConfigGetFonts (priv->config, 1);
+  fonts = filter_by_format (sets, 2);
+
+  old_fonts = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < priv->fonts->nfont; i++)
+    g_hash_table_add (old_fonts, priv->fonts->fonts[i]);
+
+  added = FcFontSetCreate ();
+  for (i = 0; i < fonts->nfont; i++)
+    {
+      if (!g_hash_table_remove (old_fonts, fonts->fonts[i]))
+        {
+          FcPatternReference (fonts->fonts[i]);
+          FcFontSetAdd (added, fonts->fonts[i]);
+        }
+    }
+
+  if (added->nfont == 0 || g_hash_table_size (old_fonts) > 0)
+    {
+      g_hash_table_destroy (old_fonts);
+      FcFontSetDestroy (added);
+      FcFontSetDestroy (fonts);
+      _pango_fc_font_map_unlock (fcfontmap);
+      return FALSE;
+    }
+
+  g_hash_table_destroy (old_fonts);
+
+  config = pango_fc_font_map_get_config (fcfontmap);
+
+  /* Forget the sort results that the new fonts change. This covers
+   * the patterns of fontsets that were evicted from the cache but are
+   * still in use, and of sorts that are still queued.
+   */
+  checked = g_hash_table_new (NULL, NULL);
+  g_hash_table_iter_init (&iter, priv->patterns_hash);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pats))
+    {
+      gboolean affected;
+
+      affected = pango_fc_patterns_affected_by (pats, config, added);
+      g_hash_table_insert (checked, pats, GINT_TO_POINTER (affected));
+
+      if (affected)
+        {
+          g_hash_table_iter_remove (&iter);
+          changed = TRUE;
+        }
+    }
+
+  /* Drop the cached fontsets that use them */
+  g_hash_table_iter_init (&iter, priv->fontset_hash);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &fontset))
+    {
+      gpointer affected;
+
+      pats = fontset->patterns;
+      if (!g_hash_table_lookup_extended (checked, pats, NULL, &affected))
+        {
+          /* Already gone from the patterns hash */
+          affected = GINT_TO_POINTER (pango_fc_patterns_affected_by (pats, config, added));
+          g_hash_table_insert (checked, pats, affected);
+        }
+
+      if (!affected)
+        continue;
+
+      if (fontset->cache_link)
+        {
+          g_queue_delete_link (priv->fontset_cache, fontset->cache_link);
+          fontset->cache_link = NULL;
+          if (fontset->key->variations)
+            priv->n_varied_fontsets--;
+        }
+
+      g_hash_table_iter_remove (&iter);
+      changed = TRUE;
+    }
+  g_hash_table_destroy (checked);
+
+  /* Sort cache positions refer to the old fonts */
+  FcFontSetDestroy (priv->fonts);
+  priv->fonts = fonts;
+  g_clear_pointer (&priv->sort_cache, pango_fc_sort_cache_unref);
+  priv->sort_cache_checked = FALSE;
+
+  families_built = priv->n_families >= 0;
+  if (families_built)
+    pango_fc_font_map_update_families (fcfontmap, added, &position, &removed, &n_added);
+
+  FcFontSetDestroy (added);
+
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  if (removed > 0 || n_added > 0)
+    g_list_model_items_changed (G_LIST_MODEL (fcfontmap), position, removed, n_added);
+  if (removed != n_added)
+    g_object_notify (G_OBJECT (fcfontmap), "n-items");
+
+  if (changed)
+    pango_font_map_changed (PANGO_FONT_MAP (fcfontmap));
+
+  return TRUE;
+}
+
 /**
  * pango_fc_font_map_config_changed:
  * @fcfontmap: a `PangoFcFontMap`
@@ -2311,16 +4248,24 @@ pango_fc_font_map_changed (PangoFontMap *fontmap)
  * Informs font map that the fontconfig configuration (i.e., FcConfig
  * object) used by this font map has changed.
  *
- * This currently calls [method@PangoFc.FontMap.cache_clear] which
- * ensures that list of fonts, etc will be regenerated using the
- * updated configuration.
+ * If fonts were only added to the configuration, for example with
+ * FcConfigAppFontAddFile(), this keeps the fonts and fontsets that
+ * the new fonts can't change, and only notifies the users of the
+ * font map if some did change. Otherwise, it calls
+ * [method@PangoFc.FontMap.cache_clear] which ensures that list of
+ * fonts, etc will be regenerated using the updated configuration.
+ *
+ * If the configuration changed in other ways along with new fonts
+ * being added, such as new substitution rules, call
+ * [method@PangoFc.FontMap.cache_clear] instead.
  *
  * Since: 1.38
  */
 void
 pango_fc_font_map_config_changed (PangoFcFontMap *fcfontmap)
 {
-  pango_fc_font_map_cache_clear (fcfontmap);
+  if (!pango_fc_font_map_add_fonts (fcfontmap))
+    pango_fc_font_map_cache_clear (fcfontmap);
 }
 
 /**
@@ -2355,6 +4300,8 @@ pango_fc_font_map_set_config (PangoFcFontMap *fcfontmap,
 
   g_return_if_fail (PANGO_IS_FC_FONT_MAP (fcfontmap));
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   oldconfig = fcfontmap->priv->config;
 
   if (fcconfig)
@@ -2363,6 +4310,10 @@ pango_fc_font_map_set_config (PangoFcFontMap *fcfontmap,
   fcfontmap->priv->config = fcconfig;
 
   g_clear_pointer (&fcfontmap->priv->fonts, FcFontSetDestroy);
+  g_clear_pointer (&fcfontmap->priv->sort_cache, pango_fc_sort_cache_unref);
+  fcfontmap->priv->sort_cache_checked = FALSE;
+
+  _pango_fc_font_map_unlock (fcfontmap);
 
   if (oldconfig != fcconfig)
     pango_fc_font_map_config_changed (fcfontmap);
@@ -2412,6 +4363,94 @@ pango_fc_font_map_get_config_fonts (PangoFcFontMap *fcfontmap)
   return fcfontmap->priv->fonts;
 }
 
+/* The sort cache is opt-in, see pangofc-sort-cache.c */
+static PangoFcSortCache *
+pango_fc_font_map_get_sort_cache (PangoFcFontMap *fcfontmap)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+
+  if (!priv->sort_cache_checked)
+    {
+      priv->sort_cache = pango_fc_sort_cache_new (pango_fc_font_map_get_config (fcfontmap),
+                                                  pango_fc_font_map_get_config_fonts (fcfontmap));
+      priv->sort_cache_checked = TRUE;
+    }
+
+  return priv->sort_cache;
+}
+
+/* Drops the coverage and hb_face of @data. Fonts that already use
+ * them hold their own references, and both are recreated on demand.
+ *
+ * An hb_face that pango_fc_font_map_get_hb_face() returned is pinned;
+ * callers don't own a reference to it, so it stays until the face data
+ * itself goes away.
+ */
+static void
+pango_fc_font_face_data_drop (PangoFcFontMap      *fcfontmap,
+                              PangoFcFontFaceData *data)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+
+  g_clear_object (&data->coverage);
+
+  if (data->hb_face && !data->hb_face_pinned)
+    {
+      pango_fc_shared_face_release_hb_face (data->shared);
+      data->hb_face = NULL;
+    }
+
+  priv->face_data_size -= data->size;
+  data->size = 0;
+
+  if (data->lru_link.data)
+    {
+      g_queue_unlink (&priv->face_data_lru, &data->lru_link);
+      data->lru_link.data = NULL;
+    }
+}
+
+static void
+pango_fc_font_face_data_trim (PangoFcFontMap      *fcfontmap,
+                              gsize                max_size,
+                              PangoFcFontFaceData *keep)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+
+  while (priv->face_data_size > max_size && priv->face_data_lru.tail)
+    {
+      PangoFcFontFaceData *data = priv->face_data_lru.tail->data;
+
+      if (data == keep)
+        break;
+
+      pango_fc_font_face_data_drop (fcfontmap, data);
+    }
+}
+
+/* Accounts @size more bytes to @data, and evicts the least recently
+ * used face data if that takes us over budget.
+ */
+static void
+pango_fc_font_face_data_add_size (PangoFcFontMap      *fcfontmap,
+                                  PangoFcFontFaceData *data,
+                                  gsize                size)
+{
+  PangoFcFontMapPrivate *priv = fcfontmap->priv;
+
+  data->size += size;
+  priv->face_data_size += size;
+
+  if (!data->lru_link.data)
+    {
+      data->lru_link.data = data;
+      g_queue_push_head_link (&priv->face_data_lru, &data->lru_link);
+    }
+
+  if (priv->max_face_data_size != 0)
+    pango_fc_font_face_data_trim (fcfontmap, priv->max_face_data_size, data);
+}
+
 static PangoFcFontFaceData *
 pango_fc_font_map_get_font_face_data (PangoFcFontMap *fcfontmap,
 				      FcPattern      *font_pattern)
@@ -2428,7 +4467,15 @@ pango_fc_font_map_get_font_face_data (PangoFcFontMap *fcfontmap,
 
   data = g_hash_table_lookup (priv->font_face_data_hash, &key);
   if (G_LIKELY (data))
-    return data;
+    {
+      if (data->lru_link.data && priv->face_data_lru.head != &data->lru_link)
+        {
+          g_queue_unlink (&priv->face_data_lru, &data->lru_link);
+          g_queue_push_head_link (&priv->face_data_lru, &data->lru_link);
+        }
+
+      return data;
+    }
 
   data = g_slice_new0 (PangoFcFontFaceData);
   data->filename = key.filename;
@@ -2437,6 +4484,8 @@ pango_fc_font_map_get_font_face_data (PangoFcFontMap *fcfontmap,
   data->pattern = font_pattern;
   FcPatternReference (data->pattern);
 
+  data->shared = pango_fc_shared_face_get (data->filename, data->id);
+
   g_hash_table_insert (priv->font_face_data_hash, data, data);
 
   return data;
@@ -2507,6 +4556,27 @@ pango_fc_coverage_finalize (GObject *object)
   G_OBJECT_CLASS (pango_fc_coverage_parent_class)->finalize (object);
 }
 
+/* Fills @map with the coverage of the 256 codepoints starting at
+ * @start, with a single lookup in the charset. Returns FALSE if
+ * @coverage is not a PangoFcCoverage.
+ */
+static gboolean
+pango_fc_coverage_get_page (PangoCoverage *coverage,
+                            FcChar32       start,
+                            FcChar32       map[FC_CHARSET_MAP_SIZE])
+{
+  FcChar32 next = start;
+
+  if (G_OBJECT_TYPE (coverage) != pango_fc_coverage_get_type ())
+    return FALSE;
+
+  /* This finds the first page at or after start */
+  if (FcCharSetNextPage (((PangoFcCoverage *) coverage)->charset, map, &next) != start)
+    memset (map, 0, sizeof (FcChar32) * FC_CHARSET_MAP_SIZE);
+
+  return TRUE;
+}
+
 static void
 pango_fc_coverage_class_init (PangoFcCoverageClass *class)
 {
@@ -2520,16 +4590,22 @@ pango_fc_coverage_class_init (PangoFcCoverageClass *class)
   coverage_class->copy = pango_fc_coverage_real_copy;
 }
 
-PangoCoverage *
-_pango_fc_font_map_get_coverage (PangoFcFontMap *fcfontmap,
-				 PangoFcFont    *fcfont)
+/* Returns the coverage of the face that @font_pattern refers to,
+ * without loading a font
+ */
+static PangoCoverage *
+pango_fc_font_map_get_pattern_coverage (PangoFcFontMap *fcfontmap,
+                                        FcPattern      *font_pattern)
 {
   PangoFcFontFaceData *data;
+  PangoCoverage *coverage = NULL;
   FcCharSet *charset;
 
-  data = pango_fc_font_map_get_font_face_data (fcfontmap, fcfont->font_pattern);
+  _pango_fc_font_map_lock (fcfontmap);
+
+  data = pango_fc_font_map_get_font_face_data (fcfontmap, font_pattern);
   if (G_UNLIKELY (!data))
-    return NULL;
+    goto out;
 
   if (G_UNLIKELY (data->coverage == NULL))
     {
@@ -2537,13 +4613,30 @@ _pango_fc_font_map_get_coverage (PangoFcFontMap *fcfontmap,
        * Pull the coverage out of the pattern, this
        * doesn't require loading the font
        */
-      if (FcPatternGetCharSet (fcfont->font_pattern, FC_CHARSET, 0, &charset) != FcResultMatch)
-        return NULL;
+      if (FcPatternGetCharSet (font_pattern, FC_CHARSET, 0, &charset) != FcResultMatch)
+        goto out;
+
+      data->coverage = pango_fc_shared_face_get_coverage (data->shared, charset);
 
-      data->coverage = _pango_fc_font_map_fc_to_coverage (charset);
+      /* A rough estimate of the bitmap leaves in the charset */
+      pango_fc_font_face_data_add_size (fcfontmap, data,
+                                        sizeof (PangoFcCoverage) +
+                                        FcCharSetCount (charset) / 8);
     }
 
-  return g_object_ref (data->coverage);
+  coverage = g_object_ref (data->coverage);
+
+out:
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return coverage;
+}
+
+PangoCoverage *
+_pango_fc_font_map_get_coverage (PangoFcFontMap *fcfontmap,
+				 PangoFcFont    *fcfont)
+{
+  return pango_fc_font_map_get_pattern_coverage (fcfontmap, fcfont->font_pattern);
 }
 
 /**
@@ -2600,11 +4693,14 @@ _pango_fc_font_map_get_languages (PangoFcFontMap *fcfontmap,
                                   PangoFcFont    *fcfont)
 {
   PangoFcFontFaceData *data;
+  PangoLanguage **languages = NULL;
   FcLangSet *langset;
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   data = pango_fc_font_map_get_font_face_data (fcfontmap, fcfont->font_pattern);
   if (G_UNLIKELY (!data))
-    return NULL;
+    goto out;
 
   if (G_UNLIKELY (data->languages == NULL))
     {
@@ -2613,12 +4709,17 @@ _pango_fc_font_map_get_languages (PangoFcFontMap *fcfontmap,
        * doesn't require loading the font
        */
       if (FcPatternGetLangSet (fcfont->font_pattern, FC_LANG, 0, &langset) != FcResultMatch)
-        return NULL;
+        goto out;
 
       data->languages = _pango_fc_font_map_fc_to_languages (langset);
     }
 
-  return data->languages;
+  languages = data->languages;
+
+out:
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return languages;
 }
 
 /**
@@ -2679,8 +4780,13 @@ pango_fc_font_map_shutdown (PangoFcFontMap *fcfontmap)
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
   int i;
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   if (priv->closed)
-    return;
+    {
+      _pango_fc_font_map_unlock (fcfontmap);
+      return;
+    }
 
   g_hash_table_foreach (priv->font_hash, (GHFunc) shutdown_font, fcfontmap);
   for (i = 0; i < priv->n_families; i++)
@@ -2700,6 +4806,8 @@ pango_fc_font_map_shutdown (PangoFcFontMap *fcfontmap)
     }
 
   priv->closed = TRUE;
+
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 static PangoWeight
@@ -3214,6 +5322,8 @@ ensure_faces (PangoFcFamily *fcfamily)
   PangoFcFontMap *fcfontmap = fcfamily->fontmap;
   PangoFcFontMapPrivate *priv = fcfontmap->priv;
 
+  _pango_fc_font_map_lock (fcfontmap);
+
   if (fcfamily->n_faces < 0)
     {
       FcFontSet *fontset;
@@ -3341,6 +5451,8 @@ ensure_faces (PangoFcFamily *fcfamily)
 	  fcfamily->faces = faces;
 	}
     }
+
+  _pango_fc_font_map_unlock (fcfontmap);
 }
 
 static void
@@ -3454,6 +5566,34 @@ pango_fc_family_init (PangoFcFamily *fcfamily)
   fcfamily->n_faces = -1;
 }
 
+/* Called with the fontmap lock held */
+static hb_face_t *
+pango_fc_font_map_ensure_hb_face (PangoFcFontMap *fcfontmap,
+                                  PangoFcFont    *fcfont,
+                                  gboolean        pin)
+{
+  PangoFcFontFaceData *data;
+
+  data = pango_fc_font_map_get_font_face_data (fcfontmap, fcfont->font_pattern);
+
+  if (!data->hb_face)
+    {
+      hb_blob_t *blob;
+
+      data->hb_face = pango_fc_shared_face_acquire_hb_face (data->shared);
+
+      blob = hb_face_reference_blob (data->hb_face);
+      pango_fc_font_face_data_add_size (fcfontmap, data,
+                                        hb_blob_get_length (blob));
+      hb_blob_destroy (blob);
+    }
+
+  if (pin)
+    data->hb_face_pinned = TRUE;
+
+  return data->hb_face;
+}
+
 /**
  * pango_fc_font_map_get_hb_face: (skip)
  * @fcfontmap: a `PangoFcFontMap`
@@ -3470,18 +5610,39 @@ hb_face_t *
 pango_fc_font_map_get_hb_face (PangoFcFontMap *fcfontmap,
                                PangoFcFont    *fcfont)
 {
-  PangoFcFontFaceData *data;
+  hb_face_t *hb_face;
 
-  data = pango_fc_font_map_get_font_face_data (fcfontmap, fcfont->font_pattern);
+  _pango_fc_font_map_lock (fcfontmap);
 
-  if (!data->hb_face)
-    {
-      hb_blob_t *blob;
+  /* The caller gets no reference, so never evict this one */
+  hb_face = pango_fc_font_map_ensure_hb_face (fcfontmap, fcfont, TRUE);
 
-      blob = hb_blob_create_from_file (data->filename);
-      data->hb_face = hb_face_create (blob, data->id);
-      hb_blob_destroy (blob);
-    }
+  _pango_fc_font_map_unlock (fcfontmap);
 
-  return data->hb_face;
+  return hb_face;
+}
+
+/*
+ * _pango_fc_font_map_ref_hb_face:
+ * @fcfontmap: a `PangoFcFontMap`
+ * @fcfont: a `PangoFcFont`
+ *
+ * Like pango_fc_font_map_get_hb_face(), but takes a reference,
+ * so the face can still be evicted from the fontmap's caches.
+ *
+ * Returns: (transfer full): the `hb_face_t` for the given font
+ */
+hb_face_t *
+_pango_fc_font_map_ref_hb_face (PangoFcFontMap *fcfontmap,
+                                PangoFcFont    *fcfont)
+{
+  hb_face_t *hb_face;
+
+  _pango_fc_font_map_lock (fcfontmap);
+
+  hb_face = hb_face_reference (pango_fc_font_map_ensure_hb_face (fcfontmap, fcfont, FALSE));
+
+  _pango_fc_font_map_unlock (fcfontmap);
+
+  return hb_face;
 }
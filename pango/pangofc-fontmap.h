@@ -55,6 +55,16 @@ GType pango_fc_font_map_get_type (void) G_GNUC_CONST;
 PANGO_AVAILABLE_IN_1_4
 void           pango_fc_font_map_cache_clear    (PangoFcFontMap *fcfontmap);
 
+PANGO_AVAILABLE_IN_1_52
+void           pango_fc_font_map_set_cache_limits (PangoFcFontMap *fcfontmap,
+                                                   guint           max_fontsets,
+                                                   gsize           max_face_data_size);
+PANGO_AVAILABLE_IN_1_52
+void           pango_fc_font_map_trim           (PangoFcFontMap *fcfontmap,
+                                                 guint           level);
+PANGO_AVAILABLE_IN_1_52
+void           pango_fc_font_map_load_families_in_background (PangoFcFontMap *fcfontmap);
+
 PANGO_AVAILABLE_IN_1_38
 void
 pango_fc_font_map_config_changed (PangoFcFontMap *fcfontmap);
@@ -55,9 +55,20 @@ void _pango_fc_font_shutdown (PangoFcFont *fcfont);
 
 void           _pango_fc_font_map_remove          (PangoFcFontMap *fcfontmap,
 						   PangoFcFont    *fcfont);
+void           _pango_fc_font_map_forget          (PangoFcFontMap *fcfontmap,
+						   PangoFcFont    *fcfont);
+
+_PANGO_EXTERN
+void           _pango_fc_font_map_lock            (PangoFcFontMap *fcfontmap);
+_PANGO_EXTERN
+void           _pango_fc_font_map_unlock          (PangoFcFontMap *fcfontmap);
+_PANGO_EXTERN
+gboolean       _pango_fc_font_map_is_thread_safe  (PangoFcFontMap *fcfontmap);
 
 PangoCoverage *_pango_fc_font_map_get_coverage    (PangoFcFontMap *fcfontmap,
 						   PangoFcFont    *fcfont);
+hb_face_t     *_pango_fc_font_map_ref_hb_face     (PangoFcFontMap *fcfontmap,
+						   PangoFcFont    *fcfont);
 PangoCoverage  *_pango_fc_font_map_fc_to_coverage (FcCharSet      *charset);
 
 PangoFcDecoder *_pango_fc_font_get_decoder       (PangoFcFont    *font);
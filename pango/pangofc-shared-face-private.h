@@ -0,0 +1,43 @@
+/* Pango
+ * pangofc-shared-face-private.h: Per-face data shared between fontmaps
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PANGOFC_SHARED_FACE_PRIVATE_H__
+#define __PANGOFC_SHARED_FACE_PRIVATE_H__
+
+#include <glib.h>
+#include <hb.h>
+#include <fontconfig/fontconfig.h>
+
+#include <pango/pango-coverage.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PangoFcSharedFace PangoFcSharedFace;
+
+PangoFcSharedFace *pango_fc_shared_face_get             (const char        *filename,
+                                                         int                id);
+void               pango_fc_shared_face_unref           (PangoFcSharedFace *face);
+
+hb_face_t *        pango_fc_shared_face_acquire_hb_face (PangoFcSharedFace *face);
+void               pango_fc_shared_face_release_hb_face (PangoFcSharedFace *face);
+
+PangoCoverage *    pango_fc_shared_face_get_coverage    (PangoFcSharedFace *face,
+                                                         FcCharSet         *charset);
+
+G_END_DECLS
+
+#endif /* __PANGOFC_SHARED_FACE_PRIVATE_H__ */
@@ -0,0 +1,256 @@
+/* Pango
+ * pangofc-shared-face.c: Per-face data shared between fontmaps
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "pangofc-shared-face-private.h"
+#include "pangofc-private.h"
+
+/* Data that only depends on the font file and face index is the
+ * same for every fontmap in the process, and fontmaps are often
+ * per-thread. So the hb_face_t and the coverage of each face are
+ * kept here, once, and handed out to all fontmaps.
+ *
+ * Everything is protected by a single lock. Each fontmap holds a
+ * reference on the entries of the faces it uses, and entries are
+ * removed when the last reference goes away.
+ *
+ * The hb_face_t is owned by the entry for as long as some fontmap
+ * uses it. Fonts reference it through their hb_font_t, so dropping
+ * it here never pulls it from under them. The entry forgets the face
+ * with the lock held, and only then drops its reference, outside the
+ * lock; so a face handed out from the table is always alive.
+ *
+ * The coverage is only weakly referenced; the fontmaps hold it
+ * alive. A configuration may edit the charset of a face, in which
+ * case its fontmap gets a private coverage.
+ */
+
+struct _PangoFcSharedFace
+{
+  char *filename;
+  int id;
+
+  int ref_count;
+
+  hb_face_t *hb_face;
+  int hb_face_users;
+
+  FcCharSet *charset;
+  GWeakRef coverage;
+};
+
+static GHashTable *shared_faces;
+G_LOCK_DEFINE_STATIC (shared_faces);
+
+static guint
+shared_face_hash (gconstpointer v)
+{
+  const PangoFcSharedFace *face = v;
+
+  return g_str_hash (face->filename) ^ face->id;
+}
+
+static gboolean
+shared_face_equal (gconstpointer v1,
+                   gconstpointer v2)
+{
+  const PangoFcSharedFace *face1 = v1;
+  const PangoFcSharedFace *face2 = v2;
+
+  return face1->id == face2->id && strcmp (face1->filename, face2->filename) == 0;
+}
+
+/*
+ * pango_fc_shared_face_get:
+ * @filename: the font file
+ * @id: the face index in @filename
+ *
+ * Returns: (transfer full): the shared data for the face
+ */
+PangoFcSharedFace *
+pango_fc_shared_face_get (const char *filename,
+                          int         id)
+{
+  PangoFcSharedFace key, *face;
+
+  key.filename = (char *) filename;
+  key.id = id;
+
+  G_LOCK (shared_faces);
+
+  if (G_UNLIKELY (shared_faces == NULL))
+    shared_faces = g_hash_table_new (shared_face_hash, shared_face_equal);
+
+  face = g_hash_table_lookup (shared_faces, &key);
+  if (face == NULL)
+    {
+      face = g_new0 (PangoFcSharedFace, 1);
+      face->filename = g_strdup (filename);
+      face->id = id;
+      g_weak_ref_init (&face->coverage, NULL);
+      g_hash_table_add (shared_faces, face);
+    }
+
+  face->ref_count++;
+
+  G_UNLOCK (shared_faces);
+
+  return face;
+}
+
+void
+pango_fc_shared_face_unref (PangoFcSharedFace *face)
+{
+  G_LOCK (shared_faces);
+
+  face->ref_count--;
+  if (face->ref_count > 0)
+    {
+      G_UNLOCK (shared_faces);
+      return;
+    }
+
+  g_hash_table_remove (shared_faces, face);
+
+  G_UNLOCK (shared_faces);
+
+  g_assert (face->hb_face_users == 0);
+  g_weak_ref_clear (&face->coverage);
+  if (face->charset)
+    FcCharSetDestroy (face->charset);
+  g_free (face->filename);
+  g_free (face);
+}
+
+/*
+ * pango_fc_shared_face_acquire_hb_face:
+ * @face: a `PangoFcSharedFace`
+ *
+ * Registers the caller as a user of the hb_face_t for @face,
+ * creating it if needed. It stays alive until the caller calls
+ * pango_fc_shared_face_release_hb_face().
+ *
+ * Returns: (transfer none): the hb_face_t
+ */
+hb_face_t *
+pango_fc_shared_face_acquire_hb_face (PangoFcSharedFace *face)
+{
+  hb_face_t *hb_face;
+
+  G_LOCK (shared_faces);
+
+  if (face->hb_face)
+    {
+      face->hb_face_users++;
+      hb_face = face->hb_face;
+      G_UNLOCK (shared_faces);
+
+      return hb_face;
+    }
+
+  G_UNLOCK (shared_faces);
+
+  /* Don't hold the lock while loading the file */
+  {
+    hb_blob_t *blob;
+
+    blob = hb_blob_create_from_file (face->filename);
+    hb_face = hb_face_create (blob, face->id);
+    hb_blob_destroy (blob);
+
+    hb_face_make_immutable (hb_face);
+  }
+
+  G_LOCK (shared_faces);
+
+  if (face->hb_face)
+    {
+      /* Somebody beat us to it */
+      hb_face_destroy (hb_face);
+      hb_face = face->hb_face;
+    }
+  else
+    face->hb_face = hb_face;
+
+  face->hb_face_users++;
+
+  G_UNLOCK (shared_faces);
+
+  return hb_face;
+}
+
+void
+pango_fc_shared_face_release_hb_face (PangoFcSharedFace *face)
+{
+  hb_face_t *hb_face = NULL;
+
+  G_LOCK (shared_faces);
+
+  g_assert (face->hb_face_users > 0);
+
+  face->hb_face_users--;
+  if (face->hb_face_users == 0)
+    {
+      hb_face = face->hb_face;
+      face->hb_face = NULL;
+    }
+
+  G_UNLOCK (shared_faces);
+
+  /* Nobody can acquire it anymore */
+  hb_face_destroy (hb_face);
+}
+
+/*
+ * pango_fc_shared_face_get_coverage:
+ * @face: a `PangoFcSharedFace`
+ * @charset: the charset of the face
+ *
+ * Returns: (transfer full): the coverage for @charset, shared
+ *   with other fontmaps if they agree on it
+ */
+PangoCoverage *
+pango_fc_shared_face_get_coverage (PangoFcSharedFace *face,
+                                   FcCharSet         *charset)
+{
+  PangoCoverage *coverage;
+
+  G_LOCK (shared_faces);
+
+  if (face->charset == NULL)
+    face->charset = FcCharSetCopy (charset);
+  else if (face->charset != charset &&
+           !FcCharSetEqual (face->charset, charset))
+    {
+      G_UNLOCK (shared_faces);
+      return _pango_fc_font_map_fc_to_coverage (charset);
+    }
+
+  coverage = g_weak_ref_get (&face->coverage);
+  if (coverage == NULL)
+    {
+      coverage = _pango_fc_font_map_fc_to_coverage (face->charset);
+      g_weak_ref_set (&face->coverage, coverage);
+    }
+
+  G_UNLOCK (shared_faces);
+
+  return coverage;
+}
@@ -0,0 +1,45 @@
+/* Pango
+ * pangofc-sort-cache-private.h: On-disk cache of FcFontSort() results
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PANGOFC_SORT_CACHE_PRIVATE_H__
+#define __PANGOFC_SORT_CACHE_PRIVATE_H__
+
+#include <glib.h>
+#include <fontconfig/fontconfig.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PangoFcSortCache PangoFcSortCache;
+
+PangoFcSortCache *pango_fc_sort_cache_new    (FcConfig         *config,
+                                              FcFontSet        *fonts);
+PangoFcSortCache *pango_fc_sort_cache_ref    (PangoFcSortCache *cache);
+void              pango_fc_sort_cache_unref  (PangoFcSortCache *cache);
+
+FcFontSet *       pango_fc_sort_cache_lookup (PangoFcSortCache *cache,
+                                              FcPattern        *pattern);
+void              pango_fc_sort_cache_add    (PangoFcSortCache *cache,
+                                              FcPattern        *pattern,
+                                              FcFontSet        *sorted);
+
+FcFontSet *       pango_fc_sort_cache_lookup_families (PangoFcSortCache *cache);
+void              pango_fc_sort_cache_add_families    (PangoFcSortCache *cache,
+                                                       FcFontSet        *grouped);
+
+G_END_DECLS
+
+#endif /* __PANGOFC_SORT_CACHE_PRIVATE_H__ */
@@ -0,0 +1,686 @@
+/* Pango
+ * pangofc-sort-cache.c: On-disk cache of FcFontSort() results
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#include "pangofc-sort-cache-private.h"
+
+/* Sorting the fonts of a large configuration for a pattern takes
+ * a while, and short-lived processes do it over and over for the
+ * same patterns. If the PANGO_FC_SORT_CACHE environment variable
+ * is set, we keep the results in a file, either the one it names,
+ * or $XDG_CACHE_HOME/pango/fc-sort.cache.
+ *
+ * The results are stored as positions in the font set of the
+ * configuration, so the file starts with a fingerprint of that
+ * font set and of the fontconfig cache directories. If they don't
+ * match, the file is ignored, and replaced once we have a result
+ * to store.
+ *
+ * After the header, the file is a sequence of records, which are
+ * appended as new results come in. Each record holds a key built
+ * from the exact values of the search pattern, and the positions
+ * of the sorted fonts. Reading stops at the first record that
+ * doesn't check out, so a truncated or garbled file only loses the
+ * records at its end. The checksums of the records cover the
+ * fingerprint too, so records never load for other fonts.
+ *
+ * Other processes may replace the file while we use it, so we
+ * check its header again under a lock before appending to it.
+ *
+ * One extra record holds the fonts of the configuration grouped
+ * by family, which is what listing the families needs.
+ */
+
+#define CACHE_MAGIC "PANGOFCS"
+#define CACHE_VERSION 2
+
+/* The keys of patterns are empty or start with a colon,
+ * see pattern_key(), so this can't clash with any of them.
+ */
+#define FAMILIES_KEY "\\families"
+
+/* Don't grow the file forever */
+#define MAX_CACHE_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+  char magic[8];
+  guint32 version;
+  guint32 n_fonts;
+  guint8 fingerprint[32];
+} CacheHeader;
+
+typedef struct {
+  guint32 key_len;  /* Including the terminating zeros, a multiple of 4 */
+  guint32 n_fonts;
+  guint32 checksum;
+  guint32 reserved;
+} RecordHeader;
+
+typedef struct {
+  guint n_fonts;
+  const guint32 *fonts;
+  guint32 *owned_fonts;
+} Entry;
+
+struct _PangoFcSortCache {
+  char *filename;
+  CacheHeader header;
+
+  FcFontSet *fonts;
+  GHashTable *font_index;  /* FcPattern -> position + 1 */
+
+  /* The entries are read from the mapped file, and added to
+   * from the threads that do the sorting, under the mutex.
+   */
+  GMutex mutex;
+  GMappedFile *mapped;
+  GHashTable *entries;  /* pattern key -> Entry */
+  guint header_written : 1;
+};
+
+static void
+entry_free (gpointer data)
+{
+  Entry *entry = data;
+
+  g_free (entry->owned_fonts);
+  g_free (entry);
+}
+
+static guint32
+record_checksum (const CacheHeader *header,
+                 const char        *key,
+                 guint              key_len,
+                 const guint32     *fonts,
+                 guint              n_fonts)
+{
+  guint32 hash = 2166136261u;
+  const guchar *p;
+  guint i;
+
+  for (p = header->fingerprint, i = 0; i < sizeof (header->fingerprint); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+
+  for (p = (const guchar *) key, i = 0; i < key_len; i++)
+    hash = (hash ^ p[i]) * 16777619u;
+
+  for (p = (const guchar *) fonts, i = 0; i < n_fonts * sizeof (guint32); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+
+  return hash;
+}
+
+static void
+compute_fingerprint (FcConfig  *config,
+                     FcFontSet *fonts,
+                     guint8     fingerprint[32])
+{
+  GChecksum *checksum;
+  FcStrList *dirs;
+  FcChar8 *dir;
+  gsize len = 32;
+  int i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  for (i = 0; i < fonts->nfont; i++)
+    {
+      FcChar8 *file;
+      int index;
+      guint32 hash;
+
+      if (FcPatternGetString (fonts->fonts[i], FC_FILE, 0, &file) == FcResultMatch)
+        g_checksum_update (checksum, file, strlen ((const char *) file) + 1);
+      if (FcPatternGetInteger (fonts->fonts[i], FC_INDEX, 0, &index) == FcResultMatch)
+        g_checksum_update (checksum, (const guchar *) &index, sizeof (int));
+
+      hash = FcPatternHash (fonts->fonts[i]);
+      g_checksum_update (checksum, (const guchar *) &hash, sizeof (guint32));
+    }
+
+  dirs = FcConfigGetCacheDirs (config);
+  if (dirs)
+    {
+      while ((dir = FcStrListNext (dirs)))
+        g_checksum_update (checksum, dir, strlen ((const char *) dir) + 1);
+      FcStrListDone (dirs);
+    }
+
+  g_checksum_get_digest (checksum, fingerprint, &len);
+  g_checksum_free (checksum);
+}
+
+static void
+load_cache (PangoFcSortCache *cache)
+{
+  GMappedFile *mapped;
+  const char *data;
+  gsize len, pos;
+
+  mapped = g_mapped_file_new (cache->filename, FALSE, NULL);
+  if (!mapped)
+    return;
+
+  data = g_mapped_file_get_contents (mapped);
+  len = g_mapped_file_get_length (mapped);
+
+  if (len < sizeof (CacheHeader) ||
+      memcmp (data, &cache->header, sizeof (CacheHeader)) != 0)
+    {
+      g_mapped_file_unref (mapped);
+      return;
+    }
+
+  pos = sizeof (CacheHeader);
+  while (len - pos >= sizeof (RecordHeader))
+    {
+      RecordHeader record;
+      const char *key;
+      const guint32 *fonts;
+      Entry *entry;
+      guint i;
+
+      memcpy (&record, data + pos, sizeof (RecordHeader));
+
+      if (record.key_len == 0 ||
+          record.key_len % 4 != 0 ||
+          record.key_len > len - pos - sizeof (RecordHeader) ||
+          record.n_fonts > cache->header.n_fonts ||
+          record.n_fonts * sizeof (guint32) > len - pos - sizeof (RecordHeader) - record.key_len)
+        break;
+
+      key = data + pos + sizeof (RecordHeader);
+      fonts = (const guint32 *) (const void *) (key + record.key_len);
+
+      if (key[record.key_len - 1] != '\0' ||
+          record.checksum != record_checksum (&cache->header, key, record.key_len, fonts, record.n_fonts))
+        break;
+
+      for (i = 0; i < record.n_fonts; i++)
+        if (fonts[i] >= cache->header.n_fonts)
+          break;
+      if (i < record.n_fonts)
+        break;
+
+      entry = g_new0 (Entry, 1);
+      entry->n_fonts = record.n_fonts;
+      entry->fonts = fonts;
+      g_hash_table_replace (cache->entries, g_strdup (key), entry);
+
+      pos += sizeof (RecordHeader) + record.key_len + record.n_fonts * sizeof (guint32);
+    }
+
+  cache->mapped = mapped;
+
+  /* If we stopped early, we rewrite the file when we store the next
+   * record, since records appended after garbage would be lost.
+   */
+  cache->header_written = pos == len;
+}
+
+/*
+ * pango_fc_sort_cache_new:
+ * @config: the configuration
+ * @fonts: the fonts of @config that the results refer to
+ *
+ * Returns: (nullable): the sort cache for @config, or %NULL
+ *   if caching is not enabled
+ */
+PangoFcSortCache *
+pango_fc_sort_cache_new (FcConfig  *config,
+                         FcFontSet *fonts)
+{
+  PangoFcSortCache *cache;
+  const char *env;
+  int i;
+
+#ifdef HAVE_FCPATTERNITERSTART
+  env = g_getenv ("PANGO_FC_SORT_CACHE");
+#else
+  /* We can't key the records, see pattern_key() */
+  env = NULL;
+#endif
+  if (!env || !*env || strcmp (env, "0") == 0)
+    return NULL;
+
+  cache = g_atomic_rc_box_new0 (PangoFcSortCache);
+
+  if (g_path_is_absolute (env))
+    cache->filename = g_strdup (env);
+  else
+    cache->filename = g_build_filename (g_get_user_cache_dir (), "pango", "fc-sort.cache", NULL);
+
+  cache->fonts = FcFontSetCreate ();
+  for (i = 0; i < fonts->nfont; i++)
+    {
+      FcPatternReference (fonts->fonts[i]);
+      FcFontSetAdd (cache->fonts, fonts->fonts[i]);
+    }
+
+  memcpy (cache->header.magic, CACHE_MAGIC, sizeof (cache->header.magic));
+  cache->header.version = CACHE_VERSION;
+  cache->header.n_fonts = fonts->nfont;
+  compute_fingerprint (config, fonts, cache->header.fingerprint);
+
+  g_mutex_init (&cache->mutex);
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, entry_free);
+
+  load_cache (cache);
+
+  return cache;
+}
+
+PangoFcSortCache *
+pango_fc_sort_cache_ref (PangoFcSortCache *cache)
+{
+  return g_atomic_rc_box_acquire (cache);
+}
+
+static void
+free_sort_cache (gpointer data)
+{
+  PangoFcSortCache *cache = data;
+
+  g_hash_table_destroy (cache->entries);
+  g_clear_pointer (&cache->mapped, g_mapped_file_unref);
+  g_clear_pointer (&cache->font_index, g_hash_table_destroy);
+  FcFontSetDestroy (cache->fonts);
+  g_mutex_clear (&cache->mutex);
+  g_free (cache->filename);
+}
+
+void
+pango_fc_sort_cache_unref (PangoFcSortCache *cache)
+{
+  g_atomic_rc_box_release_full (cache, free_sort_cache);
+}
+
+static FcFontSet *
+lookup_key (PangoFcSortCache *cache,
+            const char       *key)
+{
+  Entry *entry;
+  FcFontSet *result = NULL;
+
+  g_mutex_lock (&cache->mutex);
+
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (entry)
+    {
+      guint i;
+
+      result = FcFontSetCreate ();
+      for (i = 0; i < entry->n_fonts; i++)
+        {
+          FcPattern *font = cache->fonts->fonts[entry->fonts[i]];
+
+          FcPatternReference (font);
+          FcFontSetAdd (result, font);
+        }
+    }
+
+  g_mutex_unlock (&cache->mutex);
+
+  return result;
+}
+
+/* FcNameUnparse() rounds doubles, so we build our own keys, from
+ * the exact values of the pattern. Returns %NULL for patterns that
+ * we can't key, such as ones with FreeType faces in them.
+ */
+static char *
+pattern_key (FcPattern *pattern)
+{
+#ifdef HAVE_FCPATTERNITERSTART
+  GString *key;
+  FcPatternIter iter;
+  gboolean valid;
+  char buf[4][G_ASCII_DTOSTR_BUF_SIZE];
+
+  key = g_string_new (NULL);
+
+  FcPatternIterStart (pattern, &iter);
+  for (valid = FcPatternIterIsValid (pattern, &iter);
+       valid;
+       valid = FcPatternIterNext (pattern, &iter))
+    {
+      const char *object = FcPatternIterGetObject (pattern, &iter);
+      int n_values = FcPatternIterValueCount (pattern, &iter);
+      int i;
+
+      g_string_append_printf (key, ":%s", object);
+
+      for (i = 0; i < n_values; i++)
+        {
+          FcValue value;
+          FcValueBinding binding;
+          double begin, end;
+
+          if (FcPatternIterGetValue (pattern, &iter, i, &value, &binding) != FcResultMatch)
+            goto fail;
+
+          g_string_append_printf (key, "%c%d", i == 0 ? '=' : ',', binding);
+
+          switch ((int) value.type)
+            {
+            case FcTypeVoid:
+              g_string_append_c (key, 'v');
+              break;
+
+            case FcTypeInteger:
+              g_string_append_printf (key, "i%d", value.u.i);
+              break;
+
+            case FcTypeDouble:
+              g_string_append_printf (key, "d%s",
+                                      g_ascii_dtostr (buf[0], sizeof (buf[0]), value.u.d));
+              break;
+
+            case FcTypeString:
+              g_string_append_printf (key, "s%" G_GSIZE_FORMAT ":%s",
+                                      strlen ((const char *) value.u.s), value.u.s);
+              break;
+
+            case FcTypeBool:
+              g_string_append_printf (key, "b%d", value.u.b);
+              break;
+
+            case FcTypeMatrix:
+              g_string_append_printf (key, "m%s %s %s %s",
+                                      g_ascii_dtostr (buf[0], sizeof (buf[0]), value.u.m->xx),
+                                      g_ascii_dtostr (buf[1], sizeof (buf[1]), value.u.m->xy),
+                                      g_ascii_dtostr (buf[2], sizeof (buf[2]), value.u.m->yx),
+                                      g_ascii_dtostr (buf[3], sizeof (buf[3]), value.u.m->yy));
+              break;
+
+            case FcTypeRange:
+              FcRangeGetDouble (value.u.r, &begin, &end);
+              g_string_append_printf (key, "r%s %s",
+                                      g_ascii_dtostr (buf[0], sizeof (buf[0]), begin),
+                                      g_ascii_dtostr (buf[1], sizeof (buf[1]), end));
+              break;
+
+            case FcTypeCharSet:
+            case FcTypeLangSet:
+              {
+                /* These unparse exactly */
+                FcPattern *tmp;
+                FcChar8 *str;
+
+                tmp = FcPatternCreate ();
+                FcPatternAdd (tmp, object, value, FcTrue);
+                str = FcNameUnparse (tmp);
+                FcPatternDestroy (tmp);
+                if (!str)
+                  goto fail;
+
+                g_string_append_printf (key, "c%" G_GSIZE_FORMAT ":%s", strlen ((const char *) str), str);
+                FcStrFree (str);
+              }
+              break;
+
+            default:
+              goto fail;
+            }
+        }
+    }
+
+  return g_string_free (key, FALSE);
+
+fail:
+  g_string_free (key, TRUE);
+#endif
+
+  return NULL;
+}
+
+/*
+ * pango_fc_sort_cache_lookup:
+ * @cache: a `PangoFcSortCache`
+ * @pattern: the search pattern
+ *
+ * Returns: (nullable): the sorted fonts for @pattern,
+ *   or %NULL if they are not in the cache
+ */
+FcFontSet *
+pango_fc_sort_cache_lookup (PangoFcSortCache *cache,
+                            FcPattern        *pattern)
+{
+  char *key;
+  FcFontSet *result;
+
+  key = pattern_key (pattern);
+  if (!key)
+    return NULL;
+
+  result = lookup_key (cache, key);
+
+  g_free (key);
+
+  return result;
+}
+
+/*
+ * pango_fc_sort_cache_lookup_families:
+ * @cache: a `PangoFcSortCache`
+ *
+ * Returns: (nullable): the fonts of the configuration, grouped
+ *   by family, or %NULL if they are not in the cache
+ */
+FcFontSet *
+pango_fc_sort_cache_lookup_families (PangoFcSortCache *cache)
+{
+  return lookup_key (cache, FAMILIES_KEY);
+}
+
+static gboolean
+write_record (PangoFcSortCache *cache,
+              const char       *record,
+              gsize             record_len)
+{
+  CacheHeader header;
+  FILE *file;
+  gboolean ok;
+
+  if (!cache->header_written)
+    {
+      char *dir;
+      char *contents;
+
+      dir = g_path_get_dirname (cache->filename);
+      g_mkdir_with_parents (dir, 0700);
+      g_free (dir);
+
+      contents = g_malloc (sizeof (CacheHeader) + record_len);
+      memcpy (contents, &cache->header, sizeof (CacheHeader));
+      memcpy (contents + sizeof (CacheHeader), record, record_len);
+
+      ok = g_file_set_contents (cache->filename, contents, sizeof (CacheHeader) + record_len, NULL);
+      g_free (contents);
+
+      if (ok)
+        cache->header_written = TRUE;
+
+      return ok;
+    }
+
+  file = g_fopen (cache->filename, "r+b");
+  if (!file)
+    return FALSE;
+
+  /* Another process may have replaced the file with one for
+   * other fonts since we loaded it, so check the header again,
+   * and keep other writers out until we are done appending.
+   * The lock goes away when we close the file.
+   */
+#ifdef G_OS_UNIX
+  {
+    struct flock lock = { 0, };
+    int res;
+
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while ((res = fcntl (fileno (file), F_SETLKW, &lock)) < 0 && errno == EINTR)
+      ;
+
+    if (res < 0)
+      {
+        fclose (file);
+        return FALSE;
+      }
+  }
+#endif
+
+  ok = fread (&header, sizeof (CacheHeader), 1, file) == 1 &&
+       memcmp (&header, &cache->header, sizeof (CacheHeader)) == 0 &&
+       fseek (file, 0, SEEK_END) == 0;
+
+  /* Other processes append to it too */
+  if (ok)
+    {
+      long size = ftell (file);
+
+      ok = size >= 0 && size + record_len <= MAX_CACHE_SIZE;
+    }
+
+  if (ok)
+    ok = fwrite (record, 1, record_len, file) == record_len;
+
+  ok = (fclose (file) == 0) && ok;
+
+  return ok;
+}
+
+static void
+add_key (PangoFcSortCache *cache,
+         const char       *key,
+         FcFontSet        *sorted)
+{
+  guint key_len;
+  guint32 *fonts = NULL;
+  char *record;
+  gsize record_len;
+  RecordHeader header;
+  Entry *entry;
+  int i;
+
+  g_mutex_lock (&cache->mutex);
+
+  if (g_hash_table_contains (cache->entries, key))
+    goto out;
+
+  if (!cache->font_index)
+    {
+      cache->font_index = g_hash_table_new (NULL, NULL);
+      for (i = 0; i < cache->fonts->nfont; i++)
+        g_hash_table_insert (cache->font_index, cache->fonts->fonts[i], GUINT_TO_POINTER (i + 1));
+    }
+
+  fonts = g_new (guint32, sorted->nfont);
+  for (i = 0; i < sorted->nfont; i++)
+    {
+      guint pos = GPOINTER_TO_UINT (g_hash_table_lookup (cache->font_index, sorted->fonts[i]));
+
+      /* Not one of our fonts, so we can't store it */
+      if (pos == 0)
+        goto out;
+
+      fonts[i] = pos - 1;
+    }
+
+  key_len = (strlen (key) + 4) & ~3;
+
+  header.key_len = key_len;
+  header.n_fonts = sorted->nfont;
+  header.reserved = 0;
+
+  record_len = sizeof (RecordHeader) + key_len + sorted->nfont * sizeof (guint32);
+  record = g_malloc0 (record_len);
+  strcpy (record + sizeof (RecordHeader), key);
+  memcpy (record + sizeof (RecordHeader) + key_len, fonts, sorted->nfont * sizeof (guint32));
+  header.checksum = record_checksum (&cache->header, record + sizeof (RecordHeader), key_len, fonts, sorted->nfont);
+  memcpy (record, &header, sizeof (RecordHeader));
+
+  write_record (cache, record, record_len);
+  g_free (record);
+
+  entry = g_new0 (Entry, 1);
+  entry->n_fonts = sorted->nfont;
+  entry->fonts = entry->owned_fonts = fonts;
+  fonts = NULL;
+  g_hash_table_insert (cache->entries, g_strdup (key), entry);
+
+out:
+  g_mutex_unlock (&cache->mutex);
+
+  g_free (fonts);
+}
+
+/*
+ * pango_fc_sort_cache_add:
+ * @cache: a `PangoFcSortCache`
+ * @pattern: the search pattern
+ * @sorted: the result of sorting the fonts for @pattern
+ *
+ * Stores @sorted in the cache. This can be called from
+ * any thread.
+ */
+void
+pango_fc_sort_cache_add (PangoFcSortCache *cache,
+                         FcPattern        *pattern,
+                         FcFontSet        *sorted)
+{
+  char *key;
+
+  if (!sorted)
+    return;
+
+  key = pattern_key (pattern);
+  if (!key)
+    return;
+
+  add_key (cache, key, sorted);
+
+  g_free (key);
+}
+
+/*
+ * pango_fc_sort_cache_add_families:
+ * @cache: a `PangoFcSortCache`
+ * @grouped: the fonts of the configuration, grouped by family
+ *
+ * Stores @grouped in the cache, so that later runs can
+ * list the families without going through all the fonts.
+ * This can be called from any thread.
+ */
+void
+pango_fc_sort_cache_add_families (PangoFcSortCache *cache,
+                                  FcFontSet        *grouped)
+{
+  add_key (cache, FAMILIES_KEY, grouped);
+}
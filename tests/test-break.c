@@ -373,6 +373,93 @@ test_break (gconstpointer d)
   g_free (expected_file);
 }
 
+static void
+test_break_attrs (void)
+{
+  const char *text = "One. Two. Three.";
+  PangoLogAttr log_attrs[17];
+  PangoAttrList *attrs;
+  PangoAttribute *attr;
+
+  pango_get_log_attrs (text, -1, -1, pango_language_from_string ("en"), log_attrs, 17);
+
+  g_assert_true (log_attrs[5].is_sentence_boundary);
+  g_assert_true (log_attrs[10].is_sentence_boundary);
+  g_assert_true (log_attrs[5].is_line_break);
+  g_assert_true (log_attrs[10].is_line_break);
+
+  attrs = pango_attr_list_new ();
+
+  attr = pango_attr_sentence_new ();
+  attr->start_index = 0;
+  attr->end_index = 9;
+  pango_attr_list_insert (attrs, attr);
+
+  attr = pango_attr_word_new ();
+  attr->start_index = 5;
+  attr->end_index = 16;
+  pango_attr_list_insert (attrs, attr);
+
+  attr = pango_attr_allow_breaks_new (FALSE);
+  attr->start_index = 8;
+  attr->end_index = 16;
+  pango_attr_list_insert (attrs, attr);
+
+  pango_attr_break (text, -1, attrs, 0, log_attrs, 17);
+
+  /* The sentence attribute joins the first two sentences */
+  g_assert_false (log_attrs[5].is_sentence_boundary);
+  g_assert_true (log_attrs[9].is_sentence_boundary);
+  g_assert_true (log_attrs[9].is_sentence_end);
+
+  /* The word attribute allows a line break at its start,
+   * but allow_breaks=false wins inside its own range
+   */
+  g_assert_true (log_attrs[5].is_word_start);
+  g_assert_true (log_attrs[5].is_line_break);
+  g_assert_false (log_attrs[10].is_word_boundary);
+  g_assert_false (log_attrs[10].is_line_break);
+  g_assert_false (log_attrs[10].is_char_break);
+
+  pango_attr_list_unref (attrs);
+}
+
+static void
+test_break_hyphens (void)
+{
+  const char *text = "abcdefghijklmnopqrst";
+  PangoLogAttr log_attrs[21];
+  PangoAttrList *attrs;
+  PangoAttribute *attr;
+
+  pango_get_log_attrs (text, -1, -1, pango_language_from_string ("en"), log_attrs, 21);
+
+  g_assert_true (log_attrs[2].break_inserts_hyphen);
+  g_assert_true (log_attrs[7].break_inserts_hyphen);
+  g_assert_true (log_attrs[15].break_inserts_hyphen);
+
+  attrs = pango_attr_list_new ();
+
+  attr = pango_attr_insert_hyphens_new (FALSE);
+  attr->start_index = 0;
+  attr->end_index = 20;
+  pango_attr_list_insert (attrs, attr);
+
+  attr = pango_attr_insert_hyphens_new (TRUE);
+  attr->start_index = 5;
+  attr->end_index = 10;
+  pango_attr_list_insert (attrs, attr);
+
+  pango_attr_break (text, -1, attrs, 0, log_attrs, 21);
+
+  /* The nested range keeps its hyphens */
+  g_assert_false (log_attrs[2].break_inserts_hyphen);
+  g_assert_true (log_attrs[7].break_inserts_hyphen);
+  g_assert_false (log_attrs[15].break_inserts_hyphen);
+
+  pango_attr_list_unref (attrs);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -432,6 +519,9 @@ main (int argc, char *argv[])
 
   g_test_init (&argc, &argv, NULL);
 
+  g_test_add_func ("/break/attrs", test_break_attrs);
+  g_test_add_func ("/break/hyphens", test_break_hyphens);
+
   path = g_test_build_filename (G_TEST_DIST, "breaks", NULL);
   dir = g_dir_open (path, 0, &error);
   g_free (path);
@@ -537,6 +537,70 @@ test_set_gravity (void)
   pango_font_description_free (desc);
 }
 
+static void
+test_context_desc (void)
+{
+  PangoContext *context1, *context2;
+  PangoFontDescription *desc, *desc2;
+
+  context1 = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  context2 = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+
+  desc = pango_font_description_from_string ("Cantarell 11");
+  desc2 = pango_font_description_new ();
+  pango_font_description_set_family (desc2, "Cantarell");
+  pango_font_description_set_size (desc2, 11 * PANGO_SCALE);
+  g_assert_true (pango_font_description_equal (desc, desc2));
+
+  pango_context_set_font_description (context1, desc);
+  pango_context_set_font_description (context2, desc2);
+  pango_font_description_free (desc);
+  pango_font_description_free (desc2);
+
+  /* Equal descriptions with different masks are kept apart */
+  g_assert_cmpint (pango_font_description_get_set_fields (pango_context_get_font_description (context1)), ==,
+                   PANGO_FONT_MASK_FAMILY | PANGO_FONT_MASK_STYLE | PANGO_FONT_MASK_VARIANT |
+                   PANGO_FONT_MASK_WEIGHT | PANGO_FONT_MASK_STRETCH | PANGO_FONT_MASK_SIZE);
+  g_assert_cmpint (pango_font_description_get_set_fields (pango_context_get_font_description (context2)), ==,
+                   PANGO_FONT_MASK_FAMILY | PANGO_FONT_MASK_SIZE);
+
+  g_assert_true (pango_font_description_equal (pango_context_get_font_description (context1),
+                                               pango_context_get_font_description (context2)));
+  g_assert_cmpuint (pango_font_description_hash (pango_context_get_font_description (context1)), ==,
+                    pango_font_description_hash (pango_context_get_font_description (context2)));
+
+  /* Copies can be modified */
+  desc = pango_font_description_copy (pango_context_get_font_description (context1));
+  pango_font_description_set_size (desc, 20 * PANGO_SCALE);
+  g_assert_false (pango_font_description_equal (desc, pango_context_get_font_description (context1)));
+  g_assert_cmpint (pango_font_description_get_size (pango_context_get_font_description (context1)), ==, 11 * PANGO_SCALE);
+
+  pango_context_set_font_description (context2, desc);
+  pango_font_description_set_size (desc, 11 * PANGO_SCALE);
+  pango_context_set_font_description (context2, desc);
+  g_assert_true (pango_font_description_equal (pango_context_get_font_description (context1),
+                                               pango_context_get_font_description (context2)));
+  pango_font_description_free (desc);
+
+  /* Families that only differ in case are still equal, but each
+   * context keeps the family as it was given
+   */
+  desc = pango_font_description_from_string ("Sans 12");
+  pango_context_set_font_description (context1, desc);
+  pango_font_description_free (desc);
+  desc = pango_font_description_from_string ("sans 12");
+  pango_context_set_font_description (context2, desc);
+  pango_font_description_free (desc);
+
+  g_assert_cmpstr (pango_font_description_get_family (pango_context_get_font_description (context1)), ==, "Sans");
+  g_assert_cmpstr (pango_font_description_get_family (pango_context_get_font_description (context2)), ==, "sans");
+  g_assert_true (pango_font_description_equal (pango_context_get_font_description (context1),
+                                               pango_context_get_font_description (context2)));
+
+  g_object_unref (context2);
+  g_object_unref (context1);
+}
+
 static void
 test_match (void)
 {
@@ -574,6 +638,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/pango/fontdescription/to-filename", test_to_filename);
   g_test_add_func ("/pango/fontdescription/set-gravity", test_set_gravity);
   g_test_add_func ("/pango/fontdescription/match", test_match);
+  g_test_add_func ("/pango/fontdescription/context", test_context_desc);
   g_test_add_func ("/pango/font/extents", test_extents);
   g_test_add_func ("/pango/font/enumerate", test_enumerate);
   g_test_add_func ("/pango/font/roundtrip/plain", test_roundtrip_plain);
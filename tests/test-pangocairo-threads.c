@@ -1,8 +1,13 @@
+#include "config.h"
 #include <stdlib.h>
 #include <string.h>
 #include <pango/pango.h>
 #include <pango/pangocairo.h>
 
+#ifdef HAVE_CAIRO_FREETYPE
+#include <pango/pangocairo-fc.h>
+#endif
+
 #define WIDTH 100
 #define HEIGHT 100
 const char *text = "Hamburgerfonts\nวิวิวิวิวิวิ\nبهداد";
@@ -136,6 +141,163 @@ pangocairo_threads (void)
 
 }
 
+#ifdef HAVE_CAIRO_FREETYPE
+
+typedef struct
+{
+  cairo_surface_t *surface;
+  PangoFontMap *fontmap;
+} SharedData;
+
+static PangoLayout *
+create_layout_for_fontmap (cairo_t      *cr,
+                           PangoFontMap *fontmap)
+{
+  PangoContext *context;
+  PangoLayout *layout;
+
+  context = pango_font_map_create_context (fontmap);
+  pango_cairo_update_context (cr, context);
+
+  layout = pango_layout_new (context);
+  pango_layout_set_text (layout, text, -1);
+  pango_layout_set_width (layout, WIDTH * PANGO_SCALE);
+
+  g_object_unref (context);
+
+  return layout;
+}
+
+static gpointer
+shared_thread_func (gpointer user_data)
+{
+  SharedData *data = user_data;
+  PangoLayout *layout;
+  cairo_t *cr;
+  int i;
+
+  cr = cairo_create (data->surface);
+
+  g_mutex_lock (&mutex);
+  g_mutex_unlock (&mutex);
+
+  layout = create_layout_for_fontmap (cr, data->fontmap);
+
+  for (i = 0; i < num_iters; i++)
+    draw (cr, layout, i);
+
+  g_object_unref (layout);
+
+  cairo_destroy (cr);
+
+  return NULL;
+}
+
+/* Runs num_threads threads, either all sharing one thread-safe
+ * fontmap, or each with a fontmap of its own. Returns the elapsed
+ * time, and the surfaces in @surfaces.
+ */
+static double
+run_threads (gboolean   shared,
+             GPtrArray *surfaces)
+{
+  PangoFontMap *shared_fontmap = NULL;
+  GPtrArray *threads;
+  SharedData *data;
+  double elapsed;
+  int i;
+
+  if (shared)
+    shared_fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP,
+                                   "thread-safe", TRUE,
+                                   NULL);
+
+  threads = g_ptr_array_new ();
+  data = g_new0 (SharedData, num_threads);
+
+  g_mutex_lock (&mutex);
+
+  for (i = 0; i < num_threads; i++)
+    {
+      data[i].surface = create_surface ();
+      if (shared)
+        data[i].fontmap = g_object_ref (shared_fontmap);
+      else
+        data[i].fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+
+      g_ptr_array_add (surfaces, data[i].surface);
+      g_ptr_array_add (threads, g_thread_new ("shared", shared_thread_func, &data[i]));
+    }
+
+  g_test_timer_start ();
+
+  g_mutex_unlock (&mutex);
+
+  for (i = 0; i < num_threads; i++)
+    g_thread_join (g_ptr_array_index (threads, i));
+
+  elapsed = g_test_timer_elapsed ();
+
+  for (i = 0; i < num_threads; i++)
+    g_object_unref (data[i].fontmap);
+
+  g_free (data);
+  g_ptr_array_unref (threads);
+  g_clear_object (&shared_fontmap);
+
+  return elapsed;
+}
+
+static void
+pangocairo_threads_shared_fontmap (void)
+{
+  GPtrArray *surfaces;
+  cairo_surface_t *ref_surface;
+  PangoFontMap *fontmap;
+  PangoLayout *layout;
+  cairo_t *cr;
+  double shared_time, private_time;
+  int i;
+
+  surfaces = g_ptr_array_new_with_free_func ((GDestroyNotify) cairo_surface_destroy);
+
+  private_time = run_threads (FALSE, surfaces);
+  shared_time = run_threads (TRUE, surfaces);
+
+  g_test_message ("%d threads, %d iterations: %.3fs with private fontmaps, %.3fs with a shared fontmap",
+                  num_threads, num_iters, private_time, shared_time);
+
+  ref_surface = create_surface ();
+  cr = cairo_create (ref_surface);
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  layout = create_layout_for_fontmap (cr, fontmap);
+
+  draw (cr, layout, num_iters - 1);
+
+  g_object_unref (layout);
+  g_object_unref (fontmap);
+  cairo_destroy (cr);
+
+  for (i = 0; i < surfaces->len; i++)
+    {
+      cairo_surface_t *surface = g_ptr_array_index (surfaces, i);
+
+      if (memcmp (cairo_image_surface_get_data (ref_surface),
+                  cairo_image_surface_get_data (surface),
+                  WIDTH * HEIGHT) != 0)
+        {
+          g_test_message ("image for thread %d different from reference image", i);
+          g_test_fail ();
+          break;
+        }
+    }
+
+  cairo_surface_destroy (ref_surface);
+  g_ptr_array_unref (surfaces);
+}
+
+#endif
+
 int
 main (int argc, char **argv)
 {
@@ -147,6 +309,9 @@ main (int argc, char **argv)
     num_iters = atoi (argv[2]);
 
   g_test_add_func ("/pangocairo/threads", pangocairo_threads);
+#ifdef HAVE_CAIRO_FREETYPE
+  g_test_add_func ("/pangocairo/threads/shared-fontmap", pangocairo_threads_shared_fontmap);
+#endif
 
   return g_test_run ();
 }
@@ -660,6 +660,26 @@ test_list_change12 (void)
   pango_attr_list_unref (list);
 }
 
+static void
+test_list_change13 (void)
+{
+  PangoAttrList *list;
+  PangoAttribute *attr;
+
+  list = pango_attr_list_from_string ("5 20 size 2\n"
+                                      "6 -1 size 1\n");
+
+  /* joining must not shrink an attribute that was already
+   * extended by an earlier join
+   */
+  attr = attribute_from_string ("0 10 size 1");
+  pango_attr_list_change (list, attr);
+
+  assert_attr_list (list, "0 -1 size 1");
+
+  pango_attr_list_unref (list);
+}
+
 static void
 test_list_splice (void)
 {
@@ -953,6 +973,56 @@ test_iter_get_font (void)
   pango_attr_list_unref (list);
 }
 
+static void
+test_iter_get_font_colors (void)
+{
+  PangoAttrList *list;
+  PangoAttrIterator *iter;
+  const char *expected[] = {
+    "Times 10", "Times 10", "Times Bold 10", "Times Bold 20",
+    "Sans Italic 20", "Times Bold 20", "Times 10", "Times 10",
+  };
+  int i;
+
+  list = pango_attr_list_from_string ("0 -1 family Times\n"
+                                      "0 -1 size 10240\n"
+                                      "0 5 foreground #ff0000\n"
+                                      "5 10 foreground #00ff00\n"
+                                      "10 30 weight bold\n"
+                                      "10 15 foreground #ff0000\n"
+                                      "15 30 scale 2\n"
+                                      "15 25 foreground #00ff00\n"
+                                      "20 25 font-desc \"Sans Italic\"\n"
+                                      "25 30 foreground #ff0000\n"
+                                      "30 35 foreground #00ff00\n"
+                                      "35 40 foreground #ff0000\n");
+
+  iter = pango_attr_list_get_iterator (list);
+  i = 0;
+  do
+    {
+      PangoFontDescription *desc, *desc2;
+      GSList *attrs;
+
+      desc = pango_font_description_from_string ("Cantarell 12");
+      pango_attr_iterator_get_font (iter, desc, NULL, &attrs);
+      desc2 = pango_font_description_from_string (expected[i]);
+      g_assert_true (pango_font_description_equal (desc, desc2));
+      g_assert_cmpint (g_slist_length (attrs), ==, 1);
+      g_slist_free_full (attrs, (GDestroyNotify)pango_attribute_destroy);
+      pango_font_description_free (desc);
+      pango_font_description_free (desc2);
+
+      i++;
+    }
+  while (pango_attr_iterator_next (iter) && i < (int) G_N_ELEMENTS (expected));
+
+  g_assert_cmpint (i, ==, G_N_ELEMENTS (expected));
+
+  pango_attr_iterator_destroy (iter);
+  pango_attr_list_unref (list);
+}
+
 static void
 test_iter_get_attrs (void)
 {
@@ -1184,6 +1254,52 @@ test_insert2 (void)
   pango_attr_list_unref (list);
 }
 
+static void
+test_insert_array (void)
+{
+  PangoAttrList *list;
+  PangoAttribute *attrs[4];
+  char *s;
+
+  list = pango_attr_list_from_string ("0 10 size 10240\n");
+
+  /* Sorted, after the existing attributes */
+  attrs[0] = attribute_from_string ("0 5 weight bold");
+  attrs[1] = attribute_from_string ("5 20 style italic");
+  attrs[2] = attribute_from_string ("5 8 rise 100");
+  attrs[3] = attribute_from_string ("12 30 family Times");
+  pango_attr_list_insert_array (list, attrs, 4);
+
+  s = pango_attr_list_to_string (list);
+  g_assert_cmpstr (s, ==, "0 10 size 10240\n"
+                          "0 5 weight bold\n"
+                          "5 20 style italic\n"
+                          "5 8 rise 100\n"
+                          "12 30 family Times");
+  g_free (s);
+
+  /* Unsorted, interleaved with the existing attributes */
+  attrs[0] = attribute_from_string ("20 25 stretch 2");
+  attrs[1] = attribute_from_string ("5 15 foreground red");
+  attrs[2] = attribute_from_string ("1 2 underline single");
+  attrs[3] = attribute_from_string ("5 6 strikethrough true");
+  pango_attr_list_insert_array (list, attrs, 4);
+
+  s = pango_attr_list_to_string (list);
+  g_assert_cmpstr (s, ==, "0 10 size 10240\n"
+                          "0 5 weight bold\n"
+                          "1 2 underline single\n"
+                          "5 20 style italic\n"
+                          "5 8 rise 100\n"
+                          "5 15 foreground #ffff00000000\n"
+                          "5 6 strikethrough true\n"
+                          "12 30 family Times\n"
+                          "20 25 stretch condensed");
+  g_free (s);
+
+  pango_attr_list_unref (list);
+}
+
 static gboolean
 attr_list_merge_filter (PangoAttribute *attribute,
                         gpointer        list)
@@ -1420,6 +1536,145 @@ test_pitivi_crash (void)
   pango_attr_list_unref (list);
 }
 
+static gboolean
+just_rise (PangoAttribute *attribute, gpointer user_data)
+{
+  return attribute->klass->type == PANGO_ATTR_RISE;
+}
+
+/* Exercise the balancing of large lists, built out of order */
+static void
+test_list_large (void)
+{
+  PangoAttrList *list, *list2;
+  PangoAttrIterator *iter;
+  PangoAttribute *attr;
+  GSList *attrs;
+  int i, n;
+
+  list = pango_attr_list_new ();
+
+  for (i = 999; i >= 0; i--)
+    {
+      attr = pango_attr_rise_new (i % 2);
+      attr->start_index = 2 * i;
+      attr->end_index = 2 * i + 2;
+      pango_attr_list_change (list, attr);
+
+      attr = pango_attr_size_new (i);
+      attr->start_index = i;
+      attr->end_index = i + 10;
+      pango_attr_list_insert_before (list, attr);
+    }
+
+  assert_attr_list_order (list);
+
+  attrs = pango_attr_list_get_attributes (list);
+  g_assert_cmpint (g_slist_length (attrs), ==, 2000);
+  g_slist_free_full (attrs, (GDestroyNotify) pango_attribute_destroy);
+
+  /* Adjacent equal attributes get merged */
+  attr = pango_attr_rise_new (0);
+  attr->start_index = 0;
+  attr->end_index = 2000;
+  pango_attr_list_change (list, attr);
+
+  list2 = pango_attr_list_filter (list, just_rise, NULL);
+  assert_attr_list (list2, "0 2000 rise 0\n");
+  pango_attr_list_unref (list2);
+
+  iter = pango_attr_list_get_iterator (list);
+  n = 0;
+  do
+    {
+      int start, end;
+
+      pango_attr_iterator_range (iter, &start, &end);
+      if (start < 1009)
+        {
+          attr = pango_attr_iterator_get (iter, PANGO_ATTR_SIZE);
+          g_assert_nonnull (attr);
+          g_assert_cmpint (((PangoAttrInt *)attr)->value, ==, MIN (start, 999));
+        }
+      n++;
+    }
+  while (pango_attr_iterator_next (iter));
+  g_assert_cmpint (n, ==, 1010);
+  pango_attr_iterator_destroy (iter);
+
+  pango_attr_list_update (list, 0, 500, 0);
+  assert_attr_list_order (list);
+
+  pango_attr_list_unref (list);
+}
+
+/* Many overlapping attributes, ending in a different order than they start */
+static void
+test_iter_overlap (void)
+{
+  PangoAttrList *list;
+  PangoAttrIterator *iter, *copy;
+  PangoAttribute *attr;
+  GSList *attrs;
+  int start, end;
+  int i;
+
+  list = pango_attr_list_new ();
+
+  for (i = 0; i < 100; i++)
+    {
+      attr = pango_attr_size_new (i);
+      attr->start_index = i;
+      attr->end_index = 200 - i;
+      pango_attr_list_insert (list, attr);
+
+      attr = pango_attr_rise_new (i);
+      attr->start_index = i;
+      attr->end_index = i + 10;
+      pango_attr_list_insert (list, attr);
+    }
+
+  iter = pango_attr_list_get_iterator (list);
+
+  for (i = 0; i < 200; i++)
+    {
+      pango_attr_iterator_range (iter, &start, &end);
+      g_assert_cmpint (start, ==, i);
+      g_assert_cmpint (end, ==, i + 1);
+
+      attr = pango_attr_iterator_get (iter, PANGO_ATTR_SIZE);
+      g_assert_nonnull (attr);
+      g_assert_cmpint (((PangoAttrInt *)attr)->value, ==, i < 100 ? i : 199 - i);
+
+      attr = pango_attr_iterator_get (iter, PANGO_ATTR_RISE);
+      if (i < 109)
+        g_assert_cmpint (((PangoAttrInt *)attr)->value, ==, MIN (i, 99));
+      else
+        g_assert_null (attr);
+
+      attrs = pango_attr_iterator_get_attrs (iter);
+      g_assert_cmpint (g_slist_length (attrs), ==, i < 109 ? 2 : 1);
+      g_slist_free_full (attrs, (GDestroyNotify) pango_attribute_destroy);
+
+      if (i == 150)
+        {
+          copy = pango_attr_iterator_copy (iter);
+          pango_attr_iterator_next (copy);
+          attr = pango_attr_iterator_get (copy, PANGO_ATTR_SIZE);
+          g_assert_cmpint (((PangoAttrInt *)attr)->value, ==, 48);
+          pango_attr_iterator_destroy (copy);
+        }
+
+      g_assert_true (pango_attr_iterator_next (iter));
+    }
+
+  g_assert_null (pango_attr_iterator_get_attrs (iter));
+  g_assert_false (pango_attr_iterator_next (iter));
+
+  pango_attr_iterator_destroy (iter);
+  pango_attr_list_unref (list);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -1442,6 +1697,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/attributes/list/change10", test_list_change10);
   g_test_add_func ("/attributes/list/change11", test_list_change11);
   g_test_add_func ("/attributes/list/change12", test_list_change12);
+  g_test_add_func ("/attributes/list/change13", test_list_change13);
   g_test_add_func ("/attributes/list/splice", test_list_splice);
   g_test_add_func ("/attributes/list/splice2", test_list_splice2);
   g_test_add_func ("/attributes/list/splice3", test_list_splice3);
@@ -1452,16 +1708,20 @@ main (int argc, char *argv[])
   g_test_add_func ("/attributes/list/equal", test_list_equal);
   g_test_add_func ("/attributes/list/insert", test_insert);
   g_test_add_func ("/attributes/list/insert2", test_insert2);
+  g_test_add_func ("/attributes/list/insert-array", test_insert_array);
   g_test_add_func ("/attributes/list/merge", test_merge);
   g_test_add_func ("/attributes/list/merge2", test_merge2);
   g_test_add_func ("/attributes/iter/basic", test_iter);
   g_test_add_func ("/attributes/iter/get", test_iter_get);
   g_test_add_func ("/attributes/iter/get_font", test_iter_get_font);
+  g_test_add_func ("/attributes/iter/get_font_colors", test_iter_get_font_colors);
   g_test_add_func ("/attributes/iter/get_attrs", test_iter_get_attrs);
   g_test_add_func ("/attributes/iter/epsilon_zero", test_iter_epsilon_zero);
+  g_test_add_func ("/attributes/iter/overlap", test_iter_overlap);
   g_test_add_func ("/attributes/gnumeric-splice", test_gnumeric_splice);
   g_test_add_func ("/attributes/list/change_order", test_change_order);
   g_test_add_func ("/attributes/pitivi-crash", test_pitivi_crash);
+  g_test_add_func ("/attributes/list/large", test_list_large);
 
   return g_test_run ();
 }
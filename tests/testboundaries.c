@@ -320,12 +320,173 @@ test_boundaries (void)
   g_free (text);
 }
 
+/* Runs of ASCII letters take a bulk path in the default
+ * break algorithm. Check that the result matches what the
+ * rules give for letters inside a word, regardless of whether
+ * the length of the text is known.
+ */
+static void
+test_ascii_runs (void)
+{
+  const char *text = "Pneumonoultramicroscopicsilicovolcanoconiosis is a word, "
+                     "and so is supercalifragilisticexpialidocious.\n"
+                     "x\xe0\xa4\x95\xe0\xa5\x8d" "yz abc\xcc\x81" "def ABCdef123ghi";
+  PangoLogAttr *attrs, *attrs2;
+  const char *p;
+  gunichar prev_wc;
+  int len, i;
+
+  len = g_utf8_strlen (text, -1);
+  attrs = g_new0 (PangoLogAttr, len + 1);
+  attrs2 = g_new0 (PangoLogAttr, len + 1);
+
+  pango_get_log_attrs (text, -1, 0, pango_language_from_string ("C"), attrs, len + 1);
+  pango_get_log_attrs (text, strlen (text), 0, pango_language_from_string ("C"), attrs2, len + 1);
+
+  g_assert_true (memcmp (attrs, attrs2, sizeof (PangoLogAttr) * (len + 1)) == 0);
+
+  check_invariants (text);
+
+  for (p = text, i = 0, prev_wc = 0; *p; p = g_utf8_next_char (p), i++)
+    {
+      gunichar wc = g_utf8_get_char (p);
+
+      if (i > 1 &&
+          g_ascii_isalpha (wc) && g_ascii_isalpha (prev_wc) &&
+          g_ascii_isalpha (g_utf8_get_char (g_utf8_prev_char (g_utf8_prev_char (p)))))
+        {
+          g_assert_true (attrs[i].is_cursor_position);
+          g_assert_true (attrs[i].is_char_break);
+          g_assert_true (attrs[i].break_inserts_hyphen);
+          g_assert_false (attrs[i].is_line_break);
+          g_assert_false (attrs[i].is_word_boundary);
+          g_assert_false (attrs[i].is_word_start);
+          g_assert_false (attrs[i].is_word_end);
+          g_assert_false (attrs[i].is_sentence_boundary);
+          g_assert_false (attrs[i].is_white);
+        }
+
+      prev_wc = wc;
+    }
+
+  g_free (attrs);
+  g_free (attrs2);
+}
+
+static void
+check_update (const char *text,
+              int         offset,
+              int         n_removed,
+              const char *insert)
+{
+  PangoLanguage *lang = pango_language_from_string ("en");
+  GString *str;
+  const char *p, *q;
+  PangoLogAttr *attrs, *expected;
+  int len, new_len, attrs_len;
+
+  str = g_string_new ("");
+  p = g_utf8_offset_to_pointer (text, offset);
+  q = g_utf8_offset_to_pointer (p, n_removed);
+  g_string_append_len (str, text, p - text);
+  g_string_append (str, insert);
+  g_string_append (str, q);
+
+  len = g_utf8_strlen (text, -1);
+  attrs = g_new0 (PangoLogAttr, len + 1);
+  pango_get_log_attrs (text, -1, -1, lang, attrs, len + 1);
+
+  attrs = pango_update_log_attrs (str->str, str->len, -1, lang,
+                                  offset, n_removed, g_utf8_strlen (insert, -1),
+                                  attrs, len + 1, &attrs_len);
+
+  new_len = g_utf8_strlen (str->str, -1);
+  g_assert_cmpint (attrs_len, ==, new_len + 1);
+
+  expected = g_new0 (PangoLogAttr, new_len + 1);
+  pango_get_log_attrs (str->str, -1, -1, lang, expected, new_len + 1);
+
+  g_assert_true (memcmp (attrs, expected, sizeof (PangoLogAttr) * (new_len + 1)) == 0);
+
+  g_free (attrs);
+  g_free (expected);
+  g_string_free (str, TRUE);
+}
+
+/* Updating log attrs for an edit must give the
+ * same result as computing them from scratch.
+ */
+static void
+test_update (void)
+{
+  const char *text = "Hello world. This is a line.\n"
+                     "Second line, with words\r\n"
+                     "Third line.\r"
+                     "And the end. Done";
+
+  check_update (text, 6, 5, "there");
+  check_update (text, 12, 0, " More text.");
+  check_update (text, 28, 1, "");
+  check_update (text, 29, 0, "\n");
+  check_update (text, 0, 0, "Oh. ");
+  check_update (text, 0, 5, "");
+  check_update (text, 52, 0, "\n");
+  check_update (text, 53, 0, "\r");
+  check_update (text, 55, 0, "\n");
+  check_update (text, 83, 0, ". Really");
+  check_update (text, 66, 0, "\n");
+  check_update (text, 66, 1, "ne\n");
+  check_update (text, 10, 50, "");
+  check_update (text, 0, 83, "");
+  check_update ("", 0, 0, "New text.\nMore");
+}
+
+/* Segmenting paragraphs in parallel must give
+ * the same result as doing it all at once.
+ */
+static void
+test_parallel (void)
+{
+  PangoLanguage *lang = pango_language_from_string ("en");
+  GString *str;
+  PangoLogAttr *attrs, *expected;
+  int len, i;
+
+  str = g_string_new ("");
+  for (i = 0; i < 5000; i++)
+    {
+      g_string_append_printf (str, "Paragraph %d. It has some words, and sentences.", i);
+      if (i % 3 == 0)
+        g_string_append (str, "\r\n");
+      else if (i % 3 == 1)
+        g_string_append (str, "\n");
+      else
+        g_string_append (str, "\xe2\x80\xa9");
+    }
+
+  len = g_utf8_strlen (str->str, -1);
+  attrs = g_new0 (PangoLogAttr, len + 1);
+  expected = g_new0 (PangoLogAttr, len + 1);
+
+  pango_get_log_attrs (str->str, str->len, -1, lang, expected, len + 1);
+  pango_get_log_attrs_parallel (str->str, str->len, -1, lang, attrs, len + 1, 4);
+
+  g_assert_true (memcmp (attrs, expected, sizeof (PangoLogAttr) * (len + 1)) == 0);
+
+  g_free (attrs);
+  g_free (expected);
+  g_string_free (str, TRUE);
+}
+
 int
 main (int argc, char *argv[])
 {
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/text/boundaries", test_boundaries);
+  g_test_add_func ("/text/ascii-runs", test_ascii_runs);
+  g_test_add_func ("/text/update", test_update);
+  g_test_add_func ("/text/parallel", test_parallel);
 
   return g_test_run ();
 }
@@ -21,10 +21,12 @@
 
 #include "config.h"
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <pango/pangocairo.h>
 
 #ifdef HAVE_CAIRO_FREETYPE
 #include <pango/pango-ot.h>
+#include <pango/pangocairo-fc.h>
 #endif
 
 /* test that we don't crash in shape_tab when the layout
@@ -818,6 +820,785 @@ test_small_caps_crash (void)
   g_object_unref (context);
 }
 
+/* Log attrs for paragraphs beyond the height limit are computed on demand */
+static void
+test_log_attrs_height (void)
+{
+  PangoContext *context;
+  PangoLayout *layout;
+  const char *text = "One paragraph.\nAnother one, with more words.\nAnd a third.";
+  PangoLogAttr *attrs;
+  const PangoLogAttr *attrs2;
+  int n_attrs, n_attrs2;
+
+  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  layout = pango_layout_new (context);
+  pango_layout_set_text (layout, text, -1);
+
+  pango_layout_get_log_attrs (layout, &attrs, &n_attrs);
+  g_assert_cmpint (n_attrs, ==, g_utf8_strlen (text, -1) + 1);
+
+  pango_layout_set_text (layout, text, -1);
+  pango_layout_set_ellipsize (layout, PANGO_ELLIPSIZE_END);
+  pango_layout_set_height (layout, 0);
+  g_assert_cmpint (pango_layout_get_line_count (layout), ==, 1);
+
+  attrs2 = pango_layout_get_log_attrs_readonly (layout, &n_attrs2);
+  g_assert_cmpint (n_attrs, ==, n_attrs2);
+  g_assert_true (memcmp (attrs, attrs2, sizeof (PangoLogAttr) * n_attrs) == 0);
+
+  pango_layout_set_text (layout, text, -1);
+  g_assert_cmpint (pango_layout_get_line_count (layout), ==, 1);
+  pango_layout_set_height (layout, -1);
+  g_assert_cmpint (pango_layout_get_line_count (layout), ==, 3);
+
+  attrs2 = pango_layout_get_log_attrs_readonly (layout, &n_attrs2);
+  g_assert_true (memcmp (attrs, attrs2, sizeof (PangoLogAttr) * n_attrs) == 0);
+
+  g_free (attrs);
+  g_object_unref (layout);
+  g_object_unref (context);
+}
+
+static int
+compare_attr_type (gconstpointer a,
+                   gconstpointer b)
+{
+  const PangoAttribute *attr = a;
+
+  return attr->klass->type == GPOINTER_TO_INT (b) ? 0 : 1;
+}
+
+/* Check that changes to the attribute list are picked up
+ * on relayout, even though the layout holds on to the
+ * attributes it split out of it.
+ */
+static void
+test_attrs_changed (void)
+{
+  PangoContext *context;
+  PangoLayout *layout;
+  PangoAttrList *attrs;
+  PangoAttribute *attr;
+  PangoLayoutIter *iter;
+  PangoLayoutRun *run;
+  int height, height2;
+
+  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  layout = pango_layout_new (context);
+  pango_layout_set_text (layout, "Some text", -1);
+
+  attrs = pango_attr_list_new ();
+  pango_attr_list_insert (attrs, pango_attr_size_new (10 * PANGO_SCALE));
+  pango_layout_set_attributes (layout, attrs);
+
+  pango_layout_get_size (layout, NULL, &height);
+
+  attr = pango_attr_size_new (40 * PANGO_SCALE);
+  pango_attr_list_change (attrs, attr);
+  attr = pango_attr_underline_new (PANGO_UNDERLINE_SINGLE);
+  pango_attr_list_insert (attrs, attr);
+  pango_layout_context_changed (layout);
+
+  pango_layout_get_size (layout, NULL, &height2);
+  g_assert_cmpint (height2, >, height);
+
+  iter = pango_layout_get_iter (layout);
+  run = pango_layout_iter_get_run (iter);
+  g_assert_nonnull (run);
+  g_assert_nonnull (g_slist_find_custom (run->item->analysis.extra_attrs,
+                                         GINT_TO_POINTER (PANGO_ATTR_UNDERLINE),
+                                         compare_attr_type));
+  pango_layout_iter_free (iter);
+
+  pango_attr_list_unref (attrs);
+  g_object_unref (layout);
+  g_object_unref (context);
+}
+
+static void
+test_paint_attrs_changed (void)
+{
+  const char *text = "Some text עברית more text";
+  PangoContext *context;
+  PangoLayout *layout, *layout2;
+  PangoLayoutLine *line;
+  PangoAttrList *attrs, *attrs2;
+  PangoAttribute *attr;
+  GBytes *bytes, *bytes2;
+
+  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  layout = pango_layout_new (context);
+  pango_layout_set_text (layout, text, -1);
+
+  attrs = pango_attr_list_new ();
+  attr = pango_attr_foreground_new (0xffff, 0, 0);
+  attr->start_index = 2;
+  attr->end_index = 12;
+  pango_attr_list_insert (attrs, attr);
+  pango_layout_set_attributes (layout, attrs);
+  pango_attr_list_unref (attrs);
+
+  line = pango_layout_get_line_readonly (layout, 0);
+
+  /* Only change attributes that affect drawing */
+  attrs = pango_attr_list_new ();
+  attr = pango_attr_underline_new (PANGO_UNDERLINE_SINGLE);
+  attr->start_index = 8;
+  attr->end_index = 18;
+  pango_attr_list_insert (attrs, attr);
+  attr = pango_attr_foreground_new (0, 0xffff, 0);
+  attr->start_index = 14;
+  attr->end_index = 24;
+  pango_attr_list_insert (attrs, attr);
+  pango_layout_set_attributes (layout, attrs);
+
+  /* The lines are kept */
+  g_assert_true (pango_layout_get_line_readonly (layout, 0) == line);
+
+  layout2 = pango_layout_new (context);
+  pango_layout_set_text (layout2, text, -1);
+  pango_layout_set_attributes (layout2, attrs);
+
+  bytes = pango_layout_serialize (layout, PANGO_LAYOUT_SERIALIZE_OUTPUT);
+  bytes2 = pango_layout_serialize (layout2, PANGO_LAYOUT_SERIALIZE_OUTPUT);
+  g_assert_true (g_bytes_equal (bytes, bytes2));
+  g_bytes_unref (bytes);
+  g_bytes_unref (bytes2);
+
+  /* Changes that affect shaping still cause a relayout */
+  attrs2 = pango_attr_list_copy (attrs);
+  pango_attr_list_unref (attrs);
+  attrs = attrs2;
+  attr = pango_attr_letter_spacing_new (10 * PANGO_SCALE);
+  pango_attr_list_insert (attrs, attr);
+  pango_layout_set_attributes (layout, attrs);
+  pango_layout_set_attributes (layout2, attrs);
+
+  bytes = pango_layout_serialize (layout, PANGO_LAYOUT_SERIALIZE_OUTPUT);
+  bytes2 = pango_layout_serialize (layout2, PANGO_LAYOUT_SERIALIZE_OUTPUT);
+  g_assert_true (g_bytes_equal (bytes, bytes2));
+  g_bytes_unref (bytes);
+  g_bytes_unref (bytes2);
+
+  pango_attr_list_unref (attrs);
+  g_object_unref (layout2);
+  g_object_unref (layout);
+  g_object_unref (context);
+}
+
+#ifdef HAVE_CAIRO_FREETYPE
+static void
+test_fontmap_trim (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontset, *fontset2;
+  PangoFont *font, *font2;
+  PangoLanguage *language;
+  hb_face_t *hb_face;
+  PangoAnalysis analysis = { 0, };
+  PangoGlyphString *glyphs;
+  const char *families[] = { "Cantarell", "DejaVu Sans", "Sans", "Serif", "Monospace" };
+
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  context = pango_font_map_create_context (fontmap);
+  language = pango_language_from_string ("en");
+
+  pango_fc_font_map_set_cache_limits (PANGO_FC_FONT_MAP (fontmap), 2, 1);
+
+  desc = pango_font_description_from_string ("Cantarell 11");
+  fontset = pango_font_map_load_fontset (fontmap, context, desc, language);
+  font = pango_fontset_get_font (fontset, 'a');
+  hb_face = pango_fc_font_map_get_hb_face (PANGO_FC_FONT_MAP (fontmap), PANGO_FC_FONT (font));
+
+  /* Push more fontsets through the cache than it can hold */
+  for (int i = 0; i < (int) G_N_ELEMENTS (families); i++)
+    {
+      PangoFontDescription *desc2;
+      PangoFontset *tmp;
+      PangoFont *tmp_font;
+      PangoCoverage *coverage;
+
+      desc2 = pango_font_description_from_string (families[i]);
+      pango_font_description_set_size (desc2, 20 * PANGO_SCALE);
+      tmp = pango_font_map_load_fontset (fontmap, context, desc2, language);
+      tmp_font = pango_fontset_get_font (tmp, 'a');
+      coverage = pango_font_get_coverage (tmp_font, language);
+      g_assert_true (pango_coverage_get (coverage, 'a') == PANGO_COVERAGE_EXACT);
+
+      g_object_unref (coverage);
+      g_object_unref (tmp_font);
+      g_object_unref (tmp);
+      pango_font_description_free (desc2);
+    }
+
+  pango_fc_font_map_trim (PANGO_FC_FONT_MAP (fontmap), 255);
+
+  /* The fontset is recreated, but reuses the font that is still alive */
+  fontset2 = pango_font_map_load_fontset (fontmap, context, desc, language);
+  g_assert_true (fontset2 != fontset);
+  font2 = pango_fontset_get_font (fontset2, 'a');
+  g_assert_true (font2 == font);
+
+  /* The face we were handed is still alive, and the font still shapes */
+  g_assert_cmpuint (hb_face_get_glyph_count (hb_face), >, 0);
+
+  analysis.font = font;
+  analysis.script = PANGO_SCRIPT_LATIN;
+  analysis.language = language;
+  glyphs = pango_glyph_string_new ();
+  pango_shape_full ("abc", 3, NULL, 0, &analysis, glyphs);
+  g_assert_cmpint (glyphs->num_glyphs, ==, 3);
+  for (int i = 0; i < glyphs->num_glyphs; i++)
+    g_assert_false (glyphs->glyphs[i].glyph & PANGO_GLYPH_UNKNOWN_FLAG);
+  pango_glyph_string_free (glyphs);
+
+  g_object_unref (font2);
+  g_object_unref (fontset2);
+  g_object_unref (font);
+  g_object_unref (fontset);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+  g_object_unref (fontmap);
+}
+
+typedef struct {
+  gunichar wc;
+  PangoFont *font;
+} CoverageData;
+
+static gboolean
+find_covering_font (PangoFontset *fontset,
+                    PangoFont    *font,
+                    gpointer      user_data)
+{
+  CoverageData *data = user_data;
+  PangoCoverage *coverage;
+
+  coverage = pango_font_get_coverage (font, pango_fontset_get_language (fontset));
+  if (pango_coverage_get (coverage, data->wc) == PANGO_COVERAGE_EXACT)
+    data->font = font;
+  g_object_unref (coverage);
+
+  return data->font != NULL;
+}
+
+static void
+test_fontset_get_font (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontset;
+  gunichar chars[] = { 'a', 'b', 0xe9, 0x3b1, 0x430, 0x5d0, 0x627, 0x2192, 0x4e00, 0x1f600, 'c' };
+
+  fontmap = pango_cairo_font_map_get_default ();
+  if (!PANGO_IS_FC_FONT_MAP (fontmap))
+    {
+      g_test_skip ("Not an fc fontmap. Skipping...");
+      return;
+    }
+
+  context = pango_font_map_create_context (fontmap);
+  desc = pango_font_description_from_string ("Cantarell 11");
+  fontset = pango_font_map_load_fontset (fontmap, context, desc, pango_language_from_string ("en"));
+
+  /* The result must be the first font with exact coverage, no matter
+   * in which order the characters are looked up
+   */
+  for (int i = 0; i < (int) G_N_ELEMENTS (chars); i++)
+    {
+      PangoFont *font;
+      CoverageData data = { chars[i], NULL };
+
+      font = pango_fontset_get_font (fontset, chars[i]);
+      pango_fontset_foreach (fontset, find_covering_font, &data);
+      if (data.font)
+        g_assert_true (data.font == font);
+
+      g_object_unref (font);
+    }
+
+  g_object_unref (fontset);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+}
+
+static void
+test_fontset_shared_chain (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontsets[3];
+  const char *langs[] = { "en", "de", "fr" };
+  gunichar chars[] = { 'a', 0xe9, 0x3b1, 0x430, 0x627, 0x4e00, 0x1f600, 'b' };
+
+  /* Fontsets for languages with the same fallback fonts share
+   * them once the sort is done; lookups have to stay consistent
+   * with iteration while that happens.
+   */
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  context = pango_font_map_create_context (fontmap);
+  desc = pango_font_description_from_string ("Cantarell 11");
+
+  for (int j = 0; j < (int) G_N_ELEMENTS (langs); j++)
+    fontsets[j] = pango_font_map_load_fontset (fontmap, context, desc,
+                                               pango_language_from_string (langs[j]));
+
+  for (int i = 0; i < (int) G_N_ELEMENTS (chars); i++)
+    {
+      for (int j = 0; j < (int) G_N_ELEMENTS (langs); j++)
+        {
+          PangoFont *font;
+          CoverageData data = { chars[i], NULL };
+
+          g_assert_true (pango_fontset_get_language (fontsets[j]) == pango_language_from_string (langs[j]));
+
+          font = pango_fontset_get_font (fontsets[j], chars[i]);
+          pango_fontset_foreach (fontsets[j], find_covering_font, &data);
+          if (data.font)
+            g_assert_true (data.font == font);
+
+          g_object_unref (font);
+        }
+    }
+
+  for (int j = 0; j < (int) G_N_ELEMENTS (langs); j++)
+    g_object_unref (fontsets[j]);
+
+  pango_font_description_free (desc);
+  g_object_unref (context);
+  g_object_unref (fontmap);
+}
+
+static void
+test_fontmap_shared_face (void)
+{
+  PangoFontMap *fontmap1, *fontmap2;
+  PangoContext *context1, *context2;
+  PangoFontDescription *desc;
+  PangoFont *font1, *font2;
+  PangoCoverage *coverage1, *coverage2;
+
+  fontmap1 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  fontmap2 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  context1 = pango_font_map_create_context (fontmap1);
+  context2 = pango_font_map_create_context (fontmap2);
+
+  desc = pango_font_description_from_string ("Cantarell 11");
+  font1 = pango_font_map_load_font (fontmap1, context1, desc);
+  font2 = pango_font_map_load_font (fontmap2, context2, desc);
+  g_assert_true (font1 != font2);
+
+  coverage1 = pango_font_get_coverage (font1, NULL);
+  coverage2 = pango_font_get_coverage (font2, NULL);
+  g_assert_true (coverage1 == coverage2);
+
+  g_assert_true (hb_font_get_face (pango_font_get_hb_font (font1)) ==
+                 hb_font_get_face (pango_font_get_hb_font (font2)));
+
+  g_object_unref (coverage1);
+  g_object_unref (coverage2);
+  g_object_unref (font1);
+  g_object_unref (font2);
+  pango_font_description_free (desc);
+  g_object_unref (context1);
+  g_object_unref (context2);
+  g_object_unref (fontmap1);
+  g_object_unref (fontmap2);
+}
+
+static void
+families_changed (GListModel *model,
+                  guint       position,
+                  guint       removed,
+                  guint       added,
+                  gpointer    data)
+{
+  guint *n_announced = data;
+
+  g_assert_cmpuint (position, ==, *n_announced);
+  g_assert_cmpuint (removed, ==, 0);
+
+  *n_announced += added;
+}
+
+static void
+test_fontmap_background_families (void)
+{
+  PangoFontMap *fontmap1, *fontmap2;
+  PangoFontFamily **families;
+  int n_families;
+  guint n_announced = 0;
+
+  fontmap1 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  pango_font_map_list_families (fontmap1, &families, &n_families);
+
+  fontmap2 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  g_signal_connect (fontmap2, "items-changed", G_CALLBACK (families_changed), &n_announced);
+  pango_fc_font_map_load_families_in_background (PANGO_FC_FONT_MAP (fontmap2));
+
+  while (n_announced < n_families)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (n_announced, ==, n_families);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (fontmap2)), ==, n_families);
+
+  for (int i = 0; i < n_families; i++)
+    {
+      PangoFontFamily *family = g_list_model_get_item (G_LIST_MODEL (fontmap2), i);
+
+      g_assert_cmpstr (pango_font_family_get_name (family), ==, pango_font_family_get_name (families[i]));
+      g_object_unref (family);
+    }
+
+  g_free (families);
+  g_object_unref (fontmap2);
+
+  /* Asking for the full list waits for the thread */
+  fontmap2 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  pango_fc_font_map_load_families_in_background (PANGO_FC_FONT_MAP (fontmap2));
+  pango_font_map_list_families (fontmap2, &families, &n_families);
+  g_assert_cmpint (n_families, ==, g_list_model_get_n_items (G_LIST_MODEL (fontmap1)));
+
+  g_free (families);
+  g_object_unref (fontmap2);
+  g_object_unref (fontmap1);
+}
+
+static void
+test_fontmap_variations (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontset1, *fontset2, *fontset3;
+  PangoLanguage *language;
+
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  context = pango_font_map_create_context (fontmap);
+  language = pango_language_from_string ("en");
+
+  desc = pango_font_description_from_string ("Cantarell 11");
+
+  /* Equivalent variations give the same fontset */
+  pango_font_description_set_variations (desc, "wght=400,wdth=100");
+  fontset1 = pango_font_map_load_fontset (fontmap, context, desc, language);
+  pango_font_description_set_variations (desc, "wdth=90,wdth=100,wght=400.001");
+  fontset2 = pango_font_map_load_fontset (fontmap, context, desc, language);
+  g_assert_true (fontset1 == fontset2);
+
+  pango_font_description_set_variations (desc, "wght=700,wdth=100");
+  fontset3 = pango_font_map_load_fontset (fontmap, context, desc, language);
+  g_assert_true (fontset1 != fontset3);
+
+  g_object_unref (fontset1);
+  g_object_unref (fontset2);
+  g_object_unref (fontset3);
+
+  /* Animating an axis doesn't push other fontsets out of the cache */
+  pango_fc_font_map_set_cache_limits (PANGO_FC_FONT_MAP (fontmap), 32, 0);
+
+  pango_font_description_set_variations (desc, NULL);
+  fontset3 = pango_font_map_load_fontset (fontmap, context, desc, language);
+  g_object_add_weak_pointer (G_OBJECT (fontset3), (gpointer *) &fontset3);
+  g_object_unref (fontset3);
+
+  for (int i = 0; i < 100; i++)
+    {
+      char *variations = g_strdup_printf ("wght=%d", 100 + 8 * i);
+
+      pango_font_description_set_variations (desc, variations);
+      fontset1 = pango_font_map_load_fontset (fontmap, context, desc, language);
+      g_assert_nonnull (fontset1);
+      g_object_unref (fontset1);
+      g_free (variations);
+    }
+
+  g_assert_nonnull (fontset3);
+  g_object_remove_weak_pointer (G_OBJECT (fontset3), (gpointer *) &fontset3);
+
+  pango_font_description_free (desc);
+  g_object_unref (context);
+  g_object_unref (fontmap);
+}
+
+static void
+add_font_file (FcConfig   *config,
+               const char *name)
+{
+  char *path;
+
+  path = g_test_build_filename (G_TEST_DIST, "fonts", name, NULL);
+  g_assert_true (FcConfigAppFontAddFile (config, (const FcChar8 *) path));
+  g_free (path);
+}
+
+static void
+assert_same_families (PangoFontMap *fontmap,
+                      FcConfig     *config)
+{
+  PangoFontMap *fontmap2;
+  PangoFontFamily **families;
+  int n_families;
+
+  fontmap2 = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  pango_fc_font_map_set_config (PANGO_FC_FONT_MAP (fontmap2), config);
+  pango_font_map_list_families (fontmap2, &families, &n_families);
+
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (fontmap)), ==, n_families);
+  for (int i = 0; i < n_families; i++)
+    {
+      PangoFontFamily *family = g_list_model_get_item (G_LIST_MODEL (fontmap), i);
+
+      g_assert_cmpstr (pango_font_family_get_name (family), ==, pango_font_family_get_name (families[i]));
+      g_object_unref (family);
+    }
+
+  g_free (families);
+  g_object_unref (fontmap2);
+}
+
+static gboolean
+count_fonts (PangoFontset *fontset,
+             PangoFont    *font,
+             gpointer      data)
+{
+  (*(int *) data)++;
+
+  return FALSE;
+}
+
+static void
+test_fontmap_add_fonts (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontset, *fontset2;
+  PangoFontFamily *family, *family2;
+  FcConfig *config;
+  guint serial;
+  int n_fonts = 0;
+
+  config = FcConfigCreate ();
+  add_font_file (config, "DejaVuSans.ttf");
+  add_font_file (config, "fa-regular-f2db.ttf");
+
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  pango_fc_font_map_set_config (PANGO_FC_FONT_MAP (fontmap), config);
+  context = pango_font_map_create_context (fontmap);
+
+  desc = pango_font_description_from_string ("DejaVu Sans 11");
+  fontset = pango_font_map_load_fontset (fontmap, context, desc, pango_language_from_string ("en"));
+  pango_fontset_foreach (fontset, count_fonts, &n_fonts);
+  g_assert_cmpint (n_fonts, >, 0);
+  g_object_add_weak_pointer (G_OBJECT (fontset), (gpointer *) &fontset);
+  g_object_unref (fontset);
+
+  family = g_list_model_get_item (G_LIST_MODEL (fontmap), 0);
+  g_assert_cmpstr (pango_font_family_get_name (family), ==, "DejaVu Sans");
+
+  /* A font that covers nothing new for the fontset keeps it,
+   * and the families that it doesn't belong to
+   */
+  serial = pango_font_map_get_serial (fontmap);
+  add_font_file (config, "fa-solid-f2db.ttf");
+  pango_fc_font_map_config_changed (PANGO_FC_FONT_MAP (fontmap));
+
+  g_assert_nonnull (fontset);
+  g_assert_cmpuint (pango_font_map_get_serial (fontmap), ==, serial);
+  fontset2 = pango_font_map_load_fontset (fontmap, context, desc, pango_language_from_string ("en"));
+  g_assert_true (fontset2 == fontset);
+  g_object_unref (fontset2);
+
+  assert_same_families (fontmap, config);
+  family2 = g_list_model_get_item (G_LIST_MODEL (fontmap), 0);
+  g_assert_true (family2 == family);
+  g_object_unref (family2);
+
+  /* A font that covers new characters replaces it */
+  add_font_file (config, "amiri-06dd.ttf");
+  pango_fc_font_map_config_changed (PANGO_FC_FONT_MAP (fontmap));
+
+  g_assert_null (fontset);
+  g_assert_cmpuint (pango_font_map_get_serial (fontmap), !=, serial);
+
+  assert_same_families (fontmap, config);
+
+  g_object_unref (family);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+  g_object_unref (fontmap);
+  FcConfigDestroy (config);
+}
+
+/* Magic, version, number of fonts and fingerprint */
+#define SORT_CACHE_HEADER_SIZE 48
+#define SORT_CACHE_FINGERPRINT_OFFSET 16
+
+static int
+sort_fonts_for_family (PangoFontMap *fontmap,
+                       const char   *family)
+{
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFontset *fontset;
+  int n_fonts = 0;
+
+  context = pango_font_map_create_context (fontmap);
+  desc = pango_font_description_from_string (family);
+  fontset = pango_font_map_load_fontset (fontmap, context, desc, pango_language_from_string ("en"));
+  pango_fontset_foreach (fontset, count_fonts, &n_fonts);
+
+  g_object_unref (fontset);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+
+  return n_fonts;
+}
+
+static PangoFontMap *
+fontmap_new_for_config (FcConfig *config)
+{
+  PangoFontMap *fontmap;
+
+  fontmap = g_object_new (PANGO_TYPE_CAIRO_FC_FONT_MAP, NULL);
+  pango_fc_font_map_set_config (PANGO_FC_FONT_MAP (fontmap), config);
+
+  return fontmap;
+}
+
+static gsize
+get_file_size (const char *filename)
+{
+  char *contents;
+  gsize len;
+
+  g_assert_true (g_file_get_contents (filename, &contents, &len, NULL));
+  g_free (contents);
+
+  return len;
+}
+
+static void
+test_fontmap_sort_cache (void)
+{
+  PangoFontMap *fontmap;
+  FcConfig *config;
+  char *dir, *filename;
+  char *contents, *full;
+  gsize len, full_len;
+  gsize size1, size2;
+  int n_fonts1, n_fonts2;
+
+#ifndef HAVE_FCPATTERNITERSTART
+  g_test_skip ("The sort cache needs FcPatternIterStart");
+  return;
+#endif
+
+  dir = g_dir_make_tmp ("pango-sort-cache-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+  filename = g_build_filename (dir, "fc-sort.cache", NULL);
+  g_setenv ("PANGO_FC_SORT_CACHE", filename, TRUE);
+
+  config = FcConfigCreate ();
+  add_font_file (config, "DejaVuSans.ttf");
+  add_font_file (config, "fa-regular-f2db.ttf");
+
+  /* Each sort adds a record */
+  fontmap = fontmap_new_for_config (config);
+  n_fonts1 = sort_fonts_for_family (fontmap, "DejaVu Sans");
+  size1 = get_file_size (filename);
+  g_assert_cmpuint (size1, >, SORT_CACHE_HEADER_SIZE);
+  n_fonts2 = sort_fonts_for_family (fontmap, "Serif");
+  size2 = get_file_size (filename);
+  g_assert_cmpuint (size2, >, size1);
+  g_object_unref (fontmap);
+
+  g_assert_true (g_file_get_contents (filename, &full, &full_len, NULL));
+  g_assert_cmpuint (full_len, ==, size2);
+
+  /* Another fontmap finds both results in the cache,
+   * so it has nothing to add to it
+   */
+  fontmap = fontmap_new_for_config (config);
+  g_assert_cmpint (sort_fonts_for_family (fontmap, "DejaVu Sans"), ==, n_fonts1);
+  g_assert_cmpint (sort_fonts_for_family (fontmap, "Serif"), ==, n_fonts2);
+  g_assert_cmpuint (get_file_size (filename), ==, size2);
+  g_object_unref (fontmap);
+
+  /* A cache for other fonts is ignored, and replaced */
+  contents = g_malloc (full_len);
+  memcpy (contents, full, full_len);
+  contents[SORT_CACHE_FINGERPRINT_OFFSET] ^= 0xff;
+  g_assert_true (g_file_set_contents (filename, contents, full_len, NULL));
+  g_free (contents);
+
+  fontmap = fontmap_new_for_config (config);
+  g_assert_cmpint (sort_fonts_for_family (fontmap, "DejaVu Sans"), ==, n_fonts1);
+  g_assert_true (g_file_get_contents (filename, &contents, &len, NULL));
+  g_assert_cmpuint (len, ==, size1);
+  g_assert_true (memcmp (contents, full, size1) == 0);
+  g_free (contents);
+  g_object_unref (fontmap);
+
+  /* A truncated or garbled last record is dropped, but the
+   * records before it still load. Storing the missing result
+   * rewrites the file from scratch.
+   */
+  for (int i = 0; i < 2; i++)
+    {
+      contents = g_malloc (full_len);
+      memcpy (contents, full, full_len);
+      len = full_len;
+      if (i == 0)
+        len -= 4;
+      else
+        contents[full_len - 1] ^= 0xff;
+      g_assert_true (g_file_set_contents (filename, contents, len, NULL));
+      g_free (contents);
+
+      fontmap = fontmap_new_for_config (config);
+      g_assert_cmpint (sort_fonts_for_family (fontmap, "DejaVu Sans"), ==, n_fonts1);
+      g_assert_cmpuint (get_file_size (filename), ==, len);
+      g_assert_cmpint (sort_fonts_for_family (fontmap, "Serif"), ==, n_fonts2);
+      g_assert_cmpuint (get_file_size (filename), ==, SORT_CACHE_HEADER_SIZE + size2 - size1);
+      g_object_unref (fontmap);
+    }
+
+  /* Records are not appended to a cache that another
+   * process replaced with one for other fonts meanwhile
+   */
+  g_assert_true (g_file_set_contents (filename, full, size1, NULL));
+
+  fontmap = fontmap_new_for_config (config);
+  g_assert_cmpint (sort_fonts_for_family (fontmap, "DejaVu Sans"), ==, n_fonts1);
+
+  contents = g_malloc (size1);
+  memcpy (contents, full, size1);
+  contents[SORT_CACHE_FINGERPRINT_OFFSET] ^= 0xff;
+  g_assert_true (g_file_set_contents (filename, contents, size1, NULL));
+
+  g_assert_cmpint (sort_fonts_for_family (fontmap, "Serif"), ==, n_fonts2);
+  g_assert_cmpuint (get_file_size (filename), ==, size1);
+  g_object_unref (fontmap);
+  g_free (contents);
+
+  g_free (full);
+  FcConfigDestroy (config);
+
+  g_unsetenv ("PANGO_FC_SORT_CACHE");
+  g_remove (filename);
+  g_rmdir (dir);
+  g_free (filename);
+  g_free (dir);
+}
+#endif
+
 int
 main (int argc, char *argv[])
 {
@@ -853,6 +1634,19 @@ main (int argc, char *argv[])
   g_test_add_func ("/layout/wrap-char", test_wrap_char);
   g_test_add_func ("/matrix/transform-rectangle", test_transform_rectangle);
   g_test_add_func ("/itemize/small-caps-crash", test_small_caps_crash);
+  g_test_add_func ("/layout/log-attrs-height", test_log_attrs_height);
+  g_test_add_func ("/layout/attrs-changed", test_attrs_changed);
+  g_test_add_func ("/layout/paint-attrs-changed", test_paint_attrs_changed);
+#ifdef HAVE_CAIRO_FREETYPE
+  g_test_add_func ("/fontmap/trim", test_fontmap_trim);
+  g_test_add_func ("/fontset/get-font", test_fontset_get_font);
+  g_test_add_func ("/fontset/shared-chain", test_fontset_shared_chain);
+  g_test_add_func ("/fontmap/shared-face", test_fontmap_shared_face);
+  g_test_add_func ("/fontmap/background-families", test_fontmap_background_families);
+  g_test_add_func ("/fontmap/variations", test_fontmap_variations);
+  g_test_add_func ("/fontmap/add-fonts", test_fontmap_add_fonts);
+  g_test_add_func ("/fontmap/sort-cache", test_fontmap_sort_cache);
+#endif
 
   return g_test_run ();
 }
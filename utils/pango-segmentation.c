@@ -56,10 +56,10 @@ kind_from_string (const char *str)
 
 static gboolean
 show_segmentation (const char *input,
-                   BreakKind   kind)
+                   BreakKind   kind,
+                   int         threads)
 {
   GString *string;
-  PangoContext *context;
   gsize  length;
   GError *error = NULL;
   PangoLogAttr *attrs;
@@ -68,9 +68,6 @@ show_segmentation (const char *input,
   int i;
   char *text;
   PangoAttrList *attributes;
-  PangoLayout *layout;
-
-  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
 
   string = g_string_new ("");
 
@@ -80,11 +77,29 @@ show_segmentation (const char *input,
   pango_parse_markup (input, -1, 0, &attributes, &text, NULL, &error);
   g_assert_no_error (error);
 
-  layout = pango_layout_new (context);
-  pango_layout_set_text (layout, text, length);
-  pango_layout_set_attributes (layout, attributes);
+  if (threads >= 0)
+    {
+      /* This ignores the attributes */
+      len = g_utf8_strlen (text, -1) + 1;
+      attrs = g_new0 (PangoLogAttr, len);
+      pango_get_log_attrs_parallel (text, -1, -1, pango_language_get_default (),
+                                    attrs, len, threads);
+    }
+  else
+    {
+      PangoContext *context;
+      PangoLayout *layout;
+
+      context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+      layout = pango_layout_new (context);
+      pango_layout_set_text (layout, text, length);
+      pango_layout_set_attributes (layout, attributes);
 
-  pango_layout_get_log_attrs (layout, &attrs, &len);
+      pango_layout_get_log_attrs (layout, &attrs, &len);
+
+      g_object_unref (layout);
+      g_object_unref (context);
+    }
 
   for (i = 0, p = text; i < len; i++, p = g_utf8_next_char (p))
     {
@@ -126,7 +141,6 @@ show_segmentation (const char *input,
         }
     }
 
-  g_object_unref (layout);
   g_free (attrs);
   g_free (text);
   pango_attr_list_unref (attributes);
@@ -143,10 +157,12 @@ main (int argc, char *argv[])
 {
   const char *opt_kind = "grapheme";
   const char *opt_text = NULL;
+  int opt_threads = -1;
   gboolean opt_version = FALSE;
   GOptionEntry entries[] = {
     { "kind", 0, 0, G_OPTION_ARG_STRING, &opt_kind, "Kind of boundary (grapheme/word/line/sentence)", "KIND" },
     { "text", 0, 0, G_OPTION_ARG_STRING, &opt_text, "Text to display", "STRING" },
+    { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Segment paragraphs in parallel, ignoring markup (0 for one thread per CPU)", "N" },
     { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Show version" },
     { NULL, },
   };
@@ -192,7 +208,7 @@ main (int argc, char *argv[])
       exit (1);
     }
 
-  show_segmentation (text, kind_from_string (opt_kind));
+  show_segmentation (text, kind_from_string (opt_kind), opt_threads);
 
   return 0;
 }